@@ -0,0 +1,215 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include "compiler.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+namespace trieste
+{
+  /**
+   * A slab allocator for the nodes of one AST.
+   *
+   * Blocks are carved out of large chunks, and freed blocks are kept on a free
+   * list for reuse by later rewrites, so building and dropping a tree costs a
+   * handful of chunk allocations rather than one heap allocation per node.
+   * Chunks are aligned to their size, so the arena that owns a block can be
+   * found from the block's address alone.
+   *
+   * An arena is kept alive by every block allocated from it and by every open
+   * Scope, and releases all of its chunks at once when the last of these goes
+   * away. It is not thread-safe: an arena, and the nodes allocated from it,
+   * must only be used by one thread at a time.
+   */
+  class NodeArena
+  {
+  public:
+    static constexpr size_t chunk_size = 64 * 1024;
+
+  private:
+    struct Chunk
+    {
+      NodeArena* arena;
+      Chunk* next;
+    };
+
+    struct FreeBlock
+    {
+      FreeBlock* next;
+    };
+
+    static constexpr size_t align = alignof(std::max_align_t);
+    static constexpr size_t header_size =
+      (sizeof(Chunk) + align - 1) & ~(align - 1);
+
+    static constexpr size_t round_up(size_t size)
+    {
+      return (size + align - 1) & ~(align - 1);
+    }
+
+    size_t refs_{0};
+    size_t block_size_{0};
+    Chunk* chunks_{nullptr};
+    FreeBlock* free_{nullptr};
+    char* bump_{nullptr};
+    char* end_{nullptr};
+
+    NodeArena() = default;
+
+    ~NodeArena()
+    {
+      while (chunks_ != nullptr)
+      {
+        auto next = chunks_->next;
+        ::operator delete(chunks_, std::align_val_t(chunk_size));
+        chunks_ = next;
+      }
+    }
+
+    TRIESTE_SLOW_PATH void add_chunk()
+    {
+      auto chunk = static_cast<Chunk*>(
+        ::operator new(chunk_size, std::align_val_t(chunk_size)));
+      chunk->arena = this;
+      chunk->next = chunks_;
+      chunks_ = chunk;
+
+      bump_ = reinterpret_cast<char*>(chunk) + header_size;
+      end_ = reinterpret_cast<char*>(chunk) + chunk_size;
+    }
+
+  public:
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    /**
+     * Keep the arena alive without allocating from it.
+     */
+    void acquire()
+    {
+      refs_++;
+    }
+
+    /**
+     * Drop a reference taken by acquire().
+     */
+    void release()
+    {
+      assert(refs_ > 0);
+      if (--refs_ == 0)
+        delete this;
+    }
+
+    /**
+     * Create a new arena. It is freed once it has no live blocks and no open
+     * Scope, so it should be handed to a Scope straight away.
+     */
+    static NodeArena* make()
+    {
+      return new NodeArena();
+    }
+
+    /**
+     * The arena that nodes created on this thread are allocated from, or null
+     * if they are allocated from the heap.
+     */
+    static NodeArena* current()
+    {
+      return current_ref();
+    }
+
+    /**
+     * The arena that owns a block returned by allocate().
+     */
+    static NodeArena* of(const void* block)
+    {
+      auto chunk = reinterpret_cast<const Chunk*>(
+        reinterpret_cast<uintptr_t>(block) & ~(uintptr_t(chunk_size) - 1));
+      return chunk->arena;
+    }
+
+    /**
+     * Allocate a block. Every allocation from one arena must be the same size.
+     */
+    TRIESTE_FAST_PATH void* allocate(size_t size)
+    {
+      size = round_up(size);
+      assert((block_size_ == 0) || (block_size_ == size));
+      assert(header_size + size <= chunk_size);
+      block_size_ = size;
+
+      if (free_ != nullptr)
+      {
+        auto block = free_;
+        free_ = block->next;
+        acquire();
+        return block;
+      }
+
+      // Only take a reference once there is a block, so that a failure to
+      // add a chunk doesn't keep the arena alive.
+      if (TRIESTE_UNLIKELY(static_cast<size_t>(end_ - bump_) < size))
+        add_chunk();
+
+      auto block = bump_;
+      bump_ += size;
+      acquire();
+      return block;
+    }
+
+    /**
+     * Return a block to the arena that owns it. The object in it must already
+     * have been destroyed.
+     */
+    static void deallocate(void* block)
+    {
+      auto arena = of(block);
+      auto free = static_cast<FreeBlock*>(block);
+      free->next = arena->free_;
+      arena->free_ = free;
+      arena->release();
+    }
+
+    /**
+     * Makes an arena current for this thread until the end of the scope. A
+     * null arena makes nodes come from the heap.
+     */
+    class Scope
+    {
+    private:
+      NodeArena* arena_;
+      NodeArena* prev_;
+
+    public:
+      explicit Scope(NodeArena* arena) : arena_(arena), prev_(current_ref())
+      {
+        if (arena_ != nullptr)
+          arena_->acquire();
+
+        current_ref() = arena_;
+      }
+
+      Scope(const Scope&) = delete;
+      Scope& operator=(const Scope&) = delete;
+
+      ~Scope()
+      {
+        current_ref() = prev_;
+
+        if (arena_ != nullptr)
+          arena_->release();
+      }
+    };
+
+  private:
+    static NodeArena*& current_ref()
+    {
+      static thread_local NodeArena* arena{nullptr};
+      return arena;
+    }
+  };
+}
@@ -2,19 +2,29 @@
 // SPDX-License-Identifier: MIT
 #pragma once
 
+#include "arena.h"
 #include "intrusive_ptr.h"
 #include "token.h"
 
+#include <algorithm>
 #include <iostream>
 #include <limits>
+#include <new>
 #include <set>
 #include <sstream>
+#include <stdexcept>
 #include <vector>
 
 #ifndef TRIESTE_USE_CXX17
 #  include <span>
 #endif
 
+// Define this as 1 to count the nodes created on each thread, as reported by
+// NodeDef::allocations().
+#ifndef TRIESTE_AST_ENABLE_STATS
+#  define TRIESTE_AST_ENABLE_STATS 0
+#endif
+
 namespace trieste
 {
   struct indent
@@ -33,9 +43,206 @@ namespace trieste
   }
 
   using Nodes = std::vector<Node>;
-  using NodeIt = Nodes::iterator;
+  using NodeIt = Node*;
   using NodeSet = std::set<Node>;
 
+  namespace detail
+  {
+    /**
+     * The children of a NodeDef. This is a vector of nodes that keeps up to
+     * two children inline, so that leaves and small nodes don't need a
+     * separate allocation. Iterators are invalidated as for std::vector.
+     */
+    class NodeChildren
+    {
+    private:
+      static constexpr uint32_t inline_capacity = 2;
+
+      union
+      {
+        Node* heap_;
+        alignas(Node) unsigned char inline_[sizeof(Node) * inline_capacity];
+      };
+
+      uint32_t size_{0};
+      uint32_t capacity_{inline_capacity};
+
+      bool is_inline() const
+      {
+        return capacity_ == inline_capacity;
+      }
+
+      Node* data()
+      {
+        if (is_inline())
+          return std::launder(reinterpret_cast<Node*>(inline_));
+
+        return heap_;
+      }
+
+      const Node* data() const
+      {
+        return const_cast<NodeChildren*>(this)->data();
+      }
+
+      TRIESTE_SLOW_PATH void grow(size_t min_capacity)
+      {
+        size_t capacity = std::max<size_t>(min_capacity, size_t(capacity_) * 2);
+
+        if (capacity > std::numeric_limits<uint32_t>::max())
+          throw std::length_error("Too many children");
+
+        auto to = static_cast<Node*>(::operator new(capacity * sizeof(Node)));
+        auto from = data();
+
+        for (uint32_t i = 0; i < size_; i++)
+        {
+          new (to + i) Node(std::move(from[i]));
+          from[i].~Node();
+        }
+
+        if (!is_inline())
+          ::operator delete(heap_);
+
+        heap_ = to;
+        capacity_ = static_cast<uint32_t>(capacity);
+      }
+
+    public:
+      NodeChildren() : inline_{} {}
+
+      NodeChildren(const NodeChildren&) = delete;
+      NodeChildren& operator=(const NodeChildren&) = delete;
+
+      ~NodeChildren()
+      {
+        clear();
+
+        if (!is_inline())
+          ::operator delete(heap_);
+      }
+
+      NodeIt begin()
+      {
+        return data();
+      }
+
+      NodeIt end()
+      {
+        return data() + size_;
+      }
+
+      const Node* begin() const
+      {
+        return data();
+      }
+
+      const Node* end() const
+      {
+        return data() + size_;
+      }
+
+      bool empty() const
+      {
+        return size_ == 0;
+      }
+
+      size_t size() const
+      {
+        return size_;
+      }
+
+      const Node& at(size_t index) const
+      {
+        if (index >= size_)
+          throw std::out_of_range("NodeChildren::at");
+
+        return data()[index];
+      }
+
+      const Node& front() const
+      {
+        return data()[0];
+      }
+
+      const Node& back() const
+      {
+        return data()[size_ - 1];
+      }
+
+      void reserve(size_t capacity)
+      {
+        if (capacity > capacity_)
+          grow(capacity);
+      }
+
+      void push_back(Node node)
+      {
+        if (TRIESTE_UNLIKELY(size_ == capacity_))
+          grow(size_t(size_) + 1);
+
+        new (data() + size_) Node(std::move(node));
+        size_++;
+      }
+
+      void pop_back()
+      {
+        size_--;
+        data()[size_].~Node();
+      }
+
+      void clear()
+      {
+        auto nodes = data();
+
+        for (uint32_t i = 0; i < size_; i++)
+          nodes[i].~Node();
+
+        size_ = 0;
+      }
+
+      NodeIt erase(NodeIt first, NodeIt last)
+      {
+        auto index = first - begin();
+        auto count = static_cast<uint32_t>(last - first);
+        std::move(last, end(), first);
+
+        for (uint32_t i = 0; i < count; i++)
+          pop_back();
+
+        return begin() + index;
+      }
+
+      NodeIt erase(NodeIt pos)
+      {
+        return erase(pos, pos + 1);
+      }
+
+      NodeIt insert(NodeIt pos, Node node)
+      {
+        auto index = pos - begin();
+        push_back(std::move(node));
+        std::rotate(begin() + index, end() - 1, end());
+        return begin() + index;
+      }
+
+      // As for std::vector, the inserted range must not come from this node.
+      template<typename It>
+      NodeIt insert(NodeIt pos, It first, It last)
+      {
+        auto index = pos - begin();
+        auto count = static_cast<size_t>(std::distance(first, last));
+        reserve(size_ + count);
+
+        for (auto it = first; it != last; ++it)
+          push_back(*it);
+
+        std::rotate(begin() + index, end() - count, end());
+        return begin() + index;
+      }
+    };
+  }
+
   template<typename T>
   using NodeMap = std::map<Node, T>;
 
@@ -180,27 +387,125 @@ namespace trieste
     {
       return flags & (1 << 1);
     }
+
+    void set_contains_change()
+    {
+      flags |= 1 << 2;
+    }
+
+    void set_moved()
+    {
+      flags |= 1 << 3;
+    }
+
+    void set_revisit()
+    {
+      flags |= 1 << 4;
+    }
+
+    void reset_contains_change()
+    {
+      flags &= ~(1 << 2);
+    }
+
+    void reset_moved()
+    {
+      flags &= ~(1 << 3);
+    }
+
+    void reset_revisit()
+    {
+      flags &= ~(1 << 4);
+    }
+
+    bool contains_change()
+    {
+      return flags & (1 << 2);
+    }
+
+    bool moved()
+    {
+      return flags & (1 << 3);
+    }
+
+    bool revisit()
+    {
+      return flags & (1 << 4);
+    }
+
+    void set_in_arena()
+    {
+      flags |= 1 << 5;
+    }
+
+    bool in_arena() const
+    {
+      return flags & (1 << 5);
+    }
   };
 
-  class NodeDef final : public intrusive_refcounted<NodeDef>
+  class NodeDef final : public intrusive_refcounted<NodeDef, ast_refcount>
   {
+    friend struct intrusive_refcounted_traits<NodeDef>;
+
   private:
     Token type_;
     Location location_;
-    Symtab symtab_;
     NodeDef* parent_;
     Flags flags_{};
-    Nodes children;
+    detail::NodeChildren children;
 
-    NodeDef(const Token& type, Location location)
+    // Nodes with flag::symtab are allocated on the heap with their symbol
+    // table in a slot immediately before the NodeDef, so that other nodes
+    // don't pay for it. The slot also remembers the arena the rest of the
+    // tree is allocated from.
+    struct SymtabSlot
+    {
+      Symtab symtab;
+      NodeArena* arena;
+    };
+
+    static constexpr size_t symtab_slot_size = sizeof(SymtabSlot);
+
+    NodeDef(const Token& type, const Location& location)
     : type_(type), location_(location), parent_(nullptr)
+    {}
+
+    SymtabSlot& symtab_slot() const
     {
-      if (type_ & flag::symtab)
-        symtab_ = Symtab::make();
+      auto p = reinterpret_cast<const char*>(this) - symtab_slot_size;
+      return *std::launder(reinterpret_cast<SymtabSlot*>(const_cast<char*>(p)));
+    }
+
+    SymtabDef* symtab() const
+    {
+      if (!(type_ & flag::symtab))
+        return nullptr;
+
+      return symtab_slot().symtab.get();
+    }
+
+    // Record that the children of this node have changed. A node that
+    // contains a change always has ancestors that contain a change, so the
+    // walk can stop at the first one that is already marked.
+    void add_change()
+    {
+      auto curr = this;
+      while ((curr != nullptr) && !curr->flags_.contains_change())
+      {
+        curr->flags_.set_contains_change();
+        curr = curr->parent_;
+      }
     }
 
     void add_flags()
     {
+      // This node has a new parent, so everything below it may now match
+      // differently.
+      flags_.set_moved();
+      if (parent_ != nullptr)
+        parent_->add_change();
+
       if (type_ == Error || flags_.contains_error())
       {
         auto curr = parent_;
@@ -225,15 +530,92 @@ namespace trieste
       }
     }
 
+    // Allocate from the current arena if there is one, and from the heap
+    // otherwise. Nodes with a symbol table are always on the heap.
+    static Node make(const Token& type, const Location& location)
+    {
+#if TRIESTE_AST_ENABLE_STATS
+      allocations_ref()++;
+#endif
+
+      if (type & flag::symtab)
+      {
+        static_assert(symtab_slot_size % alignof(NodeDef) == 0);
+        auto p = static_cast<char*>(
+          ::operator new(symtab_slot_size + sizeof(NodeDef)));
+        auto arena = NodeArena::current();
+        if (arena)
+          arena->acquire();
+
+        new (p) SymtabSlot{Symtab::make(), arena};
+        return Node(new (p + symtab_slot_size) NodeDef(type, location));
+      }
+
+      auto arena = NodeArena::current();
+      if (!arena)
+        return Node(new NodeDef(type, location));
+
+      auto node =
+        new (arena->allocate(sizeof(NodeDef))) NodeDef(type, location);
+      node->flags_.set_in_arena();
+      return Node(node);
+    }
+
+    static void destroy(NodeDef* node)
+    {
+      if (node->type_ & flag::symtab)
+      {
+        auto& slot = node->symtab_slot();
+        auto arena = slot.arena;
+        node->~NodeDef();
+        slot.~SymtabSlot();
+        ::operator delete(reinterpret_cast<char*>(&slot));
+
+        if (arena)
+          arena->release();
+        return;
+      }
+
+      if (!node->flags_.in_arena())
+      {
+        delete node;
+        return;
+      }
+
+      node->~NodeDef();
+      NodeArena::deallocate(node);
+    }
+
+#if TRIESTE_AST_ENABLE_STATS
+    static size_t& allocations_ref()
+    {
+      static thread_local size_t count{0};
+      return count;
+    }
+#endif
+
   public:
+    /**
+     * The number of nodes created on this thread so far, or 0 unless
+     * TRIESTE_AST_ENABLE_STATS is set.
+     */
+    static size_t allocations()
+    {
+#if TRIESTE_AST_ENABLE_STATS
+      return allocations_ref();
+#else
+      return 0;
+#endif
+    }
+
     static Node create(const Token& type)
     {
-      return Node(new NodeDef(type, Location{nullptr, 0, 0}));
+      return make(type, Location{nullptr, 0, 0});
     }
 
     static Node create(const Token& type, Location location)
     {
-      return Node(new NodeDef(type, location));
+      return make(type, location);
     }
 
     static Node create(const Token& type, NodeRange range)
@@ -241,8 +623,20 @@ namespace trieste
       if (range.empty())
         return create(type);
 
-      return Node(
-        new NodeDef(type, range.front()->location_ * range.back()->location_));
+      return make(type, range.front()->location_ * range.back()->location_);
+    }
+
+    /**
+     * The arena this node was allocated from, or null if it is on the heap.
+     * Nodes with a symbol table live on the heap, but report the arena that
+     * was current when they were created.
+     */
+    NodeArena* arena() const
+    {
+      if (type_ & flag::symtab)
+        return symtab_slot().arena;
+
+      return flags_.in_arena() ? NodeArena::of(this) : nullptr;
     }
 
     const Token& type() const
@@ -318,32 +712,32 @@ namespace trieste
 
     auto rbegin()
     {
-      return children.rbegin();
+      return std::reverse_iterator<NodeIt>(children.end());
     }
 
     auto rend()
     {
-      return children.rend();
+      return std::reverse_iterator<NodeIt>(children.begin());
     }
 
-    auto cbegin()
+    auto cbegin() const
     {
-      return children.cbegin();
+      return static_cast<const detail::NodeChildren&>(children).begin();
     }
 
-    auto cend()
+    auto cend() const
     {
-      return children.cend();
+      return static_cast<const detail::NodeChildren&>(children).end();
     }
 
-    auto crbegin()
+    auto crbegin() const
     {
-      return children.crbegin();
+      return std::reverse_iterator<const Node*>(cend());
     }
 
-    auto crend()
+    auto crend() const
     {
-      return children.crend();
+      return std::reverse_iterator<const Node*>(cbegin());
     }
 
     auto find_first(Token token, NodeIt begin)
@@ -426,6 +820,7 @@ namespace trieste
 
       // Don't set the parent of the new child node to `this`.
       children.push_back(node);
+      add_change();
     }
 
     void push_back_ephemeral(NodeRange range)
@@ -441,6 +836,7 @@ namespace trieste
 
       auto node = children.back();
       children.pop_back();
+      add_change();
 
       if (node->parent_ == this)
         node->parent_ = nullptr;
@@ -457,6 +853,9 @@ namespace trieste
           (*it)->parent_ = nullptr;
       }
 
+      if (first != last)
+        add_change();
+
       return children.erase(first, last);
     }
 
@@ -506,7 +905,7 @@ namespace trieste
       {
         auto node = p->intrusive_ptr_from_this();
 
-        if (node->symtab_)
+        if (node->symtab())
           return node;
 
         p = node->parent_;
@@ -518,19 +917,21 @@ namespace trieste
     const Nodes& includes()
     {
       static Nodes empty_includes;
-      if (!symtab_)
+      auto symtab = this->symtab();
+      if (!symtab)
         return empty_includes;
 
-      return symtab_->includes;
+      return symtab->includes;
     }
 
     template<typename F>
     Nodes& get_symbols(Nodes& result, F&& f)
     {
-      if (!symtab_)
+      auto symtab = this->symtab();
+      if (!symtab)
         return result;
 
-      for (auto& [loc, nodes] : symtab_->symbols)
+      for (auto& [loc, nodes] : symtab->symbols)
         std::copy_if(nodes.begin(), nodes.end(), std::back_inserter(result), f);
 
       return result;
@@ -539,11 +940,12 @@ namespace trieste
     template<typename F>
     Nodes& get_symbols(const Location& loc, Nodes& result, F&& f)
     {
-      if (!symtab_)
+      auto symtab = this->symtab();
+      if (!symtab)
         return result;
 
-      auto it = symtab_->symbols.find(loc);
-      if (it == symtab_->symbols.end())
+      auto it = symtab->symbols.find(loc);
+      if (it == symtab->symbols.end())
         return result;
 
       std::copy_if(
@@ -554,8 +956,9 @@ namespace trieste
 
     void clear_symbols()
     {
-      if (symtab_)
-        symtab_->clear();
+      auto symtab = this->symtab();
+      if (symtab)
+        symtab->clear();
     }
 
     Nodes lookup(Node until = {})
@@ -575,8 +978,8 @@ namespace trieste
         // Includes are always returned, regardless of what's being looked up.
         result.insert(
           result.end(),
-          st->symtab_->includes.begin(),
-          st->symtab_->includes.end());
+          st->symtab()->includes.begin(),
+          st->symtab()->includes.end());
 
         // If we've reached the scope limit or there are no shadowing
         // definitions, don't continue to the next scope.
@@ -619,7 +1022,7 @@ namespace trieste
       if (!st)
         throw std::runtime_error("No symbol table");
 
-      auto& entry = st->symtab_->symbols[loc];
+      auto& entry = st->symtab()->symbols[loc];
       entry.push_back(intrusive_ptr_from_this());
 
       // If there are multiple definitions, none can be shadowing.
@@ -636,20 +1039,23 @@ namespace trieste
       if (!st)
         throw std::runtime_error("No symbol table");
 
-      st->symtab_->includes.emplace_back(intrusive_ptr_from_this());
+      st->symtab()->includes.emplace_back(intrusive_ptr_from_this());
     }
 
     Location fresh(const Location& prefix = {})
     {
       // This actually returns a unique name, rather than a fresh one.
       if (type_ == Top)
-        return symtab_->fresh(prefix);
+        return symtab()->fresh(prefix);
 
       return parent(Top)->fresh(prefix);
     }
 
     Node clone() const
     {
+      // Keep the clone in the same arena as the original.
+      NodeArena::Scope scope(arena());
+
       // This doesn't preserve the symbol table.
       auto node = create(type_, location_);
 
@@ -682,6 +1088,7 @@ namespace trieste
       else
       {
         children.erase(it);
+        add_change();
       }
     }
 
@@ -791,10 +1198,10 @@ namespace trieste
           origin_stack.push_back(&no_origin);
         }
 
-        if (node->symtab_)
+        if (node->symtab())
         {
           out << std::endl;
-          node->symtab_->str(out, level + 1);
+          node->symtab()->str(out, level + 1);
         }
 
         level++;
@@ -936,6 +1343,37 @@ namespace trieste
       return result;
     }
 
+    bool get_and_reset_contains_change()
+    {
+      bool result = flags_.contains_change();
+      flags_.reset_contains_change();
+      return result;
+    }
+
+    bool get_moved()
+    {
+      return flags_.moved();
+    }
+
+    bool get_and_reset_moved()
+    {
+      bool result = flags_.moved();
+      flags_.reset_moved();
+      return result;
+    }
+
+    void set_revisit()
+    {
+      flags_.set_revisit();
+    }
+
+    bool get_and_reset_revisit()
+    {
+      bool result = flags_.revisit();
+      flags_.reset_revisit();
+      return result;
+    }
+
     size_t tree_size()
     {
       size_t size = 0;
@@ -994,6 +1432,12 @@ namespace trieste
     }
   };
 
+  // Nodes without a symbol table don't carry one, locations use 32-bit
+  // offsets, and a couple of children are stored inline.
+  static_assert(
+    (sizeof(void*) != 8) || (sizeof(NodeDef) <= 72),
+    "NodeDef is larger than 72 bytes");
+
   constexpr void
   intrusive_refcounted_traits<NodeDef>::intrusive_inc_ref(NodeDef* node)
   {
@@ -1006,6 +1450,12 @@ namespace trieste
     node->intrusive_dec_ref();
   }
 
+  inline void
+  intrusive_refcounted_traits<NodeDef>::intrusive_delete(NodeDef* node)
+  {
+    NodeDef::destroy(node);
+  }
+
   inline TokenDef::operator Node() const
   {
     return NodeDef::create(Token(*this));
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <string>
 #include <version>
 #ifdef __cpp_lib_source_location
 #  include <source_location>
@@ -41,5 +42,20 @@ namespace trieste
 
       Located(T t, DebugLocation l = {}) : value(t), location(l) {}
     };
+
+    /*
+     * The location as "file:line", or an empty string where source locations
+     * are not available.
+     */
+    inline std::string to_string(const DebugLocation& l)
+    {
+#ifdef __cpp_lib_source_location
+      return std::string(l.location.file_name()) + ":" +
+        std::to_string(l.location.line());
+#else
+      (void)l;
+      return {};
+#endif
+    }
   }
 }
@@ -1,9 +1,10 @@
 #pragma once
 
+#include "compiler.h"
 #include "token.h"
 
-#include <array>
 #include <cstddef>
+#include <vector>
 
 namespace trieste::detail
 {
@@ -13,6 +14,10 @@ namespace trieste::detail
    * This is used by matching system.  If a rule applies generally, it is added
    * to all tokens, and if it applies to a specific token, it is added to that
    * token only.
+   *
+   * The table is indexed by the dense token id, and only grows as far as the
+   * largest token that has a specific value. Tokens past the end of the table
+   * use the default value.
    */
   template<typename T>
   class DefaultMap
@@ -22,7 +27,7 @@ namespace trieste::detail
     T def{};
 
     // The map of specific values for tokens.
-    std::array<T*, TokenDef::DEFAULT_MAP_TABLE_SIZE> map;
+    std::vector<T*> map;
 
     // If this is true, then the map is empty, and the default value has not
     // been modified.
@@ -39,12 +44,10 @@ namespace trieste::detail
     }
 
   public:
-    DefaultMap()
-    {
-      map.fill(&def);
-    }
+    DefaultMap() {}
 
-    DefaultMap(const DefaultMap& dm) : def(dm.def), empty_(dm.empty_)
+    DefaultMap(const DefaultMap& dm)
+    : def(dm.def), map(dm.map.size()), empty_(dm.empty_)
     {
       for (size_t index = 0; index < map.size(); index++)
       {
@@ -55,6 +58,25 @@ namespace trieste::detail
       }
     }
 
+    DefaultMap& operator=(const DefaultMap& dm)
+    {
+      if (this == &dm)
+        return *this;
+
+      clear();
+      def = dm.def;
+      empty_ = dm.empty_;
+      map.resize(dm.map.size(), &def);
+
+      for (size_t index = 0; index < map.size(); index++)
+      {
+        if (!dm.is_index_default(index))
+          map[index] = new T(*dm.map[index]);
+      }
+
+      return *this;
+    }
+
     /**
      *  Modify all values in the map, including the default value.
      *
@@ -79,6 +101,8 @@ namespace trieste::detail
     {
       auto i = token_index(t);
       empty_ = false;
+      if (i >= map.size())
+        map.resize(i + 1, &def);
       // Use existing default set of rules.
       if (is_index_default(i))
         map[i] = new T(def);
@@ -89,9 +113,12 @@ namespace trieste::detail
      * Get the value for a token. If this token has no specific value, return
      * the default value.
      */
-    T& get(const Token& t)
+    TRIESTE_FAST_PATH T& get(const Token& t)
     {
-      return *map[token_index(t)];
+      auto i = token_index(t);
+      if (TRIESTE_UNLIKELY(i >= map.size()))
+        return def;
+      return *map[i];
     }
 
     /**
@@ -103,12 +130,10 @@ namespace trieste::detail
       for (size_t i = 0; i < map.size(); i++)
       {
         if (!is_index_default(i))
-        {
           delete map[i];
-          map[i] = &def;
-        }
       }
-      def.clear();
+      map.clear();
+      def = T{};
     }
 
     ~DefaultMap()
@@ -56,6 +56,13 @@ namespace trieste
       bool wfcheck = true;
       build->add_flag("-w", wfcheck, "Check well-formedness.");
 
+      bool profile = false;
+      build->add_flag(
+        "--profile",
+        profile,
+        "Report attempts, matches and time for each rule of each pass in the "
+        "Info log.");
+
       std::vector<std::string> pass_names = reader.pass_names();
       std::string end_pass = pass_names.back();
       build->add_option("-p,--pass", end_pass, "Run up to this pass.")
@@ -208,6 +215,7 @@ namespace trieste
           .debug_enabled(!dump_passes.empty())
           .debug_path(dump_passes)
           .wf_check_enabled(wfcheck)
+          .profile_enabled(profile)
           .end_pass(end_pass);
         if (path.extension() == ".trieste")
         {
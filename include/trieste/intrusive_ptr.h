@@ -5,12 +5,36 @@
 #include <atomic>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <ostream>
 #include <utility>
 
 namespace trieste
 {
+  // Reference counting policies for intrusive_refcounted. Atomic counts can be
+  // shared freely between threads. Non-atomic counts are cheaper, but every
+  // object, and every intrusive_ptr to it, must stay on the thread that created
+  // it. Debug builds check this.
+  namespace refcount
+  {
+    struct atomic
+    {};
+
+    struct nonatomic
+    {};
+  }
+
+  // The policy used for the objects that make up an AST and its rewrite rules:
+  // NodeDef, SourceDef and PatternDef. Define TRIESTE_NONATOMIC_REFCOUNT (the
+  // CMake option TRIESTE_USE_NONATOMIC_REFCOUNT) when ASTs are only ever built
+  // and rewritten on a single thread.
+#ifdef TRIESTE_NONATOMIC_REFCOUNT
+  using ast_refcount = refcount::nonatomic;
+#else
+  using ast_refcount = refcount::atomic;
+#endif
+
   namespace detail
   {
     // In principle, std::atomic should not be copied.
@@ -20,7 +44,11 @@ namespace trieste
     // be copied_. The copy constructors here will just set the new refcount to
     // 0, as if the object was constructed from scratch, so different
     // intrusive_ptr can take ownership of the new object.
-    struct copyable_refcount final
+    template<typename Policy>
+    struct copyable_refcount;
+
+    template<>
+    struct copyable_refcount<refcount::atomic> final
     {
     private:
       // The refcount here starts at 0, not 1 like in other reference counting
@@ -63,6 +91,76 @@ namespace trieste
         return value.fetch_sub(dec);
       }
     };
+
+#ifndef NDEBUG
+    // A small, non-zero id for the current thread.
+    inline uint32_t thread_tag()
+    {
+      static std::atomic<uint32_t> next{1};
+      static thread_local uint32_t tag = next++;
+      return tag;
+    }
+#endif
+
+    // The same as above, with plain arithmetic. In debug builds, the thread
+    // that first takes a reference is recorded, and any use of the count from
+    // another thread asserts. The count is narrowed so that the check doesn't
+    // change the size of the object.
+    template<>
+    struct copyable_refcount<refcount::nonatomic> final
+    {
+    private:
+      static constexpr size_t refcount_init = 0;
+
+#ifdef NDEBUG
+      size_t value;
+
+      void check_thread() {}
+#else
+      uint32_t value;
+      uint32_t owner{0};
+
+      void check_thread()
+      {
+        if (owner == 0)
+          owner = thread_tag();
+
+        assert(
+          (owner == thread_tag()) &&
+          "object with a non-atomic refcount used from more than one thread");
+      }
+#endif
+
+    public:
+      constexpr copyable_refcount(size_t value_)
+      : value(static_cast<decltype(value)>(value_))
+      {}
+
+      constexpr copyable_refcount() : value{refcount_init} {}
+      constexpr copyable_refcount(const copyable_refcount&)
+      : value{refcount_init}
+      {}
+
+      operator size_t() const
+      {
+        return value;
+      }
+
+      copyable_refcount& operator+=(size_t inc)
+      {
+        check_thread();
+        value += inc;
+        return *this;
+      }
+
+      size_t fetch_sub(size_t dec)
+      {
+        check_thread();
+        size_t prev = value;
+        value -= dec;
+        return prev;
+      }
+    };
   }
 
   // These traits are an indirect helper for incrementing and decrementing
@@ -107,6 +205,11 @@ namespace trieste
     {
       ptr->intrusive_dec_ref();
     }
+
+    static void intrusive_delete(T* ptr)
+    {
+      delete ptr;
+    }
   };
 
   template<typename T>
@@ -242,7 +345,7 @@ namespace trieste
     friend std::hash<intrusive_ptr<T>>;
   };
 
-  template<typename T>
+  template<typename T, typename Policy = refcount::atomic>
   struct intrusive_refcounted
   {
   private:
@@ -255,7 +358,7 @@ namespace trieste
     // default initialized. It is always necessary to make a fresh refcount for
     // a fresh object, so it's fine to ignore copy semantics here - it makes no
     // difference to what will happen.
-    detail::copyable_refcount intrusive_refcount;
+    detail::copyable_refcount<Policy> intrusive_refcount;
 
     constexpr void intrusive_inc_ref()
     {
@@ -268,7 +371,8 @@ namespace trieste
     TRIESTE_SLOW_PATH
     void intrusive_dec_ref()
     {
-      // Atomically subtract 1 from refcount and get the _old value_.
+      // Subtract 1 from refcount (atomically, unless the policy says otherwise)
+      // and get the _old value_.
       size_t prev_rc = intrusive_refcount.fetch_sub(1);
       // If the value _was_ 0, we just did a negative wrap-around to
       // max(size_t). We should stop now and think about how we got here.
@@ -355,7 +459,7 @@ namespace trieste
         work_list_local.pop_back();
         // may recursively call ~intrusive_ptr<T> and reach the re-entrant case,
         // depending on structure
-        delete ptr;
+        intrusive_refcounted_traits<T>::intrusive_delete(ptr);
       }
 
       work_list = nullptr;
@@ -302,6 +302,7 @@ namespace trieste
     depth depth_;
     const wf::Wellformed& wf_ = wf::empty;
     size_t max_errors_;
+    bool arena_{false};
     std::filesystem::path exe;
 
     PreF prefile_;
@@ -337,16 +338,31 @@ namespace trieste
       return *this;
     }
 
+    bool arena() const
+    {
+      return arena_;
+    }
+
+    /**
+     * Allocate the nodes of each parsed AST from a NodeArena of its own.
+     * Passes run over the AST allocate from the same arena.
+     */
+    Parse& arena(bool value)
+    {
+      arena_ = value;
+      return *this;
+    }
+
     Parse& operator()(
       const std::string& mode, const std::initializer_list<detail::Rule> r)
     {
       auto& rules = rules_[mode];
       rules.insert(rules.end(), r.begin(), r.end());
-      rule_sets_.insert_or_assign(
-        mode,
-        TRegexSet(rules.begin(), rules.end(), [](const detail::Rule& rule) {
-          return rule->regex;
-        }));
+      TRegexSet set(rules.begin(), rules.end(), [](const detail::Rule& rule) {
+        return rule->regex;
+      });
+      set.combined(true);
+      rule_sets_.insert_or_assign(mode, std::move(set));
       return *this;
     }
 
@@ -411,6 +427,8 @@ namespace trieste
 
     Node parse(const std::filesystem::path path) const
     {
+      NodeArena::Scope scope(
+        arena_ ? NodeArena::make() : NodeArena::current());
       auto ast = sub_parse(path);
       auto top = NodeDef::create(Top);
       top->push_back(ast);
@@ -423,6 +441,8 @@ namespace trieste
 
     Node parse(const Source source) const
     {
+      NodeArena::Scope scope(
+        arena_ ? NodeArena::make() : NodeArena::current());
       auto ast = parse_source(source->origin(), File, source);
       auto top = NodeDef::create(Top);
       top->push_back(ast);
@@ -2,11 +2,27 @@
 
 #include "defaultmap.h"
 #include "rewrite.h"
+#include "ruletree.h"
+#include "staticpattern.h"
 #include "trieste/intrusive_ptr.h"
 #include "wf.h"
 
+#include <algorithm>
+#include <chrono>
 #include <vector>
 
+// Define this as 1 to count the rule attempts and matches of every pass, as
+// reported by PassDef::stats().
+#ifndef TRIESTE_PASS_ENABLE_STATS
+#  define TRIESTE_PASS_ENABLE_STATS 0
+#endif
+
+// Define this as 0 to always try the rules of a pass one at a time, rather
+// than merging rules that start with the same steps into a tree.
+#ifndef TRIESTE_PASS_RULE_TREE
+#  define TRIESTE_PASS_RULE_TREE 1
+#endif
+
 namespace trieste
 {
   namespace dir
@@ -15,8 +31,36 @@ namespace trieste
     constexpr flag bottomup = 1 << 0;
     constexpr flag topdown = 1 << 1;
     constexpr flag once = 1 << 2;
+    // After a replacement, resume matching from the earliest position whose
+    // previous match attempts examined the replaced nodes, rather than from
+    // the first child, and after the first iteration only revisit subtrees
+    // that changed in the previous one. This reaches the same fixpoint as
+    // rechecking everything provided that rules, `pre` and `post` only depend
+    // on the nodes they examine. Ignored when combined with `once`.
+    constexpr flag incremental = 1 << 3;
   }
 
+  /**
+   * Counters for one rule of a pass, collected while profiling is enabled.
+   */
+  struct RuleProfile
+  {
+    // Where the rule was written, or its position in the pass where source
+    // locations are not available.
+    std::string location;
+    // Times the pattern was tried against a position.
+    size_t attempts = 0;
+    // Times the pattern matched a range without errors.
+    size_t matches = 0;
+    // Times the pattern matched a range that contains an error, which is
+    // discarded.
+    size_t errors = 0;
+    // Matches whose effect returned NoChange.
+    size_t no_change = 0;
+    // Time spent matching the pattern and running the effect.
+    std::chrono::nanoseconds duration{0};
+  };
+
   class PassDef;
   using Pass = intrusive_ptr<PassDef>;
 
@@ -26,6 +70,18 @@ namespace trieste
     using F = std::function<size_t(Node)>;
     using CondF = std::function<bool(Node)>;
 
+    struct Stats
+    {
+      // Patterns tried against a position.
+      size_t rule_attempts = 0;
+      // Patterns that matched a range without errors, whether or not the
+      // rule then made a change.
+      size_t rule_matches = 0;
+      // Positions matched against a tree of rules that share a prefix. These
+      // are not counted as rule attempts.
+      size_t tree_walks = 0;
+    };
+
   private:
     static const int NOCHANGE = -1;
     static const int REAPPLY = -2;
@@ -34,16 +90,36 @@ namespace trieste
     const wf::Wellformed& wf_ = wf::empty;
     dir::flag direction_;
 
+    // A rule together with its position in rules_.
+    struct IndexedRule
+    {
+      size_t index;
+      detail::PatternEffect<Node> rule;
+    };
+
+    // The rules that can apply under one parent at one start token.
+    struct RuleList
+    {
+      std::vector<IndexedRule> rules;
+      // The same rules merged into a tree, if any of them share a prefix.
+      detail::RuleTree tree;
+    };
+
     std::vector<detail::PatternEffect<Node>> rules_;
-    detail::DefaultMap<
-      detail::DefaultMap<std::vector<detail::PatternEffect<Node>>>>
-      rule_map;
+    detail::DefaultMap<detail::DefaultMap<RuleList>> rule_map;
+
+    bool profiling_{false};
+    std::vector<RuleProfile> rule_profile_;
 
     F pre_once;
     F post_once;
     CondF cond_run;
-    std::map<Token, F> pre_;
-    std::map<Token, F> post_;
+    detail::DefaultMap<F> pre_;
+    detail::DefaultMap<F> post_;
+
+#if TRIESTE_PASS_ENABLE_STATS
+    Stats stats_;
+#endif
 
   public:
     PassDef(
@@ -125,24 +201,24 @@ namespace trieste
 
     void pre(const Token& type, F f)
     {
-      pre_[type] = f;
+      pre_.modify(type) = f;
     }
 
     void pre(const std::initializer_list<Token>& types, F f)
     {
       for (const auto& type : types)
-        pre_[type] = f;
+        pre_.modify(type) = f;
     }
 
     void post(const Token& type, F f)
     {
-      post_[type] = f;
+      post_.modify(type) = f;
     }
 
     void post(const std::initializer_list<Token>& types, F f)
     {
       for (const auto& type : types)
-        post_[type] = f;
+        post_.modify(type) = f;
     }
 
     template<typename... Ts>
@@ -164,6 +240,10 @@ namespace trieste
       static thread_local Match match;
       ast::detail::top_node() = node;
 
+      // Nodes built by this pass are allocated alongside the tree they are
+      // added to.
+      NodeArena::Scope arena(node->arena());
+
       size_t changes = 0;
       size_t changes_sum = 0;
       size_t count = 0;
@@ -176,10 +256,18 @@ namespace trieste
       if (pre_once)
         changes_sum += pre_once(node);
 
+      bool incremental = flag(dir::incremental) && !flag(dir::once);
+
       // Because apply runs over child nodes, the top node is never visited.
       do
       {
-        changes = apply(node, match);
+        // Only the first iteration has to look at the whole tree.
+        bool sparse = incremental && (count > 0);
+
+        if (incremental)
+          collect_changes(node, sparse);
+
+        changes = apply(node, match, sparse);
 
         auto lifted = lift(node);
         if (!lifted.empty())
@@ -198,6 +286,64 @@ namespace trieste
       return {node, count, changes_sum};
     }
 
+    /**
+     * Counts accumulated over every run of this pass, or zeros unless
+     * TRIESTE_PASS_ENABLE_STATS is set.
+     */
+    Stats stats() const
+    {
+#if TRIESTE_PASS_ENABLE_STATS
+      return stats_;
+#else
+      return {};
+#endif
+    }
+
+    void reset_stats()
+    {
+#if TRIESTE_PASS_ENABLE_STATS
+      stats_ = {};
+#endif
+    }
+
+    /**
+     * Enable or disable the per-rule counters reported by rule_profile().
+     * They accumulate over runs until reset_profile() is called.
+     */
+    void profile(bool enable)
+    {
+      profiling_ = enable;
+      if (enable && (rule_profile_.size() != rules_.size()))
+        reset_profile();
+    }
+
+    bool profile() const
+    {
+      return profiling_;
+    }
+
+    void reset_profile()
+    {
+      rule_profile_.clear();
+      rule_profile_.resize(rules_.size());
+
+      for (size_t i = 0; i < rules_.size(); i++)
+      {
+        auto& location = rule_profile_[i].location;
+        location = detail::to_string(rules_[i].first.location);
+        if (location.empty())
+          location = "rule " + std::to_string(i);
+      }
+    }
+
+    /**
+     * One entry per rule, in the order the rules were added.
+     */
+    const std::vector<RuleProfile>& rule_profile() const
+    {
+      return rule_profile_;
+    }
+
     std::vector<Node> reify_patterns()
     {
       std::vector<Node> patterns;
@@ -213,28 +359,30 @@ namespace trieste
     {
       rule_map.clear();
 
-      for (auto& rule : rules_)
+      if (profiling_)
+        reset_profile();
+
+      for (size_t index = 0; index < rules_.size(); index++)
       {
+        const auto& rule = rules_[index];
         const auto& starts = rule.first.value.get_starts();
         const auto& parents = rule.first.value.get_parents();
 
         //  This is used to add a rule under a specific parent, or to the
         //  default.
-        auto add = [&](detail::DefaultMap<
-                       std::vector<detail::PatternEffect<Node>>>& rules) {
+        auto add = [&](detail::DefaultMap<RuleList>& rules) {
           if (starts.empty())
           {
             // If there are no starts, then this rule applies to all tokens.
-            rules.modify_all([&](std::vector<detail::PatternEffect<Node>>& v) {
-              v.push_back(rule);
-            });
+            rules.modify_all(
+              [&](RuleList& l) { l.rules.push_back({index, rule}); });
           }
           else
           {
             for (const auto& start : starts)
             {
               // Add the rule to the specific start token.
-              rules.modify(start).push_back(rule);
+              rules.modify(start).rules.push_back({index, rule});
             }
           }
         };
@@ -251,6 +399,40 @@ namespace trieste
           }
         }
       }
+
+#if TRIESTE_PASS_RULE_TREE
+      if (rules_.empty())
+        return;
+
+      std::vector<detail::RuleTree::Path> paths;
+      paths.reserve(rules_.size());
+
+      for (const auto& rule : rules_)
+        paths.push_back(detail::RuleTree::flatten(rule.first.value));
+
+      rule_map.modify_all([&](detail::DefaultMap<RuleList>& rules) {
+        if (rules.empty())
+          return;
+
+        rules.modify_all([&](RuleList& l) {
+          l.tree = {};
+
+          // Only build a tree where it saves matching a step more than once.
+          bool shared = false;
+          for (size_t i = 1; !shared && (i < l.rules.size()); i++)
+          {
+            shared = detail::RuleTree::shares_prefix(
+              paths[l.rules[i - 1].index], paths[l.rules[i].index]);
+          }
+
+          if (!shared)
+            return;
+
+          for (const auto& indexed : l.rules)
+            l.tree.add(paths[indexed.index]);
+        });
+      });
+#endif
     }
 
     bool flag(dir::flag f) const
@@ -305,6 +487,107 @@ namespace trieste
       return replaced;
     }
 
+    // Try each rule at `start` in order until one makes a change. On success
+    // `it` is left after the replacement, and otherwise at `start`.
+    template<bool Profile>
+    TRIESTE_FAST_PATH ptrdiff_t try_rules(
+      std::vector<IndexedRule>& rules,
+      Match& match,
+      const NodeIt& start,
+      NodeIt& it,
+      const Node& node)
+    {
+      for (auto& [index, rule] : rules)
+      {
+        ptrdiff_t replaced = NOCHANGE;
+        [[maybe_unused]] std::chrono::steady_clock::time_point rule_start;
+
+        if constexpr (Profile)
+        {
+          rule_start = std::chrono::steady_clock::now();
+          rule_profile_[index].attempts++;
+        }
+        else
+        {
+          UNUSED(index);
+        }
+
+        match.reset();
+#if TRIESTE_PASS_ENABLE_STATS
+        stats_.rule_attempts++;
+#endif
+        if (TRIESTE_UNLIKELY(rule.first.value.match(it, node, match)))
+        {
+          if (TRIESTE_LIKELY(!range_contains_error(start, it)))
+          {
+#if TRIESTE_PASS_ENABLE_STATS
+            stats_.rule_matches++;
+#endif
+            replaced = replace(match, rule.second, start, it, node);
+
+            if constexpr (Profile)
+            {
+              rule_profile_[index].matches++;
+              if (replaced == NOCHANGE)
+                rule_profile_[index].no_change++;
+            }
+          }
+          else if constexpr (Profile)
+          {
+            rule_profile_[index].errors++;
+          }
+        }
+
+        if constexpr (Profile)
+        {
+          rule_profile_[index].duration +=
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - rule_start);
+        }
+
+        if (replaced != NOCHANGE)
+          return replaced;
+
+        it = start;
+      }
+
+      return NOCHANGE;
+    }
+
+    // As try_rules, but matching the steps that adjacent rules share once.
+    TRIESTE_FAST_PATH ptrdiff_t try_tree(
+      RuleList& list,
+      Match& match,
+      const NodeIt& start,
+      NodeIt& it,
+      const Node& node)
+    {
+      ptrdiff_t replaced = NOCHANGE;
+
+#if TRIESTE_PASS_ENABLE_STATS
+      stats_.tree_walks++;
+#endif
+      list.tree.match(start, node, match, [&](size_t rule, NodeIt end) {
+        if (TRIESTE_UNLIKELY(range_contains_error(start, end)))
+          return false;
+
+#if TRIESTE_PASS_ENABLE_STATS
+        stats_.rule_matches++;
+#endif
+        it = end;
+        replaced =
+          replace(match, list.rules[rule].rule.second, start, it, node);
+
+        if (replaced != NOCHANGE)
+          return true;
+
+        it = start;
+        return false;
+      });
+
+      return replaced;
+    }
+
     TRIESTE_FAST_PATH size_t match_children(const Node& node, Match& match)
     {
       size_t changes = 0;
@@ -315,6 +598,13 @@ namespace trieste
       if (TRIESTE_UNLIKELY(rules.empty()))
         return changes;
 
+      bool incremental = flag(dir::incremental) && !flag(dir::once);
+
+      // For incremental mode, horizons[i] is one past the furthest child
+      // examined by any match attempt at positions [0, i]. It is only
+      // populated for the positions before `it`.
+      std::vector<size_t> horizons;
+
       auto it = node->begin();
       // Perform matching at this level
       while (it != node->end())
@@ -322,39 +612,65 @@ namespace trieste
         ptrdiff_t replaced = NOCHANGE;
 
         auto start = it;
+        size_t pos = static_cast<size_t>(start - node->begin());
+
+        // Selecting the rules below examines the node at `pos`.
+        if (incremental)
+          match.watch(node.get(), pos + 1);
+
         // Find rule set for this parent and start token combination.
-        auto& specific_rules = rules.get((*it)->type());
-        for (auto& rule : specific_rules)
-        {
-          match.reset();
-          if (
-            TRIESTE_UNLIKELY(rule.first.value.match(it, node, match)) &&
-            TRIESTE_LIKELY(!range_contains_error(start, it)))
-          {
-            replaced = replace(match, rule.second, start, it, node);
-            if (replaced != NOCHANGE)
-            {
-              changes++;
-              break;
-            }
-          }
-          it = start;
-        }
+        auto& specific = rules.get((*it)->type());
+        if (TRIESTE_UNLIKELY(profiling_))
+          replaced = try_rules<true>(specific.rules, match, start, it, node);
+#if TRIESTE_PASS_RULE_TREE
+        else if (!specific.tree.empty())
+          replaced = try_tree(specific, match, start, it, node);
+#endif
+        else
+          replaced = try_rules<false>(specific.rules, match, start, it, node);
+
+        if (replaced != NOCHANGE)
+          changes++;
 
         if (replaced == NOCHANGE)
         {
           // If we didn't do anything, advance to the next node.
+          if (incremental)
+          {
+            size_t horizon = match.horizon();
+            if (!horizons.empty() && (horizons.back() > horizon))
+              horizon = horizons.back();
+            horizons.push_back(horizon);
+          }
+
           ++it;
         }
         else if (replaced == REAPPLY)
         {
-          // Don't advance so that we match on the inserted nodes next
+          // Don't advance so that we match on the inserted nodes next. Any
+          // earlier position that examined the replaced nodes must be
+          // retried the next time we restart.
+          if (incremental)
+          {
+            auto dirty =
+              std::upper_bound(horizons.begin(), horizons.end(), pos);
+            std::fill(dirty, horizons.end(), SIZE_MAX);
+          }
         }
         else if (flag(dir::once))
         {
           // Skip over everything we populated.
           it += replaced;
         }
+        else if (incremental)
+        {
+          // Restart from the first position whose match attempts could have
+          // seen the replaced nodes. Earlier positions examined only nodes
+          // that are unchanged, so they would fail again.
+          auto dirty = std::upper_bound(horizons.begin(), horizons.end(), pos);
+          horizons.erase(dirty, horizons.end());
+          it = node->begin() + horizons.size();
+        }
         else
         {
           // Otherwise, start again from the beginning.
@@ -362,24 +678,68 @@ namespace trieste
         }
       }
 
+      if (incremental)
+        match.watch(nullptr);
+
       return changes;
     }
 
+    // Clear the change tracking flags set since the last iteration. If
+    // `revisit` is set, also mark every node that must be visited again:
+    // nodes whose subtree changed, and everything below a node that was
+    // moved to a new parent. Change flags are not cleared while rules run,
+    // which keeps them set on every ancestor of a changed node.
+    static void collect_changes(const Node& root, bool revisit)
+    {
+      size_t moved_depth = 0;
+
+      root->traverse(
+        [&](Node& node) {
+          bool moved = node->get_and_reset_moved();
+          bool changed = node->get_and_reset_contains_change();
+
+          if (moved || (moved_depth > 0))
+            moved_depth++;
+          else if (!changed)
+            return false;
+
+          if (revisit)
+            node->set_revisit();
+
+          return true;
+        },
+        [&](Node&) {
+          if (moved_depth > 0)
+            moved_depth--;
+        });
+    }
+
     template<bool Topdown, bool Pre, bool Post>
-    size_t apply_special(Node root, Match& match)
+    size_t apply_special(Node root, Match& match, bool sparse)
     {
       size_t changes = 0;
+      size_t moved_depth = 0;
 
       auto add = [&](Node& node) TRIESTE_FAST_PATH_LAMBDA {
         // Don't examine Error or Lift nodes.
         if (node->type() & flag::internal)
           return false;
 
+        // Skip subtrees that didn't change in the last iteration, but visit
+        // everything that has been moved during this one.
+        if (sparse)
+        {
+          if ((moved_depth > 0) || node->get_moved())
+            moved_depth++;
+          else if (!node->get_and_reset_revisit())
+            return false;
+        }
+
         if constexpr (Pre)
         {
-          auto pre_f = pre_.find(node->type());
-          if (pre_f != pre_.end())
-            changes += pre_f->second(node);
+          auto& pre_f = pre_.get(node->type());
+          if (pre_f)
+            changes += pre_f(node);
         }
         if constexpr (Topdown)
           changes += match_children(node, match);
@@ -388,15 +748,18 @@ namespace trieste
       };
 
       auto remove = [&](Node& node) TRIESTE_FAST_PATH_LAMBDA {
+        if (moved_depth > 0)
+          moved_depth--;
+
         if constexpr (!Topdown)
           changes += match_children(node, match);
         else
           UNUSED(node);
         if constexpr (Post)
         {
-          auto post_f = post_.find(node->type());
-          if (post_f != post_.end())
-            changes += post_f->second(node);
+          auto& post_f = post_.get(node->type());
+          if (post_f)
+            changes += post_f(node);
         }
       };
 
@@ -405,7 +768,7 @@ namespace trieste
       return changes;
     }
 
-    size_t apply(Node root, Match& match)
+    size_t apply(Node root, Match& match, bool sparse)
     {
       if (flag(dir::topdown))
       {
@@ -413,22 +776,22 @@ namespace trieste
         {
           if (post_.empty())
           {
-            return apply_special<true, false, false>(root, match);
+            return apply_special<true, false, false>(root, match, sparse);
           }
           else
           {
-            return apply_special<true, false, true>(root, match);
+            return apply_special<true, false, true>(root, match, sparse);
           }
         }
         else
         {
           if (post_.empty())
           {
-            return apply_special<true, true, false>(root, match);
+            return apply_special<true, true, false>(root, match, sparse);
           }
           else
           {
-            return apply_special<true, true, true>(root, match);
+            return apply_special<true, true, true>(root, match, sparse);
           }
         }
       }
@@ -438,22 +801,22 @@ namespace trieste
         {
           if (post_.empty())
           {
-            return apply_special<false, false, false>(root, match);
+            return apply_special<false, false, false>(root, match, sparse);
           }
           else
           {
-            return apply_special<false, false, true>(root, match);
+            return apply_special<false, false, true>(root, match, sparse);
           }
         }
         else
         {
           if (post_.empty())
           {
-            return apply_special<false, true, false>(root, match);
+            return apply_special<false, true, false>(root, match, sparse);
           }
           else
           {
-            return apply_special<false, true, true>(root, match);
+            return apply_special<false, true, true>(root, match, sparse);
           }
         }
       }
@@ -115,6 +115,14 @@ namespace trieste
     size_t count;
     size_t changes;
     std::chrono::microseconds duration;
+    // One entry per rule of the pass, or empty unless profiling is enabled.
+    std::vector<RuleProfile> rules;
+  };
+
+  struct PassProfile
+  {
+    std::string pass;
+    std::vector<RuleProfile> rules;
   };
 
   struct ProcessResult
@@ -124,6 +132,8 @@ namespace trieste
     Node ast;
     Nodes errors;
     size_t total_changes = 0;
+    // The rule counters of each pass that ran, if profiling was enabled.
+    std::vector<PassProfile> profile = {};
 
     void print_errors(logging::Log& err) const
     {
@@ -167,6 +177,8 @@ namespace trieste
 
     bool check_well_formed{true};
 
+    bool profile{false};
+
     std::function<bool(Node&, std::string, size_t index, PassStatistics&)>
       pass_complete;
 
@@ -196,7 +208,6 @@ namespace trieste
                         std::string pass_name,
                         size_t index,
                         PassStatistics& stats) {
-        auto [count, changes, duration] = stats;
         std::string delim{"\t"};
         if (index == 0)
         {
@@ -205,8 +216,27 @@ namespace trieste
         }
         else
         {
-          summary << pass_name << delim << count << delim << changes << delim
-                  << static_cast<size_t>(duration.count()) << std::endl;
+          summary << pass_name << delim << stats.count << delim
+                  << stats.changes << delim
+                  << static_cast<size_t>(stats.duration.count()) << std::endl;
+        }
+
+        if (!stats.rules.empty())
+        {
+          summary << delim << "Rule" << delim << "Attempts" << delim
+                  << "Matches" << delim << "Errors" << delim << "NoChange"
+                  << delim << "Time (us)" << std::endl;
+
+          for (auto& rule : stats.rules)
+          {
+            summary << delim << rule.location << delim << rule.attempts
+                    << delim << rule.matches << delim << rule.errors << delim
+                    << rule.no_change << delim
+                    << std::chrono::duration_cast<std::chrono::microseconds>(
+                         rule.duration)
+                         .count()
+                    << std::endl;
+          }
         }
 
         if (output_directory.empty())
@@ -260,6 +290,16 @@ namespace trieste
       return *this;
     }
 
+    /**
+     * @brief Specifies if per-rule counters should be collected for each
+     * pass. They are reported in PassStatistics and ProcessResult.
+     */
+    Process& set_profile(bool b)
+    {
+      profile = b;
+      return *this;
+    }
+
     bool validate(Node ast, Nodes& errors)
     {
       auto wf = pass_range.input_wf();
@@ -289,6 +329,7 @@ namespace trieste
       WFContext context(pass_range.input_wf());
 
       Nodes errors;
+      std::vector<PassProfile> profiles;
 
       // Check ast is well-formed before starting.
       auto ok = validate(ast, errors);
@@ -305,6 +346,13 @@ namespace trieste
         auto& pass = pass_range();
         context.push_back(pass->wf());
 
+        bool was_profiling = pass->profile();
+        if (profile)
+        {
+          pass->profile(true);
+          pass->reset_profile();
+        }
+
         auto [new_ast, count, changes] = pass->run(ast);
         total_changes += changes;
         ast = new_ast;
@@ -318,14 +366,22 @@ namespace trieste
         stats = {
           count,
           changes,
-          std::chrono::duration_cast<std::chrono::microseconds>(then - now)};
+          std::chrono::duration_cast<std::chrono::microseconds>(then - now),
+          {}};
+
+        if (profile)
+        {
+          stats.rules = pass->rule_profile();
+          profiles.push_back({pass->name(), stats.rules});
+          pass->profile(was_profiling);
+        }
 
         ok = pass_complete(ast, pass->name(), index, stats) && ok;
 
         last_pass = pass->name();
       }
 
-      return {ok, last_pass, ast, errors, total_changes};
+      return {ok, last_pass, ast, errors, total_changes, profiles};
     }
   };
 } // namespace trieste
@@ -24,6 +24,7 @@ namespace trieste
     InputSpec input_{};
     bool debug_enabled_;
     bool wf_check_enabled_;
+    bool profile_enabled_;
     std::filesystem::path debug_path_;
     std::string start_pass_;
     std::string end_pass_;
@@ -39,6 +40,7 @@ namespace trieste
       parser_(parser),
       debug_enabled_(false),
       wf_check_enabled_(false),
+      profile_enabled_(false),
       debug_path_("."),
       start_pass_(""),
       end_pass_(""),
@@ -132,6 +134,7 @@ namespace trieste
       auto result =
         Process(pass_range)
           .set_check_well_formed(wf_check_enabled_)
+          .set_profile(profile_enabled_)
           .set_default_pass_complete(summary, language_name_, debug_path)
           .run(ast);
       summary << "---------" << std::endl;
@@ -214,6 +217,28 @@ namespace trieste
       return wf_check_enabled_;
     }
 
+    Reader& profile_enabled(bool value)
+    {
+      profile_enabled_ = value;
+      return *this;
+    }
+
+    bool profile_enabled() const
+    {
+      return profile_enabled_;
+    }
+
+    Reader& arena_enabled(bool value)
+    {
+      parser_.arena(value);
+      return *this;
+    }
+
+    bool arena_enabled() const
+    {
+      return parser_.arena();
+    }
+
     Reader& debug_path(const std::filesystem::path& path)
     {
       debug_path_ = path;
@@ -27,6 +27,9 @@ namespace trieste
   // string), PartialMatch (substring), and GlobalReplace operations.
   // Regex objects are immutable after construction and safe to share
   // across threads.  Matching uses a thread-local MatchContext.
+  // Patterns are compiled through regex::RegexCache::global(), so when that
+  // cache is given a capacity, TRegexes with the same pattern share one
+  // compiled engine.
   //
   // Usage:
   //   TRegex re("(\\d+)-(\\d+)");
@@ -35,6 +38,7 @@ namespace trieste
   class TRegex
   {
     friend class TRegexMatch;
+    friend class TRegexSet;
 
   public:
     TRegex() : pattern_(), num_captures_(0)
@@ -53,6 +57,25 @@ namespace trieste
       init();
     }
 
+    // A regex for pattern loaded from its program, as serialized by
+    // RegexEngine::serialize(), e.g. one embedded in the binary. This skips
+    // compiling the pattern, unless the program can't be loaded or was
+    // compiled from another pattern or syntax mode.
+    TRegex(std::string_view pattern, std::string_view program)
+    : pattern_(pattern)
+    {
+      auto engine = regex::RegexEngine::deserialize(
+        program, pattern, regex::RegexEngine::SyntaxMode::Extended);
+      if (!engine)
+      {
+        init();
+        return;
+      }
+
+      engine_ = std::make_shared<const regex::RegexEngine>(std::move(*engine));
+      num_captures_ = engine_->num_captures();
+    }
+
     TRegex(const TRegex&) = default;
     TRegex(TRegex&&) = default;
     TRegex& operator=(const TRegex&) = default;
@@ -262,6 +285,41 @@ namespace trieste
       return regex.engine_->match(text, ctx);
     }
 
+    // FullMatch of each of `count` texts, e.g. keys or identifiers to
+    // validate. Sets matched[i] for texts[i] and returns the number that
+    // match. The match context is bound once for the batch, and the texts
+    // run one after another on the shared lazy DFA, so the first texts warm
+    // it up for the rest. Literals, and patterns with anchors, `\b` or other
+    // conditionals, fall back to a FullMatch per text.
+    static size_t FullMatchBatch(
+      const std::string_view* texts,
+      size_t count,
+      const TRegex& regex,
+      bool* matched)
+    {
+      if (regex.engine_ == nullptr || !regex.engine_->ok())
+      {
+        std::fill_n(matched, count, false);
+        return 0;
+      }
+      auto& ctx = thread_local_context();
+      return regex.engine_->match_batch(texts, count, matched, ctx);
+    }
+
+    static std::vector<bool> FullMatchBatch(
+      const std::vector<std::string_view>& texts, const TRegex& regex)
+    {
+      std::vector<bool> result(texts.size());
+      bool matched[256];
+      for (size_t i = 0; i < texts.size(); i += std::size(matched))
+      {
+        size_t n = std::min(std::size(matched), texts.size() - i);
+        FullMatchBatch(texts.data() + i, n, regex, matched);
+        std::copy_n(matched, n, result.begin() + i);
+      }
+      return result;
+    }
+
     // Variadic FullMatch: extracts capture groups into typed out-params.
     template<typename... A>
     static bool
@@ -442,9 +500,10 @@ namespace trieste
       auto& ctx = thread_local_context();
       if (n == 0)
         return re.engine_->match(text, ctx);
+
+      // Only a match of the whole text counts, so its length is known.
       std::vector<regex::RegexEngine::Capture> captures;
-      size_t len = re.engine_->find_prefix(text, captures, ctx, true);
-      if (len != text.size())
+      if (!re.engine_->find_captures(text, text.size(), captures, ctx))
         return false;
 
       int num_caps = std::min(n, static_cast<int>(captures.size()));
@@ -499,7 +558,7 @@ namespace trieste
 
     void init()
     {
-      engine_ = std::make_shared<regex::RegexEngine>(pattern_);
+      engine_ = regex::RegexCache::global().get(pattern_);
       num_captures_ = engine_->num_captures();
     }
 
@@ -533,47 +592,113 @@ namespace trieste
       return len;
     }
 
+    size_t find_prefix(
+      const std::string_view& text,
+      regex::RegexEngine::MatchContext& ctx,
+      bool at_start = true) const
+    {
+      if (engine_ == nullptr || !engine_->ok())
+        return regex::RegexEngine::npos;
+      return engine_->find_prefix(text, ctx, at_start);
+    }
+
+    bool find_captures(
+      const std::string_view& text,
+      size_t len,
+      std::vector<regex::RegexEngine::Capture>& captures,
+      regex::RegexEngine::MatchContext& ctx) const
+    {
+      if (engine_ == nullptr)
+        return false;
+      return engine_->find_captures(text, len, captures, ctx);
+    }
+
     std::string pattern_;
-    std::shared_ptr<regex::RegexEngine> engine_;
+    std::shared_ptr<const regex::RegexEngine> engine_;
     size_t num_captures_ = 0;
   };
 
   // Result of a single regex match against a Source.
-  // Stores Location spans for the overall match (index 0) and each
-  // capture group (indices 1..N).  Use at(i) to retrieve a Location
-  // and parse<T>(i) to convert a captured span to a typed value.
+  // Stores Location spans for the overall match (index 0) and the first
+  // max_capture capture groups (indices 1..N).  Use at(i) to retrieve a
+  // Location and parse<T>(i) to convert a captured span to a typed value.
+  // With max_capture = 0 only the extent of a match is found, which skips
+  // the capture simulation entirely.
   class TRegexMatch
   {
     friend class TRegexIterator;
+    friend class TRegexSet;
 
   private:
     std::vector<Location> locations;
     size_t matches = 0;
+    size_t max_capture_;
     regex::RegexEngine::MatchContext ctx_;
     std::vector<regex::RegexEngine::Capture> captures_;
 
+    size_t wanted_captures(const TRegex& regex) const
+    {
+      return std::min(
+        static_cast<size_t>(regex.NumberOfCapturingGroups()), max_capture_);
+    }
+
     bool match_regexp(
       const TRegex& regex,
       const std::string_view& view,
       Source& source,
       size_t offset)
     {
-      matches = regex.NumberOfCapturingGroups() + 1;
-
-      if (locations.size() < matches)
-        locations.resize(matches);
-
-      size_t matched_len = regex.find_prefix(view, captures_, ctx_);
+      size_t wanted = wanted_captures(regex);
+      size_t matched_len;
+      if (wanted == 0)
+      {
+        captures_.clear();
+        matched_len = regex.find_prefix(view, ctx_);
+      }
+      else
+      {
+        matched_len = regex.find_prefix(view, captures_, ctx_);
+      }
 
       if (matched_len == regex::RegexEngine::npos)
       {
         return false;
       }
 
+      record_match(source, offset, matched_len, wanted);
+      return true;
+    }
+
+    // Record a match of known length, found elsewhere, finding the captures
+    // over its span if any are wanted.
+    bool match_span(
+      const TRegex& regex,
+      const std::string_view& view,
+      Source& source,
+      size_t offset,
+      size_t len)
+    {
+      size_t wanted = wanted_captures(regex);
+      if (wanted == 0)
+        captures_.clear();
+      else if (!regex.find_captures(view, len, captures_, ctx_))
+        return false;
+
+      record_match(source, offset, len, wanted);
+      return true;
+    }
+
+    void record_match(
+      Source& source, size_t offset, size_t matched_len, size_t wanted)
+    {
+      matches = wanted + 1;
+
+      if (locations.size() < matches)
+        locations.resize(matches);
+
       locations[0] = Location(source, offset, matched_len);
 
-      size_t capture_count =
-        std::min(captures_.size(), matches > 0 ? matches - 1 : 0);
+      size_t capture_count = std::min(captures_.size(), wanted);
       for (size_t i = 0; i < capture_count; i++)
       {
         if (!captures_[i].matched() || (captures_[i].end < captures_[i].start))
@@ -592,12 +717,17 @@ namespace trieste
       {
         locations[i] = Location(source, offset, 0);
       }
+    }
 
-      return true;
+    // Record a match, found elsewhere, of a regex without capturing groups.
+    void set_match(Source& source, size_t offset, size_t len)
+    {
+      matches = 1;
+      locations[0] = Location(source, offset, len);
     }
 
   public:
-    TRegexMatch(size_t max_capture = 0)
+    TRegexMatch(size_t max_capture = 0) : max_capture_(max_capture)
     {
       locations.resize(max_capture + 1);
     }
@@ -774,12 +904,44 @@ namespace trieste
       auto& candidates = regex::is_ascii(first) ? ascii_candidates_[first] :
                                                   nonascii_candidates_;
 
-      for (auto idx : candidates)
+      if (combined_ && !candidates.empty())
       {
-        if (m.try_match(regexes_[idx], view, source, offset))
-          return static_cast<int>(idx);
+        if (auto found = combined_set_.find_prefix(view, m.ctx_))
+          return match_combined(m, *found, candidates, view, source, offset);
+      }
+
+      return match_candidates(m, candidates, view, source, offset);
+    }
+
+    bool combined() const
+    {
+      return combined_;
+    }
+
+    // Match all regexes in one scan of the input, on an automaton built from
+    // all of them, rather than trying each candidate in turn. The first regex
+    // that matches still wins. Regexes with anchors or \b are left out of the
+    // automaton and tried on their own.
+    TRegexSet& combined(bool value)
+    {
+      combined_ = value;
+
+      if (combined_)
+      {
+        std::vector<const regex::RegexEngine*> engines;
+        engines.reserve(regexes_.size());
+        for (auto& regex : regexes_)
+          engines.push_back(regex.engine_.get());
+        combined_set_ = regex::RegexSet(engines);
+        combined_all_ = combined_set_.includes_all();
+      }
+      else
+      {
+        combined_set_ = {};
+        combined_all_ = false;
       }
-      return std::nullopt;
+
+      return *this;
     }
 
     size_t size() const
@@ -793,6 +955,135 @@ namespace trieste
     }
 
   private:
+    // A node of the trie of literal regexes. Children of the root are found
+    // by first byte in literal_roots_, the rest by a short linear scan.
+    struct LiteralNode
+    {
+      // The lowest index of a literal that ends here.
+      size_t index;
+      std::vector<std::pair<uint8_t, uint32_t>> children;
+    };
+
+    // The first literal that is a prefix of the input, and its length.
+    // `index` is size() if there is none. Literals are also matched by the
+    // combined automaton, which sees them in the same scan as the other
+    // regexes, so the trie is only used without it.
+    struct LiteralMatch
+    {
+      size_t index;
+      size_t len;
+    };
+
+    LiteralMatch match_literals(const std::string_view& view) const
+    {
+      LiteralMatch result{regexes_.size(), 0};
+      if (literal_trie_.empty())
+        return result;
+
+      const LiteralNode* node = &literal_trie_[0];
+      size_t pos = 0;
+
+      while (true)
+      {
+        if (node->index < result.index)
+          result = {node->index, pos};
+
+        if (pos >= view.size())
+          break;
+
+        auto byte = static_cast<uint8_t>(view[pos]);
+        uint32_t next = 0;
+
+        if (pos == 0)
+        {
+          next = literal_roots_[byte];
+        }
+        else
+        {
+          for (auto& [b, child] : node->children)
+          {
+            if (b == byte)
+            {
+              next = child;
+              break;
+            }
+          }
+        }
+
+        if (next == 0)
+          break;
+
+        node = &literal_trie_[next];
+        pos++;
+      }
+
+      return result;
+    }
+
+    // Try each candidate in turn, with all of the literals at once.
+    std::optional<int> match_candidates(
+      TRegexMatch& m,
+      const std::vector<uint16_t>& candidates,
+      const std::string_view& view,
+      Source& source,
+      size_t offset) const
+    {
+      if (candidates.empty())
+        return std::nullopt;
+
+      // Regexes after the first literal that matches can't win.
+      auto literal = match_literals(view);
+
+      for (auto idx : candidates)
+      {
+        if (idx >= literal.index)
+          break;
+
+        if (
+          !literal_[idx] && m.try_match(regexes_[idx], view, source, offset))
+          return static_cast<int>(idx);
+      }
+
+      if (literal.index >= regexes_.size())
+        return std::nullopt;
+
+      m.set_match(source, offset, literal.len);
+      return static_cast<int>(literal.index);
+    }
+
+    std::optional<int> match_combined(
+      TRegexMatch& m,
+      const regex::RegexSet::Match& found,
+      const std::vector<uint16_t>& candidates,
+      const std::string_view& view,
+      Source& source,
+      size_t offset) const
+    {
+      size_t winner = found.found() ? found.index : regexes_.size();
+
+      // Regexes left out of the automaton win if they come first.
+      for (auto idx : candidates)
+      {
+        if (combined_all_ || (idx >= winner))
+          break;
+
+        if (
+          !combined_set_.includes(idx) &&
+          m.try_match(regexes_[idx], view, source, offset))
+          return static_cast<int>(idx);
+      }
+
+      if (!found.found())
+        return std::nullopt;
+
+      // The automaton found the extent of the match, so only the captures
+      // are left to find.
+      if (!m.match_span(regexes_[winner], view, source, offset, found.len))
+        return std::nullopt;
+
+      return static_cast<int>(winner);
+    }
+
     void build_dispatch_table()
     {
       assert(
@@ -829,6 +1120,65 @@ namespace trieste
           nonascii_candidates_.push_back(idx);
         }
       }
+
+      build_literal_trie();
+    }
+
+    // Fold the literal regexes into a trie, so that they are all matched by
+    // one walk over the input rather than one comparison each.
+    void build_literal_trie()
+    {
+      literal_.assign(regexes_.size(), false);
+
+      for (size_t i = 0; i < regexes_.size(); ++i)
+      {
+        auto& engine = regexes_[i].engine_;
+        if ((engine == nullptr) || !engine->ok() || !engine->is_literal())
+          continue;
+
+        literal_[i] = true;
+        if (literal_trie_.empty())
+          literal_trie_.push_back({regexes_.size(), {}});
+
+        uint32_t node = 0;
+        for (auto c : engine->literal())
+        {
+          auto byte = static_cast<uint8_t>(c);
+          uint32_t next = 0;
+
+          if (node == 0)
+          {
+            next = literal_roots_[byte];
+          }
+          else
+          {
+            for (auto& [b, child] : literal_trie_[node].children)
+            {
+              if (b == byte)
+              {
+                next = child;
+                break;
+              }
+            }
+          }
+
+          if (next == 0)
+          {
+            next = static_cast<uint32_t>(literal_trie_.size());
+            literal_trie_.push_back({regexes_.size(), {}});
+            if (node == 0)
+              literal_roots_[byte] = next;
+            else
+              literal_trie_[node].children.emplace_back(byte, next);
+          }
+
+          node = next;
+        }
+
+        // Earlier literals take priority over later duplicates.
+        auto& end = literal_trie_[node];
+        end.index = std::min(end.index, i);
+      }
     }
 
     std::vector<TRegex> regexes_;
@@ -838,6 +1188,14 @@ namespace trieste
     std::vector<uint16_t> nonascii_candidates_;
     // Precomputed index of the first empty-matchable regex.
     std::optional<int> empty_match_index_;
+    // Which regexes are literals, and a trie of them. Node 0 is the root.
+    std::vector<bool> literal_;
+    std::vector<LiteralNode> literal_trie_;
+    std::array<uint32_t, 256> literal_roots_ = {};
+    // All of the regexes in one automaton, if combined.
+    bool combined_ = false;
+    bool combined_all_ = false;
+    regex::RegexSet combined_set_;
   };
 
   // Backwards-compatibility aliases for code written against the old
@@ -2,20 +2,51 @@
 // SPDX-License-Identifier: MIT
 #pragma once
 
+#include "compiler.h"
 #include "unicode_data.h"
 #include "utf8.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstdint>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
 #include <string_view>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#if defined(_MSC_VER) && !defined(__clang__)
+#  include <intrin.h>
+#endif
+
 #ifndef TRIESTE_REGEX_ENGINE_ENABLE_STATS
 #  define TRIESTE_REGEX_ENGINE_ENABLE_STATS 0
 #endif
 
+// Runs of bytes in a character class are skipped 16 bytes at a time with
+// SSE2 or NEON where the target has them. Define this as 0 to always use
+// the scalar loop.
+#ifndef TRIESTE_REGEX_ENGINE_ENABLE_SIMD
+#  define TRIESTE_REGEX_ENGINE_ENABLE_SIMD 1
+#endif
+
+#if TRIESTE_REGEX_ENGINE_ENABLE_SIMD && \
+  (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64))
+#  include <emmintrin.h>
+#  define TRIESTE_REGEX_ENGINE_SSE2 1
+#elif TRIESTE_REGEX_ENGINE_ENABLE_SIMD && \
+  (defined(__aarch64__) || defined(_M_ARM64))
+#  include <arm_neon.h>
+#  define TRIESTE_REGEX_ENGINE_NEON 1
+#endif
+
 namespace trieste::regex
 {
   using namespace utf8;
@@ -90,12 +121,26 @@ namespace trieste::regex
   //   MaxClosureCacheEntries — maximum precomputed epsilon-closure entries.
   //   MaxGroupNesting — maximum depth of nested parenthesised groups.
   //   MaxCaptureFrameEntries — maximum capture frame arena entries.
+  //   MaxDfaStates   — maximum lazy DFA states cached for one engine.
+  //   MaxDfaStatesPerContext — maximum lazy DFA states in one MatchContext.
+  //   MaxDfaResets   — cache resets before a MatchContext stops using the
+  //                    lazy DFA of an engine and falls back to the NFA.
+  //   MaxCachedDfas  — maximum engines with a lazy DFA in one MatchContext.
+  //   MaxRequiredLiteralStates — largest NFA searched for a required
+  //                    literal beyond its prefix.
+  //   MaxBitNfaWords — machine words of states for the bit-parallel NFA.
   inline constexpr size_t MaxRepetition = 1000;
   inline constexpr size_t MaxPostfixSize = 100000;
   inline constexpr size_t MaxStates = 100000;
   inline constexpr size_t MaxClosureCacheEntries = 1'000'000;
   inline constexpr size_t MaxGroupNesting = 256;
   inline constexpr size_t MaxCaptureFrameEntries = 1'000'000;
+  inline constexpr size_t MaxDfaStates = 512;
+  inline constexpr size_t MaxDfaStatesPerContext = 4096;
+  inline constexpr size_t MaxDfaResets = 8;
+  inline constexpr size_t MaxCachedDfas = 64;
+  inline constexpr size_t MaxRequiredLiteralStates = 256;
+  inline constexpr size_t MaxBitNfaWords = 2;
 
   // Error codes reported when pattern compilation fails.
   // Use error_code_string() to obtain a human-readable message.
@@ -179,6 +224,18 @@ namespace trieste::regex
     return label >= CaptureClose && label < CaptureClose + MaxCaptures;
   }
 
+  // Whether a state label is an epsilon transition: a split, a capture
+  // marker or a conditional. Every other state is its own closure.
+  inline constexpr bool is_epsilon(rune_t label)
+  {
+    return label >= CaptureClose && label < Match;
+  }
+
+  static_assert(
+    (CaptureClose < CaptureOpen) && (CaptureOpen < Split) &&
+      (WordBoundary < Match) && (StartAnchor < Match) && (EndAnchor < Match),
+    "Epsilon labels must lie in [CaptureClose, Match)");
+
   inline constexpr size_t capture_index(rune_t label)
   {
     if (is_capture_open(label))
@@ -198,6 +255,174 @@ namespace trieste::regex
     return r < 128;
   }
 
+  // The index of the lowest set bit of a non-zero word.
+  inline size_t lowest_bit(uint64_t word)
+  {
+    assert(word != 0);
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return static_cast<size_t>(index);
+#else
+    return static_cast<size_t>(__builtin_ctzll(word));
+#endif
+  }
+
+  // A set of ASCII bytes that a matcher stays in the same state on, so a
+  // run of them can be consumed in one go. Bytes outside ASCII always end
+  // a run. When the set, or its complement within ASCII, is at most
+  // MaxRanges ranges of bytes, runs are scanned with vector compares;
+  // otherwise a byte at a time against the bitmap.
+  class AsciiRun
+  {
+  public:
+    static constexpr size_t MaxRanges = 4;
+
+    explicit AsciiRun(const uint64_t* bits) : bits_{bits[0], bits[1]}
+    {
+      size_t in = count_ranges(false);
+      size_t out = count_ranges(true);
+      negated_ = out < in;
+      if (std::min(in, out) > MaxRanges)
+        return;
+
+      vector_ = true;
+      for (size_t b = 0; b < 128; b++)
+      {
+        if (contains_ascii(b) == negated_)
+          continue;
+        if (
+          (ranges_ > 0) &&
+          (size_t(lo_[ranges_ - 1]) + span_[ranges_ - 1] + 1 == b))
+          span_[ranges_ - 1]++;
+        else
+        {
+          lo_[ranges_] = static_cast<uint8_t>(b);
+          span_[ranges_] = 0;
+          ranges_++;
+        }
+      }
+    }
+
+    bool contains(unsigned char byte) const
+    {
+      return (byte < 128) && contains_ascii(byte);
+    }
+
+    // The first position from pos on whose byte is not in the set. Most
+    // runs in tokenizers are short, so the first byte is checked inline.
+    size_t scan(const std::string_view& str, size_t pos) const
+    {
+      if (
+        (pos >= str.size()) ||
+        !contains(static_cast<unsigned char>(str[pos])))
+        return pos;
+
+      return scan_rest(str, pos + 1);
+    }
+
+  private:
+    size_t scan_rest(const std::string_view& str, size_t pos) const
+    {
+      auto data = reinterpret_cast<const unsigned char*>(str.data());
+      size_t size = str.size();
+
+#if defined(TRIESTE_REGEX_ENGINE_SSE2)
+      if (vector_)
+      {
+        // A byte is in [lo, lo + span] iff byte - lo <= span, unsigned.
+        // Bytes from 0x80 on are never in a range of ASCII bytes.
+        __m128i lo[MaxRanges];
+        __m128i span[MaxRanges];
+        for (size_t r = 0; r < ranges_; r++)
+        {
+          lo[r] = _mm_set1_epi8(static_cast<char>(lo_[r]));
+          span[r] = _mm_set1_epi8(static_cast<char>(span_[r]));
+        }
+
+        for (; pos + 16 <= size; pos += 16)
+        {
+          __m128i x =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+          __m128i hit = _mm_setzero_si128();
+          for (size_t r = 0; r < ranges_; r++)
+          {
+            __m128i y = _mm_sub_epi8(x, lo[r]);
+            hit = _mm_or_si128(
+              hit, _mm_cmpeq_epi8(_mm_max_epu8(y, span[r]), span[r]));
+          }
+
+          auto stop = static_cast<uint32_t>(
+            negated_ ? (_mm_movemask_epi8(hit) | _mm_movemask_epi8(x)) :
+                       (~_mm_movemask_epi8(hit) & 0xFFFF));
+          if (stop != 0)
+            return pos + lowest_bit(stop);
+        }
+      }
+#elif defined(TRIESTE_REGEX_ENGINE_NEON)
+      if (vector_)
+      {
+        uint8x16_t lo[MaxRanges];
+        uint8x16_t span[MaxRanges];
+        for (size_t r = 0; r < ranges_; r++)
+        {
+          lo[r] = vdupq_n_u8(lo_[r]);
+          span[r] = vdupq_n_u8(span_[r]);
+        }
+
+        for (; pos + 16 <= size; pos += 16)
+        {
+          uint8x16_t x = vld1q_u8(data + pos);
+          uint8x16_t hit = vdupq_n_u8(0);
+          for (size_t r = 0; r < ranges_; r++)
+            hit = vorrq_u8(hit, vcleq_u8(vsubq_u8(x, lo[r]), span[r]));
+
+          uint8x16_t stop = negated_ ?
+            vorrq_u8(hit, vcgeq_u8(x, vdupq_n_u8(0x80))) :
+            vmvnq_u8(hit);
+
+          // Narrow each byte of the mask to a nibble.
+          uint64_t mask = vget_lane_u64(
+            vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(stop), 4)),
+            0);
+          if (mask != 0)
+            return pos + (lowest_bit(mask) >> 2);
+        }
+      }
+#endif
+
+      while ((pos < size) && contains(data[pos]))
+        pos++;
+
+      return pos;
+    }
+
+    bool contains_ascii(size_t byte) const
+    {
+      return (bits_[byte >> 6] >> (byte & 63)) & 1;
+    }
+
+    size_t count_ranges(bool negated) const
+    {
+      size_t count = 0;
+      bool prev = false;
+      for (size_t b = 0; b < 128; b++)
+      {
+        bool in = contains_ascii(b) != negated;
+        count += in && !prev;
+        prev = in;
+      }
+      return count;
+    }
+
+    uint64_t bits_[2];
+    uint8_t lo_[MaxRanges] = {};
+    uint8_t span_[MaxRanges] = {};
+    uint8_t ranges_ = 0;
+    bool vector_ = false; // False if runs are scanned a byte at a time.
+    bool negated_ = false; // The ranges are of the bytes not in the set.
+  };
+
   // Decode one rune from utf8_str at byte offset pos.
   // Returns {rune_value, bytes_consumed}. Fast path for ASCII.
   inline std::pair<rune_t, size_t>
@@ -214,19 +439,105 @@ namespace trieste::regex
   // Public Types
   // =========================================================================
 
+  // Two-level membership table for the non-ASCII runes of a large class,
+  // such as a Unicode category. Each 256-rune page maps to a 256-bit block;
+  // block 0 is empty and block 1 full, and only pages that are partly in the
+  // class get a block of their own. Pages past the end of `pages` all map to
+  // `tail`.
+  struct RuneTable
+  {
+    std::vector<uint16_t> pages;
+    std::vector<uint64_t> blocks;
+    uint16_t tail = 0;
+
+    bool contains(rune_t r) const
+    {
+      size_t page = r >> 8;
+      size_t block = (page < pages.size()) ? pages[page] : tail;
+      return (blocks[(block << 2) | ((r >> 6) & 3)] >> (r & 63)) & 1;
+    }
+
+    bool empty() const
+    {
+      return blocks.empty();
+    }
+
+    // `ranges` should be sorted and non-overlapping. Pages from `tail_page`
+    // on are all in the class if `full_tail`, and otherwise none are.
+    static RuneTable build(
+      const std::vector<std::pair<rune_t, rune_t>>& ranges,
+      rune_t tail_page,
+      bool full_tail)
+    {
+      RuneTable table;
+      table.blocks = {0, 0, 0, 0, ~uint64_t(0), ~uint64_t(0), ~uint64_t(0),
+                      ~uint64_t(0)};
+      table.pages.assign(tail_page, 0);
+      table.tail = full_tail ? 1 : 0;
+
+      for (auto& [lo, hi] : ranges)
+      {
+        rune_t end = std::min(hi >> 8, tail_page - 1);
+        for (rune_t page = lo >> 8; page <= end; page++)
+        {
+          rune_t first = std::max(lo, page << 8);
+          rune_t last = std::min(hi, (page << 8) | 0xFF);
+          if ((first == (page << 8)) && (last == ((page << 8) | 0xFF)))
+          {
+            table.pages[page] = 1;
+            continue;
+          }
+
+          // Ranges don't overlap, so the empty and full blocks are never
+          // written to.
+          if (table.pages[page] <= 1)
+          {
+            table.pages[page] = static_cast<uint16_t>(table.blocks.size() >> 2);
+            table.blocks.resize(table.blocks.size() + 4, 0);
+          }
+          uint64_t* block = &table.blocks[size_t(table.pages[page]) << 2];
+          for (rune_t r = first; r <= last;)
+          {
+            rune_t word_last = std::min(last, r | 63);
+            uint64_t width = word_last - r + 1;
+            uint64_t mask = (width == 64) ? ~uint64_t(0) :
+                                            ((uint64_t(1) << width) - 1);
+            block[(r >> 6) & 3] |= mask << (r & 63);
+            r = word_last + 1;
+          }
+        }
+      }
+      return table;
+    }
+
+    size_t bytes() const
+    {
+      return (pages.capacity() * sizeof(uint16_t)) +
+        (blocks.capacity() * sizeof(uint64_t));
+    }
+  };
+
   // A character class: a sorted, non-overlapping set of Unicode codepoint
   // ranges plus a precomputed 128-bit ASCII bitmap for fast single-byte
-  // acceptance checks.
+  // acceptance checks. Large classes also get a RuneTable for the rest.
   struct RuneClass
   {
+    // Classes with at most this many non-ASCII ranges are searched instead.
+    static constexpr size_t MaxSearchedRanges = 8;
+
     std::vector<std::pair<rune_t, rune_t>> ranges;
     uint64_t ascii_bitmap[2] = {};
+    // Set once the class is final, and shared by copies of it.
+    std::shared_ptr<const RuneTable> table;
 
     bool contains(rune_t r) const
     {
       if (is_ascii(r))
         return (ascii_bitmap[r >> 6] >> (r & 63)) & 1;
 
+      if (table)
+        return (r <= 0x10FFFF) && table->contains(r);
+
       if (ranges.empty())
         return false;
 
@@ -247,11 +558,20 @@ namespace trieste::regex
     void add_range(rune_t lo, rune_t hi)
     {
       ranges.push_back({lo, hi});
+      table.reset();
     }
 
+    // Both sides are usually sorted, e.g. after merging a Unicode category,
+    // and then they are merged in linear time so that finalize needn't sort.
     void merge(const RuneClass& other)
     {
+      auto mid = static_cast<std::ptrdiff_t>(ranges.size());
       ranges.insert(ranges.end(), other.ranges.begin(), other.ranges.end());
+      table.reset();
+      if (
+        std::is_sorted(ranges.begin(), ranges.begin() + mid) &&
+        std::is_sorted(ranges.begin() + mid, ranges.end()))
+        std::inplace_merge(ranges.begin(), ranges.begin() + mid, ranges.end());
     }
 
     // Sort, merge overlapping ranges, and rebuild the ASCII bitmap.
@@ -264,21 +584,60 @@ namespace trieste::regex
         rebuild_ascii_bitmap();
         return;
       }
-      std::sort(ranges.begin(), ranges.end());
-      std::vector<std::pair<rune_t, rune_t>> merged;
-      merged.push_back(ranges[0]);
+      // The ranges are usually a sorted block, e.g. a Unicode category, and a
+      // few more, so only those are sorted.
+      auto sorted = std::is_sorted_until(ranges.begin(), ranges.end());
+      if (sorted != ranges.end())
+      {
+        std::sort(sorted, ranges.end());
+        std::inplace_merge(ranges.begin(), sorted, ranges.end());
+      }
+      size_t last = 0;
       for (size_t i = 1; i < ranges.size(); i++)
       {
-        auto& back = merged.back();
+        auto& back = ranges[last];
         if (ranges[i].first <= back.second + 1)
           back.second = std::max(back.second, ranges[i].second);
         else
-          merged.push_back(ranges[i]);
+          ranges[++last] = ranges[i];
       }
-      ranges = std::move(merged);
+      ranges.resize(last + 1);
       rebuild_ascii_bitmap();
     }
 
+    // Build the RuneTable, unless the class has one or is small enough to
+    // search. Called once the class is final, as an engine finishes
+    // compiling.
+    void build_table()
+    {
+      if (!table)
+        table = make_table();
+    }
+
+    std::shared_ptr<const RuneTable> make_table() const
+    {
+      size_t searched = 0;
+      rune_t top = 0;
+      rune_t tail_start = 0x110000;
+      for (auto& [lo, hi] : ranges)
+      {
+        searched += (hi >= 128);
+        top = std::max(top, hi);
+        if (hi == 0x10FFFF)
+          tail_start = lo;
+      }
+      if ((searched <= MaxSearchedRanges) || (top > 0x10FFFF))
+        return nullptr;
+
+      // A class that runs to the end of Unicode, e.g. a negated one, ends in
+      // full pages, which the tail covers.
+      bool full_tail = (top == 0x10FFFF);
+      rune_t tail_page =
+        full_tail ? ((tail_start + 0xFF) >> 8) : ((top >> 8) + 1);
+      return std::make_shared<const RuneTable>(
+        RuneTable::build(ranges, std::max<rune_t>(tail_page, 1), full_tail));
+    }
+
     // Add a gap range to `out`, splitting around the surrogate range
     // [0xD800, 0xDFFF] to produce only valid Unicode scalar values.
     static void add_gap_excluding_surrogates(
@@ -335,7 +694,8 @@ namespace trieste::regex
     {
       // All Unicode scalar values (XSD semantics: matches everything incl.
       // newlines).
-      RuneClass rc{{{0, 0xD7FF}, {0xE000, 0x10FFFF}}};
+      RuneClass rc;
+      rc.ranges = {{0, 0xD7FF}, {0xE000, 0x10FFFF}};
       rc.rebuild_ascii_bitmap();
       return rc;
     }
@@ -362,15 +722,87 @@ namespace trieste::regex
 
   class RegexEngine
   {
+    friend class RegexSet;
+
   private:
     struct StateDef;
-    using State = StateDef*;
+    using State = const StateDef*;
+
+    // A link to no state.
+    static constexpr uint32_t NoState = static_cast<uint32_t>(-1);
 
-    // Thread for capture-aware simulation.
+    // Index of an AsciiRun for a state that has none.
+    static constexpr uint32_t NoRun = static_cast<uint32_t>(-1);
+
+    // Thread for capture-aware simulation and for unanchored search.
+    // `start` is the byte offset at which the thread's match attempt began;
+    // it is always 0 for prefix matching.
     struct Thread
     {
       State state;
       size_t caps_frame;
+      size_t start;
+    };
+
+    // A DFA built lazily from the NFAs of an ordered list of engines by
+    // subset construction, for prefix matching without captures. Each DFA
+    // state is a sorted set of NFA states, each tagged with the index of the
+    // engine (the rule) it belongs to. Transitions on ASCII runes are cached
+    // in a row of 128 entries per state; other runes are stepped through the
+    // NFAs and the resulting set is looked up. State 0 is the empty set,
+    // which can never match.
+    struct LazyDfa
+    {
+      static constexpr uint32_t Dead = 0;
+      static constexpr uint32_t Unknown = static_cast<uint32_t>(-1);
+      static constexpr uint32_t NoRule = static_cast<uint32_t>(-1);
+      static constexpr uint32_t UncheckedRun = static_cast<uint32_t>(-2);
+
+      // (rule << 32) | closure_index, so sets are ordered by rule.
+      using Element = uint64_t;
+
+      // The first rule that has matched, and the first rule with an NFA
+      // state in the set. Both are NoRule if there is none. `run` indexes
+      // the bytes the state loops on in `runs`; it is UncheckedRun until
+      // the state is first seen to loop.
+      struct StateInfo
+      {
+        uint32_t accept_rule;
+        uint32_t live_rule;
+        uint32_t run;
+      };
+
+      struct SetHash
+      {
+        size_t operator()(const std::vector<Element>& set) const
+        {
+          size_t h = set.size();
+          for (auto e : set)
+            h = (h ^ static_cast<size_t>(e ^ (e >> 32))) * 0x100000001b3;
+          return h;
+        }
+      };
+
+      uint64_t id = 0;
+      uint32_t rules = 0;
+      size_t calls = 0;
+      size_t resets = 0;
+      bool failed = false;
+      uint32_t start = Dead;
+      std::unordered_map<std::vector<Element>, uint32_t, SetHash> index;
+      std::vector<const std::vector<Element>*> sets;
+      std::vector<StateInfo> info;
+      std::vector<uint32_t> transitions;
+      std::vector<AsciiRun> runs;
+    };
+
+    // Result of running a LazyDfa: the first rule that matched and its
+    // longest prefix, or failed if the cache thrashed.
+    struct DfaMatch
+    {
+      uint32_t rule = LazyDfa::NoRule;
+      size_t len = 0;
+      bool failed = false;
     };
 
   public:
@@ -405,6 +837,9 @@ namespace trieste::regex
     // - RegexEngine::match/find_prefix bind the context to the engine each
     //   call and reset per-call counters, so contexts can be reused safely
     //   across different RegexEngine instances.
+    // - A context also caches a lazy DFA for each engine it is used with
+    //   (up to MaxCachedDfas), so alternating between engines, as TRegexSet
+    //   does, keeps every DFA warm.
     struct MatchContext
     {
       friend class RegexEngine;
@@ -427,7 +862,7 @@ namespace trieste::regex
       std::vector<State> noncapturing_next_states;
       std::vector<Thread> capturing_current_threads;
       std::vector<Thread> capturing_next_threads;
-      std::vector<std::pair<State, size_t>> capture_traversal_stack_;
+      std::vector<std::pair<uint32_t, size_t>> capture_traversal_stack_;
 
       // --- Visited tracking (epoch-based for large NFAs) ---
       size_t epoch_counter = 0;
@@ -441,6 +876,16 @@ namespace trieste::regex
       // --- Capture frame allocator ---
       std::vector<size_t> capture_frames;
       size_t capture_frame_slots = 0;
+      std::vector<size_t> capture_frames_scratch;
+      std::vector<size_t> capture_frame_remap;
+
+      // --- Lazy DFAs of the engines recently matched with this context ---
+      // Keyed by engine id rather than address, so that a new engine can't
+      // pick up the DFA of a destroyed one.
+      std::vector<uint64_t> dfa_ids_;
+      std::vector<std::unique_ptr<LazyDfa>> dfas_;
+      std::vector<LazyDfa::Element> dfa_scratch_;
+      size_t dfa_states_total_ = 0;
 
       // --- Stats accumulator ---
 #if TRIESTE_REGEX_ENGINE_ENABLE_STATS
@@ -466,6 +911,44 @@ namespace trieste::regex
         ensure_visited_capacity(state_count);
       }
 
+      LazyDfa& dfa_for(uint64_t id, size_t rules)
+      {
+        for (size_t i = 0; i < dfa_ids_.size(); i++)
+        {
+          if (dfa_ids_[i] == id)
+            return *dfas_[i];
+        }
+
+        if (dfa_ids_.size() >= MaxCachedDfas)
+        {
+          dfa_ids_.clear();
+          dfas_.clear();
+          dfa_states_total_ = 0;
+        }
+
+        dfa_ids_.push_back(id);
+        dfas_.push_back(std::make_unique<LazyDfa>());
+        dfas_.back()->id = id;
+        dfas_.back()->rules = static_cast<uint32_t>(rules);
+        return *dfas_.back();
+      }
+
+      void clear_dfa(LazyDfa& dfa)
+      {
+        dfa_states_total_ -= dfa.sets.size();
+        dfa.index.clear();
+        dfa.sets.clear();
+        dfa.info.clear();
+        dfa.transitions.clear();
+        dfa.runs.clear();
+      }
+
+      void clear_dfas()
+      {
+        for (auto& dfa : dfas_)
+          clear_dfa(*dfa);
+      }
+
       void reset_capture_frames(size_t cap_slots)
       {
         capture_frame_slots = cap_slots;
@@ -516,6 +999,37 @@ namespace trieste::regex
         return capture_frames.data() + (frame * capture_frame_slots);
       }
 
+      // Move the frames still referenced by `threads` or by `keep` to a
+      // fresh arena, dropping the rest. Frames are copied before they are
+      // written, so threads that share a frame can share the copy.
+      void compact_capture_frames(std::vector<Thread>& threads, size_t& keep)
+      {
+        assert(capture_frame_slots > 0);
+        size_t slots = capture_frame_slots;
+        capture_frame_remap.assign(capture_frames.size() / slots, npos);
+        capture_frames_scratch.clear();
+
+        auto relocate = [&](size_t& frame) {
+          if (frame == npos)
+            return;
+
+          auto& to = capture_frame_remap[frame];
+          if (to == npos)
+          {
+            to = capture_frames_scratch.size() / slots;
+            auto from = capture_frames.begin() + (frame * slots);
+            capture_frames_scratch.insert(
+              capture_frames_scratch.end(), from, from + slots);
+          }
+          frame = to;
+        };
+
+        for (auto& t : threads)
+          relocate(t.caps_frame);
+        relocate(keep);
+        std::swap(capture_frames, capture_frames_scratch);
+      }
+
       void reset_match_stats()
       {
 #if TRIESTE_REGEX_ENGINE_ENABLE_STATS
@@ -598,17 +1112,22 @@ namespace trieste::regex
     RegexEngine(const std::string_view& utf8_regexp, SyntaxMode syntax_mode)
     : error_code_(ErrorCode::NoError),
       num_captures_(0),
-      syntax_mode_(syntax_mode)
+      syntax_mode_(syntax_mode),
+      pattern_hash_(hash_pattern(utf8_regexp))
     {
       std::vector<rune_t> postfix = regexp_to_postfix_runes(utf8_regexp);
-      // Reserve for Thompson: at most 2 states per postfix token + 1 accept.
-      // This guarantees no reallocation, keeping all State pointers stable.
-      owned_states_.reserve(2 * postfix.size() + 1);
+      // Reserve exactly for Thompson's construction, so that there is no
+      // reallocation and State pointers stay stable while the NFA is built.
+      owned_states_.reserve(nfa_state_count(postfix));
       accept_state_ = create_state(Match);
       start_state_ = postfix_to_nfa(postfix);
+      trim_states();
       detect_conditional_states();
+      detect_literal();
+      detect_required_literals();
       precompute_epsilon_closures();
       finalize_states();
+      build_bit_nfa();
       first_char_info_ = compute_first_char_info();
     }
 
@@ -647,6 +1166,220 @@ namespace trieste::regex
       return syntax_mode_;
     }
 
+    // Approximate heap and object footprint of the compiled pattern, in
+    // bytes. Scratch space lives in MatchContext and isn't counted.
+    size_t memory_usage() const
+    {
+      size_t bytes = sizeof(*this) + error_arg_.capacity() +
+        literal_.capacity() + literal_prefix_.capacity() +
+        required_literal_.capacity() +
+        (bit_states_.capacity() * sizeof(State)) +
+        (bit_run_.capacity() * sizeof(uint32_t)) +
+        (bit_runs_.capacity() * sizeof(AsciiRun)) +
+        ((bit_start_.capacity() + bit_ascii_.capacity() +
+          bit_follow_.capacity()) *
+         sizeof(uint64_t)) +
+        (owned_states_.capacity() * sizeof(StateDef)) +
+        (rune_classes_.capacity() * sizeof(RuneClass)) +
+        (ascii_classes_.capacity() * sizeof(uint64_t)) +
+        (closure_cache_flat_.capacity() * sizeof(uint32_t)) +
+        (closure_cache_offsets_.capacity() * sizeof(uint32_t));
+
+      for (auto& rc : rune_classes_)
+      {
+        bytes += rc.ranges.capacity() * sizeof(rc.ranges[0]);
+        if (rc.table)
+          bytes += rc.table->bytes();
+      }
+
+      return bytes;
+    }
+
+    // The compiled program as a compact byte string: a hash of the pattern,
+    // the NFA states, rune classes, epsilon closures, first-char info and
+    // literals. deserialize()
+    // turns it back into an engine without parsing the pattern or computing
+    // closures, so lexers can be precompiled into a binary or cached on disk.
+    std::string serialize() const
+    {
+      ProgramWriter out;
+      out.bytes.append(ProgramMagic);
+      out.uint(ProgramVersion);
+      out.uint(static_cast<uint64_t>(syntax_mode_));
+      out.uint(pattern_hash_);
+      out.uint(static_cast<uint64_t>(error_code_));
+      out.string(error_arg_);
+      out.uint(num_captures_);
+      out.uint(has_conditionals_);
+      out.uint(is_literal_);
+      out.string(literal_);
+      out.string(literal_prefix_);
+      out.string(required_literal_);
+
+      out.uint(rune_classes_.size());
+      for (auto& rc : rune_classes_)
+      {
+        out.uint(rc.ranges.size());
+        for (auto& [lo, hi] : rc.ranges)
+        {
+          out.uint(lo);
+          out.uint(hi - lo);
+        }
+        out.uint(rc.ascii_bitmap[0]);
+        out.uint(rc.ascii_bitmap[1]);
+      }
+
+      out.uint(owned_states_.size());
+      for (auto& state : owned_states_)
+      {
+        out.uint(state.label);
+        out.uint(link_ref(state.next));
+        out.uint(link_ref(state.next_alt));
+      }
+      out.uint(link_ref(link_to(start_state_)));
+      out.uint(link_ref(link_to(accept_state_)));
+
+      // Offsets only grow, so they are stored as deltas.
+      out.uint(closure_cache_offsets_.size());
+      uint32_t prev = 0;
+      for (auto offset : closure_cache_offsets_)
+      {
+        out.uint(offset - prev);
+        prev = offset;
+      }
+      out.uint(closure_cache_flat_.size());
+      for (auto state : closure_cache_flat_)
+        out.uint(link_ref(state));
+
+      out.uint(first_char_info_.bitmap[0]);
+      out.uint(first_char_info_.bitmap[1]);
+      out.uint(first_char_info_.can_match_empty);
+      out.uint(first_char_info_.can_match_nonascii);
+      return std::move(out.bytes);
+    }
+
+    // An engine from the output of serialize(), or nullopt if the bytes are
+    // from another version of the format, truncated, or inconsistent. The
+    // per-state ASCII masks and the bit-parallel NFA are rebuilt, as they
+    // are cheap to derive and larger than the rest of the program.
+    static std::optional<RegexEngine> deserialize(std::string_view bytes)
+    {
+      ProgramReader in{bytes};
+      if (!in.magic(ProgramMagic) || (in.uint() != ProgramVersion))
+        return std::nullopt;
+
+      RegexEngine re(ProgramTag{});
+      uint64_t mode = in.uint();
+      re.pattern_hash_ = in.uint();
+      uint64_t error = in.uint();
+      if (
+        (mode > static_cast<uint64_t>(SyntaxMode::IregexpStrict)) ||
+        (error > static_cast<uint64_t>(ErrorCode::ErrorInternalError)))
+        return std::nullopt;
+      re.syntax_mode_ = static_cast<SyntaxMode>(mode);
+      re.error_code_ = static_cast<ErrorCode>(error);
+      re.error_arg_ = in.string();
+      re.num_captures_ = in.uint();
+      re.has_conditionals_ = in.flag();
+      re.is_literal_ = in.flag();
+      re.literal_ = in.string();
+      re.literal_prefix_ = in.string();
+      re.required_literal_ = in.string();
+      if (re.num_captures_ > MaxCaptures)
+        return std::nullopt;
+
+      re.rune_classes_.resize(in.count());
+      for (auto& rc : re.rune_classes_)
+      {
+        rc.ranges.resize(in.count());
+        for (auto& [lo, hi] : rc.ranges)
+        {
+          lo = in.rune();
+          hi = lo + in.rune();
+          if (hi < lo)
+            in.failed = true;
+        }
+        rc.ascii_bitmap[0] = in.uint();
+        rc.ascii_bitmap[1] = in.uint();
+      }
+
+      // Reserve exactly, so that state pointers stay stable.
+      size_t state_count = in.count();
+      re.owned_states_.reserve(state_count);
+      for (size_t i = 0; i < state_count; i++)
+      {
+        rune_t label = in.rune();
+        uint32_t next = read_link(in, state_count);
+        uint32_t next_alt = read_link(in, state_count);
+        re.owned_states_.push_back({label, next, next_alt, 0});
+
+        if (
+          (is_class_ref(label) &&
+           (class_ref_index(label) >= re.rune_classes_.size())) ||
+          ((is_capture_open(label) || is_capture_close(label)) &&
+           (capture_index(label) >= re.num_captures_)))
+          in.failed = true;
+      }
+      re.start_state_ = re.target(read_link(in, state_count));
+      re.accept_state_ = re.target(read_link(in, state_count));
+
+      re.closure_cache_offsets_.resize(in.count());
+      uint64_t offset = 0;
+      for (auto& entry : re.closure_cache_offsets_)
+      {
+        offset += in.uint();
+        entry = static_cast<uint32_t>(offset);
+        if (offset > std::numeric_limits<uint32_t>::max())
+          in.failed = true;
+      }
+      re.closure_cache_flat_.resize(in.count());
+      for (auto& entry : re.closure_cache_flat_)
+      {
+        entry = read_link(in, state_count);
+        if (entry == NoState)
+          in.failed = true;
+      }
+
+      re.first_char_info_.bitmap[0] = in.uint();
+      re.first_char_info_.bitmap[1] = in.uint();
+      re.first_char_info_.can_match_empty = in.flag();
+      re.first_char_info_.can_match_nonascii = in.flag();
+
+      if (in.failed || !in.rest.empty())
+        return std::nullopt;
+
+      if (re.ok())
+      {
+        // Matching relies on a closure for every state and set of flags.
+        size_t slots =
+          state_count * (re.has_conditionals_ ? ClosureFlagCombinations : 1);
+        if (
+          (re.start_state_ == nullptr) || (re.accept_state_ == nullptr) ||
+          (re.closure_cache_offsets_.size() != slots + 1) ||
+          (offset != re.closure_cache_flat_.size()))
+          return std::nullopt;
+      }
+
+      re.finalize_states();
+      re.build_bit_nfa();
+      return re;
+    }
+
+    // As above, but also nullopt unless the program was compiled from
+    // pattern in mode, so that a program left stale by an edit to its
+    // pattern isn't used in place of the pattern.
+    static std::optional<RegexEngine> deserialize(
+      std::string_view bytes, std::string_view pattern, SyntaxMode mode)
+    {
+      auto re = deserialize(bytes);
+      if (
+        re &&
+        ((re->pattern_hash_ != hash_pattern(pattern)) ||
+         (re->syntax_mode_ != mode)))
+        return std::nullopt;
+      return re;
+    }
+
     struct FirstCharInfo
     {
       uint64_t bitmap[2];
@@ -676,6 +1409,31 @@ namespace trieste::regex
       return first_char_info_;
     }
 
+    // True if the pattern only matches one ASCII string, literal(), and has
+    // no groups. Such patterns are matched by comparing bytes.
+    bool is_literal() const
+    {
+      return is_literal_;
+    }
+
+    const std::string& literal() const
+    {
+      return literal_;
+    }
+
+    // An ASCII string that every match starts with, and the longest ASCII
+    // string that every match contains. Either may be empty. search() looks
+    // for these with a substring scan before running the NFA.
+    const std::string& literal_prefix() const
+    {
+      return literal_prefix_;
+    }
+
+    const std::string& required_literal() const
+    {
+      return required_literal_;
+    }
+
     bool match(const std::string_view& utf8_str) const
     {
       MatchContext ctx;
@@ -687,6 +1445,39 @@ namespace trieste::regex
       return find_prefix(utf8_str, ctx, true) == utf8_str.size();
     }
 
+    // match() on each of `count` texts, for checking many short strings
+    // against one pattern. Sets matched[i] for texts[i] and returns the
+    // number that match. The context is bound once, and without
+    // conditionals every text runs on the lazy DFA, which unlike match()
+    // only has to find whether the whole text leads to an accepting state.
+    size_t match_batch(
+      const std::string_view* texts,
+      size_t count,
+      bool* matched,
+      MatchContext& ctx) const
+    {
+      ctx.reset_match_stats();
+      if (ok() && !is_literal_ && !has_conditionals_)
+      {
+        auto& dfa = ctx.dfa_for(id_, 1);
+        if (dfa.sets.empty() && !dfa.failed)
+        {
+          const RegexEngine* self = this;
+          dfa_reset(&self, dfa, ctx);
+        }
+        if (!dfa.failed)
+          return match_batch_dfa(texts, count, matched, dfa, ctx);
+      }
+
+      size_t matches = 0;
+      for (size_t i = 0; i < count; i++)
+      {
+        matched[i] = match(texts[i], ctx);
+        matches += matched[i];
+      }
+      return matches;
+    }
+
     // Prefix match: returns the byte length of the longest prefix of
     // utf8_str that matches the pattern. Returns npos if no prefix matches.
     static constexpr size_t npos = static_cast<size_t>(-1);
@@ -741,6 +1532,24 @@ namespace trieste::regex
       return find_prefix_with_context(utf8_str, captures, ctx, at_start, false);
     }
 
+    // Captures of a prefix match whose length is already known, e.g. from
+    // find_prefix without captures, from a RegexSet, or because the whole
+    // string has to match. Fills `captures` as find_prefix does for a match
+    // of exactly len bytes, and returns false if there is no such match.
+    bool find_captures(
+      const std::string_view& utf8_str,
+      size_t len,
+      std::vector<Capture>& captures,
+      MatchContext& ctx,
+      bool at_start = true) const
+    {
+      captures.clear();
+      if (!ok() || (len == npos) || (len > utf8_str.size()))
+        return false;
+      return find_captures_with_context(
+        utf8_str, len, captures, ctx, at_start, false);
+    }
+
     // Result of a search() call.
     struct SearchResult
     {
@@ -758,6 +1567,11 @@ namespace trieste::regex
     // match position and length. On success, captures are filled with byte
     // offsets relative to utf8_str (not the suffix).
     //
+    // The result is the leftmost match, and the longest match starting
+    // there, with the same captures as find_prefix would report at that
+    // position. All start positions are simulated in a single pass, so the
+    // search is linear in the length of utf8_str.
+    //
     // Unlike find_prefix, search correctly tracks word-boundary context
     // (\b) as it scans through the string, so patterns like \bword\b work
     // correctly when matched against interior positions.
@@ -775,56 +1589,62 @@ namespace trieste::regex
       MatchContext& ctx,
       size_t start_pos = 0) const
     {
-      SearchResult result;
-      if (!ok())
+      captures.clear();
+      if (!ok() || start_pos > utf8_str.size())
+        return {};
+
+      if (is_literal_)
+      {
+        size_t at = utf8_str.find(literal_, start_pos);
+        if (at == std::string_view::npos)
+          return {};
+        return {at, literal_.size()};
+      }
+
+      // Without the required literal there can't be a match. This is the
+      // common case when searching large inputs. A prefix is looked for by
+      // the search itself.
+      if (
+        (required_literal_.size() > literal_prefix_.size()) &&
+        (utf8_str.find(required_literal_, start_pos) == std::string_view::npos))
+        return {};
+
+      // With a literal prefix the search only starts threads where the
+      // prefix occurs, so captures are cheapest found in the same pass.
+      // Otherwise a thread starts at nearly every position, and tracking
+      // captures for all of them costs more than a second pass over the
+      // span that matched.
+      if ((num_captures_ > 0) && !literal_prefix_.empty())
+        return search_unanchored<true>(utf8_str, captures, ctx, start_pos);
+
+      auto result =
+        search_unanchored<false>(utf8_str, captures, ctx, start_pos);
+      if (!result.found() || (num_captures_ == 0))
         return result;
 
-      for (size_t probe = start_pos; probe <= utf8_str.size();)
+      // The captures are those of find_prefix at the start of the match.
+      size_t at = result.match_start;
+      bool prev_is_word = (at > 0) &&
+        is_word_char(
+          static_cast<rune_t>(static_cast<unsigned char>(utf8_str[at - 1])));
+      if (!find_captures_with_context(
+            utf8_str.substr(at),
+            result.match_len,
+            captures,
+            ctx,
+            at == 0,
+            prev_is_word))
+        return {};
+
+      for (auto& capture : captures)
       {
-        bool prev_word = false;
-        if (probe > 0)
+        if (capture.matched())
         {
-          // The byte at probe-1 is either an ASCII char or part of a
-          // multi-byte UTF-8 sequence. Since is_word_char only matches
-          // ASCII word chars ([0-9A-Za-z_]), and all multi-byte leading/
-          // continuation bytes have values >= 0x80, casting the raw byte
-          // to rune_t gives the correct result.
-          prev_word = is_word_char(static_cast<rune_t>(
-            static_cast<unsigned char>(utf8_str[probe - 1])));
+          capture.start += at;
+          capture.end += at;
         }
+      }
 
-        std::string_view suffix(
-          utf8_str.data() + probe, utf8_str.size() - probe);
-        size_t len = find_prefix_with_context(
-          suffix, captures, ctx, probe == 0, prev_word);
-        if (len != npos)
-        {
-          result.match_start = probe;
-          result.match_len = len;
-          // Adjust capture offsets to full-string coordinates.
-          for (auto& cap : captures)
-          {
-            if (cap.matched())
-            {
-              cap.start += probe;
-              cap.end += probe;
-            }
-          }
-          return result;
-        }
-
-        // Advance by rune width so probes only occur at UTF-8 codepoint
-        // boundaries, never in the middle of a multi-byte sequence.
-        if (probe < utf8_str.size())
-        {
-          auto [r, n] = decode_rune(utf8_str, probe);
-          probe += n;
-        }
-        else
-        {
-          break;
-        }
-      }
       return result;
     }
 
@@ -848,24 +1668,427 @@ namespace trieste::regex
       }
     }
 
+    // Serialized programs start with the magic and the format version, and
+    // then hold unsigned LEB128 integers and length-prefixed strings. States
+    // are referred to by index + 1, with 0 for none.
+    static constexpr std::string_view ProgramMagic = "TRXP";
+    static constexpr uint64_t ProgramVersion = 3;
+
+    // FNV-1a, to tie a serialized program to the pattern it came from.
+    static uint64_t hash_pattern(std::string_view pattern)
+    {
+      uint64_t hash = 0xcbf29ce484222325;
+      for (char c : pattern)
+      {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3;
+      }
+      return hash;
+    }
+
+    struct ProgramTag
+    {};
+
+    // An empty engine for deserialize() to fill in.
+    explicit RegexEngine(ProgramTag)
+    : start_state_(nullptr),
+      accept_state_(nullptr),
+      error_code_(ErrorCode::NoError),
+      num_captures_(0)
+    {}
+
+    struct ProgramWriter
+    {
+      std::string bytes;
+
+      void uint(uint64_t value)
+      {
+        while (value >= 0x80)
+        {
+          bytes.push_back(static_cast<char>((value & 0x7F) | 0x80));
+          value >>= 7;
+        }
+        bytes.push_back(static_cast<char>(value));
+      }
+
+      void string(std::string_view value)
+      {
+        uint(value.size());
+        bytes.append(value);
+      }
+    };
+
+    // Reads what ProgramWriter wrote. Running out of bytes or reading a
+    // value out of range sets `failed` and yields zeros from then on.
+    struct ProgramReader
+    {
+      std::string_view rest;
+      bool failed = false;
+
+      bool magic(std::string_view expected)
+      {
+        if (rest.substr(0, expected.size()) != expected)
+          return false;
+        rest.remove_prefix(expected.size());
+        return true;
+      }
+
+      uint64_t uint()
+      {
+        uint64_t value = 0;
+        for (unsigned shift = 0; !failed && (shift < 64); shift += 7)
+        {
+          if (rest.empty())
+            break;
+
+          auto byte = static_cast<uint8_t>(rest.front());
+          rest.remove_prefix(1);
+          value |= uint64_t(byte & 0x7F) << shift;
+          if ((byte & 0x80) == 0)
+            return value;
+        }
+        failed = true;
+        return 0;
+      }
+
+      bool flag()
+      {
+        uint64_t value = uint();
+        if (value > 1)
+          failed = true;
+        return value == 1;
+      }
+
+      rune_t rune()
+      {
+        uint64_t value = uint();
+        if (value > std::numeric_limits<rune_t>::max())
+          failed = true;
+        return static_cast<rune_t>(value);
+      }
+
+      // A number of items that follow, each taking at least a byte, so that
+      // a corrupt count can't cause a huge allocation.
+      size_t count()
+      {
+        uint64_t value = uint();
+        if (value > rest.size())
+        {
+          failed = true;
+          return 0;
+        }
+        return static_cast<size_t>(value);
+      }
+
+      std::string string()
+      {
+        size_t size = count();
+        std::string value(rest.substr(0, size));
+        rest.remove_prefix(size);
+        return value;
+      }
+    };
+
+    // A link as stored in a program: 0 for NoState, else the index plus 1.
+    static uint64_t link_ref(uint32_t link)
+    {
+      return (link == NoState) ? 0 : uint64_t(link) + 1;
+    }
+
+    // The link a serialized reference refers to, among state_count states.
+    static uint32_t read_link(ProgramReader& in, size_t state_count)
+    {
+      uint64_t ref = in.uint();
+      if (ref > state_count)
+        in.failed = true;
+      if ((ref == 0) || in.failed)
+        return NoState;
+      return static_cast<uint32_t>(ref - 1);
+    }
+
+    // Unanchored simulation behind search(). A new thread is started from
+    // the start state at every position until a match is found. Threads are
+    // kept ordered by their start position, so when two threads reach the
+    // same state the one that started earlier wins. It has the same future
+    // as the later one, so nothing is lost: if the later one could still
+    // match, the earlier one matches too and is preferred. Among threads with
+    // the same start, the order is exactly that of find_prefix, so the
+    // captures agree with it.
+    template<bool Capturing>
+    SearchResult search_unanchored(
+      const std::string_view& utf8_str,
+      std::vector<Capture>& captures,
+      MatchContext& ctx,
+      size_t start_pos) const
+    {
+      ctx.reset_match_stats();
+      ctx.bind_engine(this, state_count_);
+
+      auto& current_threads = ctx.capturing_current_threads;
+      auto& next_threads = ctx.capturing_next_threads;
+      current_threads.clear();
+      next_threads.clear();
+
+      size_t cap_slots = 2 * num_captures_;
+      if constexpr (Capturing)
+        ctx.reset_capture_frames(cap_slots);
+
+      size_t epoch = 0;
+      auto begin_step = [&]() {
+        if (!Capturing && ctx.use_bitset_)
+          ctx.clear_visited_bitset();
+        else
+          ctx.advance_epoch(epoch);
+      };
+
+      auto add = [&](
+                   std::vector<Thread>& threads,
+                   uint32_t state,
+                   size_t caps_frame,
+                   size_t start,
+                   size_t pos,
+                   bool boundary,
+                   bool at_start,
+                   bool at_end) {
+        if constexpr (Capturing)
+          add_state_capturing(
+            threads,
+            state,
+            caps_frame,
+            start,
+            pos,
+            epoch,
+            ctx,
+            boundary,
+            at_start,
+            at_end);
+        else
+          add_search_state(
+            threads, state, start, epoch, ctx, boundary, at_start, at_end);
+      };
+
+      size_t pos = start_pos;
+      rune_t rune = 0;
+      size_t rune_bytes = 0;
+      bool has_rune = false;
+      bool prev_is_word = false;
+      bool next_is_word = false;
+
+      auto decode_at = [&](size_t at) {
+        has_rune = at < utf8_str.size();
+        if (has_rune)
+        {
+          auto [dr, dn] = decode_rune(utf8_str, at);
+          rune = dr;
+          rune_bytes = dn;
+        }
+        next_is_word = has_rune && is_word_char(rune);
+      };
+
+      // Word characters are ASCII, so the byte before start_pos is enough to
+      // classify the rune that precedes it.
+      if (pos > 0)
+        prev_is_word = is_word_char(
+          static_cast<rune_t>(static_cast<unsigned char>(utf8_str[pos - 1])));
+
+      decode_at(pos);
+      begin_step();
+
+      SearchResult result;
+      size_t best_caps_frame = npos;
+
+      while (true)
+      {
+        if (!result.found())
+        {
+          // With nothing in flight, skip positions that can't start a match.
+          // Closures that died in the last step may have marked epsilon
+          // states as visited, so a skip starts a fresh step.
+          if (current_threads.empty() && !first_char_info_.can_match_empty)
+          {
+            size_t skip_from = pos;
+            if (!literal_prefix_.empty())
+            {
+              // The prefix is ASCII, so wherever it is found is the start of
+              // a rune, and the byte before it classifies the previous rune.
+              size_t at = utf8_str.find(literal_prefix_, pos);
+              if (at == std::string_view::npos)
+                break;
+
+              if (at != pos)
+              {
+                pos = at;
+                prev_is_word = is_word_char(static_cast<rune_t>(
+                  static_cast<unsigned char>(utf8_str[pos - 1])));
+                decode_at(pos);
+              }
+            }
+            else
+            {
+              while (has_rune &&
+                     !first_char_info_.test(
+                       static_cast<uint8_t>(utf8_str[pos])))
+              {
+                pos += rune_bytes;
+                prev_is_word = next_is_word;
+                decode_at(pos);
+              }
+            }
+
+            if (pos != skip_from)
+              begin_step();
+          }
+
+          // Start a match attempt here, after every earlier attempt.
+          size_t init_caps_frame = npos;
+          if constexpr (Capturing)
+            init_caps_frame = ctx.allocate_capture_frame(npos);
+
+          if (!Capturing || (init_caps_frame != npos))
+            add(
+              current_threads,
+              index_of(start_state_),
+              init_caps_frame,
+              pos,
+              pos,
+              prev_is_word != next_is_word,
+              pos == 0,
+              !has_rune);
+        }
+
+        // Only one thread can be in the accept state. It has the earliest
+        // start of any match ending here, and attempts that started after it
+        // can no longer win.
+        for (size_t i = 0; i < current_threads.size(); i++)
+        {
+          auto& t = current_threads[i];
+          if (t.state != accept_state_)
+            continue;
+
+          result.match_start = t.start;
+          result.match_len = pos - t.start;
+          best_caps_frame = t.caps_frame;
+
+          size_t keep = i + 1;
+          while ((keep < current_threads.size()) &&
+                 (current_threads[keep].start <= t.start))
+            keep++;
+          current_threads.resize(keep);
+          break;
+        }
+
+        if (!has_rune || (result.found() && current_threads.empty()))
+          break;
+
+        ctx.record_active_states(current_threads.size());
+        rune_t rune_value = rune;
+        pos += rune_bytes;
+        prev_is_word = next_is_word;
+        decode_at(pos);
+
+        bool boundary = prev_is_word != next_is_word;
+        begin_step();
+        next_threads.clear();
+
+        for (auto& t : current_threads)
+        {
+          if (accepts(t.state, rune_value, ctx))
+            add(
+              next_threads,
+              t.state->next,
+              t.caps_frame,
+              t.start,
+              pos,
+              boundary,
+              false,
+              !has_rune);
+        }
+
+        std::swap(current_threads, next_threads);
+
+        if constexpr (Capturing)
+        {
+          // Keep the frame arena proportional to the live threads, rather
+          // than to the length of the input.
+          if (
+            ctx.capture_frames.size() >
+            cap_slots * 4 * (current_threads.size() + 64))
+            ctx.compact_capture_frames(current_threads, best_caps_frame);
+        }
+      }
+
+      if constexpr (Capturing)
+      {
+        if (result.found() && (best_caps_frame != npos))
+        {
+          const size_t* best_caps = ctx.capture_frame_data(best_caps_frame);
+          captures.resize(num_captures_);
+          for (size_t i = 0; i < num_captures_; i++)
+          {
+            captures[i].start = best_caps[i * 2];
+            captures[i].end = best_caps[i * 2 + 1];
+          }
+        }
+      }
+
+      return result;
+    }
+
+    // Whether the consuming state `state` accepts `rune`.
+    bool accepts(State state, rune_t rune, MatchContext& ctx) const
+    {
+      if (rune < 128)
+        return (ascii_bitmap(state)[rune >> 6] >> (rune & 63)) & 1;
+
+      if (is_class_ref(state->label))
+      {
+        ctx.stats_inc_class_ref_checks();
+        return rune_classes_[class_ref_index(state->label)].contains(rune);
+      }
+
+      ctx.stats_inc_literal_checks();
+      return state->label == rune;
+    }
+
     // Internal find_prefix variant that accepts initial prev_is_word context.
-    // Used by search() to maintain correct \b semantics across probe positions.
+    // The length of the match is found without captures first, so that the
+    // capture simulation only runs over the span that matched, and not at
+    // all when there is no match.
     size_t find_prefix_with_context(
       const std::string_view& utf8_str,
       std::vector<Capture>& captures,
       MatchContext& ctx,
       bool at_start,
       bool prev_is_word) const
+    {
+      captures.clear();
+      size_t len = find_prefix_noncapturing_with_context(
+        utf8_str, ctx, at_start, prev_is_word);
+      if ((len == npos) || (num_captures_ == 0))
+        return len;
+
+      if (!find_captures_with_context(
+            utf8_str, len, captures, ctx, at_start, prev_is_word))
+        return npos;
+
+      return len;
+    }
+
+    // Run the capture-tracking NFA over the first len bytes of utf8_str and
+    // fill captures from the highest priority thread that accepts at len.
+    // Runes after len are only looked at for anchors and \b. Returns false
+    // if no thread accepts there, or if the capture frames run out.
+    bool find_captures_with_context(
+      const std::string_view& utf8_str,
+      size_t len,
+      std::vector<Capture>& captures,
+      MatchContext& ctx,
+      bool at_start,
+      bool prev_is_word) const
     {
       ctx.reset_match_stats();
       ctx.bind_engine(this, state_count_);
       captures.clear();
-      if (!ok() || num_captures_ == 0)
-      {
-        // Non-capturing path with prev_is_word context.
-        return find_prefix_noncapturing_with_context(
-          utf8_str, ctx, at_start, prev_is_word);
-      }
 
       size_t cap_slots = 2 * num_captures_;
       auto& current_threads = ctx.capturing_current_threads;
@@ -889,39 +2112,29 @@ namespace trieste::regex
         next_is_word = is_word_char(current_rune);
       }
 
-      size_t init_caps_frame = ctx.allocate_capture_frame(npos);
-      if (init_caps_frame == npos)
-        return npos;
+      size_t init_caps_frame = npos;
+      if (cap_slots > 0)
+      {
+        init_caps_frame = ctx.allocate_capture_frame(npos);
+        if (init_caps_frame == npos)
+          return false;
+      }
       ctx.advance_epoch(epoch);
       add_state_capturing(
         current_threads,
-        start_state_,
+        index_of(start_state_),
         init_caps_frame,
         0,
+        0,
         epoch,
         ctx,
         prev_is_word != next_is_word,
         at_start,
         utf8_str.empty());
 
-      size_t best = npos;
-      size_t best_caps_frame = npos;
-      auto check_accept = [&](const std::vector<Thread>& threads, size_t pos) {
-        for (auto& t : threads)
-        {
-          if (t.state == accept_state_)
-          {
-            best = pos;
-            best_caps_frame = t.caps_frame;
-            return;
-          }
-        }
-      };
-
-      check_accept(current_threads, 0);
-
       size_t pos = 0;
-      while (has_current_rune && !current_threads.empty())
+      size_t no_frame = npos;
+      while ((pos < len) && has_current_rune && !current_threads.empty())
       {
         ctx.record_active_states(current_threads.size());
         rune_t rune_value = current_rune;
@@ -951,11 +2164,13 @@ namespace trieste::regex
           for (auto& t : current_threads)
           {
             if (
-              (t.state->ascii_accept[rune_value >> 6] >> (rune_value & 63)) & 1)
+              (ascii_bitmap(t.state)[rune_value >> 6] >> (rune_value & 63)) &
+              1)
               add_state_capturing(
                 next_threads,
                 t.state->next,
                 t.caps_frame,
+                0,
                 pos,
                 epoch,
                 ctx,
@@ -977,6 +2192,7 @@ namespace trieste::regex
                   next_threads,
                   t.state->next,
                   t.caps_frame,
+                  0,
                   pos,
                   epoch,
                   ctx,
@@ -991,6 +2207,7 @@ namespace trieste::regex
                 next_threads,
                 t.state->next,
                 t.caps_frame,
+                0,
                 pos,
                 epoch,
                 ctx,
@@ -1001,21 +2218,37 @@ namespace trieste::regex
           }
         }
         std::swap(current_threads, next_threads);
-        check_accept(current_threads, pos);
+
+        // Keep the frame arena proportional to the live threads, rather than
+        // to the length of the span.
+        if (
+          ctx.capture_frames.size() >
+          cap_slots * 4 * (current_threads.size() + 64))
+          ctx.compact_capture_frames(current_threads, no_frame);
       }
 
-      if (best != npos && best_caps_frame != npos)
+      if (pos != len)
+        return false;
+
+      for (auto& t : current_threads)
       {
-        const size_t* best_caps = ctx.capture_frame_data(best_caps_frame);
+        if (t.state != accept_state_)
+          continue;
+
+        if (t.caps_frame == npos)
+          return true;
+
+        const size_t* caps = ctx.capture_frame_data(t.caps_frame);
         captures.resize(num_captures_);
         for (size_t i = 0; i < num_captures_; i++)
         {
-          captures[i].start = best_caps[i * 2];
-          captures[i].end = best_caps[i * 2 + 1];
+          captures[i].start = caps[i * 2];
+          captures[i].end = caps[i * 2 + 1];
         }
+        return true;
       }
 
-      return best;
+      return false;
     }
 
     // Non-capturing find_prefix with prev_is_word context. Used by
@@ -1031,6 +2264,35 @@ namespace trieste::regex
       if (!ok())
         return npos;
 
+      if (is_literal_)
+      {
+        return (utf8_str.substr(0, literal_.size()) == literal_) ?
+          literal_.size() :
+          npos;
+      }
+
+      if (bit_words_ == 1)
+        return find_prefix_bits<1>(utf8_str, ctx);
+      if (bit_words_ == 2)
+        return find_prefix_bits<2>(utf8_str, ctx);
+
+      // Without anchors or \b the NFA step only depends on the rune, so the
+      // state sets can be cached as a DFA. A short first match doesn't build
+      // one, so that one-off matches with a fresh context stay cheap.
+      if (!has_conditionals_)
+      {
+        auto& dfa = ctx.dfa_for(id_, 1);
+        if (
+          !dfa.failed &&
+          ((dfa.calls++ > 0) || (utf8_str.size() >= DfaWarmupBytes)))
+        {
+          const RegexEngine* self = this;
+          auto result = dfa_find_prefix(&self, dfa, utf8_str, ctx);
+          if (!result.failed)
+            return (result.rule == 0) ? result.len : npos;
+        }
+      }
+
       auto& current_states = ctx.noncapturing_current_states;
       auto& next_states = ctx.noncapturing_next_states;
       current_states.clear();
@@ -1057,7 +2319,7 @@ namespace trieste::regex
       bool at_end = has_conditionals_ && utf8_str.empty();
       start_list(
         current_states,
-        start_state_,
+        index_of(start_state_),
         epoch,
         ctx,
         boundary,
@@ -1110,27 +2372,545 @@ namespace trieste::regex
       return best;
     }
 
+    // find_prefix_noncapturing_with_context for small patterns without
+    // conditionals, on the bit-parallel NFA. The active states are `Words`
+    // machine words. A step masks them with the states that accept the byte
+    // and ORs together the follow sets of the states that remain.
+    template<size_t Words>
+    size_t
+    find_prefix_bits(const std::string_view& utf8_str, MatchContext& ctx) const
+    {
+      uint64_t active[Words];
+      uint64_t moved[Words];
+      for (size_t w = 0; w < Words; w++)
+        active[w] = bit_start_[w];
+
+      const size_t accept_word = bit_accept_ >> 6;
+      const uint64_t accept_bit = uint64_t(1) << (bit_accept_ & 63);
+      size_t best = (active[accept_word] & accept_bit) ? 0 : npos;
+      size_t pos = 0;
+
+      while (pos < utf8_str.size())
+      {
+        auto byte = static_cast<unsigned char>(utf8_str[pos]);
+        if (is_ascii(byte))
+        {
+          const uint64_t* row = &bit_ascii_[byte * Words];
+          for (size_t w = 0; w < Words; w++)
+            moved[w] = active[w] & row[w];
+          pos++;
+        }
+        else
+        {
+          auto [rune, len] = decode_rune(utf8_str, pos);
+          for (size_t w = 0; w < Words; w++)
+          {
+            moved[w] = 0;
+            for (uint64_t bits = active[w]; bits != 0; bits &= bits - 1)
+            {
+              size_t i = (w << 6) | lowest_bit(bits);
+              if ((i != bit_accept_) && accepts(bit_states_[i], rune, ctx))
+                moved[w] |= uint64_t(1) << (i & 63);
+            }
+          }
+          pos += len;
+        }
+
+        uint64_t any = 0;
+        size_t count = 0;
+        size_t last = 0;
+        for (size_t w = 0; w < Words; w++)
+          active[w] = 0;
+
+        for (size_t w = 0; w < Words; w++)
+        {
+          for (uint64_t bits = moved[w]; bits != 0; bits &= bits - 1)
+          {
+            last = (w << 6) | lowest_bit(bits);
+            const uint64_t* follow = &bit_follow_[last * Words];
+            for (size_t v = 0; v < Words; v++)
+              active[v] |= follow[v];
+            count++;
+          }
+        }
+
+        ctx.record_active_states(count);
+        for (size_t w = 0; w < Words; w++)
+          any |= active[w];
+
+        // The active states are exactly the follow set of `last`, which
+        // they stay in for every byte of its run.
+        if ((count == 1) && (bit_run_[last] != NoRun))
+          pos = bit_runs_[bit_run_[last]].scan(utf8_str, pos);
+
+        if (active[accept_word] & accept_bit)
+          best = pos;
+
+        if (any == 0)
+          break;
+      }
+
+      return best;
+    }
+
+    // Inputs at least this long build a DFA on the first call.
+    static constexpr size_t DfaWarmupBytes = 256;
+
+    // match_batch for patterns without conditionals, on the lazy DFA of the
+    // engine, which the first text warms up for the rest.
+    size_t match_batch_dfa(
+      const std::string_view* texts,
+      size_t count,
+      bool* matched,
+      LazyDfa& dfa,
+      MatchContext& ctx) const
+    {
+      const RegexEngine* self = this;
+      size_t matches = 0;
+      for (size_t i = 0; i < count; i++)
+      {
+        // Unlike dfa_find_prefix, only the state at the end matters, and
+        // the dead state ends the scan. Once the DFA fails, the rest are
+        // matched on their own.
+        auto& text = texts[i];
+        uint32_t d = dfa.start;
+        size_t pos = 0;
+        while ((pos < text.size()) && (d != LazyDfa::Dead) && !dfa.failed)
+        {
+          auto byte = static_cast<unsigned char>(text[pos]);
+          uint32_t next;
+          if (is_ascii(byte))
+          {
+            size_t resets = dfa.resets;
+            next = dfa.transitions[(size_t(d) << 7) | byte];
+            if (next == LazyDfa::Unknown)
+              next = dfa_step(&self, dfa, d, byte, ctx);
+            pos++;
+
+            if ((next == d) && (dfa.resets == resets))
+              pos = dfa_skip_run(&self, dfa, d, text, pos, ctx);
+          }
+          else
+          {
+            auto [rune, len] = decode_rune(text, pos);
+            next = dfa_step(&self, dfa, d, rune, ctx);
+            pos += len;
+          }
+
+          if (next == LazyDfa::Unknown)
+            break;
+          d = next;
+        }
+
+        if (dfa.failed)
+          matched[i] = match(text, ctx);
+        else
+          matched[i] = (pos == text.size()) && (dfa.info[d].accept_rule == 0);
+        matches += matched[i];
+      }
+      return matches;
+    }
+
+    // Run the lazy DFA of `engines` over a prefix of utf8_str. Rules are
+    // tried in order, as if each engine's find_prefix were called in turn
+    // until one matched: the first rule with a matching prefix wins, with
+    // its longest match. Engines that are null never match. None of the
+    // engines may have conditionals. The scan stops once no rule before the
+    // current winner is still live.
+    static DfaMatch dfa_find_prefix(
+      const RegexEngine* const* engines,
+      LazyDfa& dfa,
+      const std::string_view& utf8_str,
+      MatchContext& ctx)
+    {
+      DfaMatch result;
+
+      if (dfa.sets.empty())
+      {
+        dfa_reset(engines, dfa, ctx);
+        if (dfa.failed)
+        {
+          result.failed = true;
+          return result;
+        }
+      }
+
+      uint32_t d = dfa.start;
+      size_t pos = 0;
+
+      // Rules from `limit` on can no longer win. The dead state has no live
+      // rule, so it is always past the limit.
+      uint32_t limit = LazyDfa::NoRule;
+
+      while (true)
+      {
+        auto info = dfa.info[d];
+        if (info.accept_rule < result.rule)
+        {
+          result.rule = info.accept_rule;
+          limit = info.accept_rule + 1;
+        }
+
+        // Whether the winner matches again is often unpredictable, so this
+        // is kept free of branches.
+        result.len = (info.accept_rule == result.rule) ? pos : result.len;
+
+        if ((info.live_rule >= limit) || (pos >= utf8_str.size()))
+          break;
+
+        ctx.record_active_states(dfa.sets[d]->size());
+        auto byte = static_cast<unsigned char>(utf8_str[pos]);
+        uint32_t next;
+
+        if (is_ascii(byte))
+        {
+          size_t resets = dfa.resets;
+          next = dfa.transitions[(size_t(d) << 7) | byte];
+          if (next == LazyDfa::Unknown)
+            next = dfa_step(engines, dfa, d, byte, ctx);
+          pos++;
+
+          // The state loops on this byte, so it may loop on a run of them.
+          if ((next == d) && (dfa.resets == resets))
+            pos = dfa_skip_run(engines, dfa, d, utf8_str, pos, ctx);
+        }
+        else
+        {
+          auto [rune, len] = decode_rune(utf8_str, pos);
+          next = dfa_step(engines, dfa, d, rune, ctx);
+          pos += len;
+        }
+
+        if (next == LazyDfa::Unknown)
+        {
+          result.failed = true;
+          return result;
+        }
+
+        d = next;
+      }
+
+      return result;
+    }
+
+    // Follow `rune` from DFA state `d` through the NFAs. ASCII transitions
+    // are cached unless interning the target reset the cache. Returns
+    // Unknown if the DFA has failed.
+    static uint32_t dfa_step(
+      const RegexEngine* const* engines,
+      LazyDfa& dfa,
+      uint32_t d,
+      rune_t rune,
+      MatchContext& ctx)
+    {
+      auto& next_set = ctx.dfa_scratch_;
+      dfa_follow(engines, dfa, d, rune, next_set, ctx);
+
+      size_t resets = dfa.resets;
+      uint32_t next = dfa_intern(engines, dfa, next_set, ctx);
+
+      if (is_ascii(rune) && (dfa.resets == resets) && !dfa.failed)
+        dfa.transitions[(size_t(d) << 7) | rune] = next;
+
+      return next;
+    }
+
+    // The NFA states that DFA state `d` moves to on `rune`, unsorted.
+    static void dfa_follow(
+      const RegexEngine* const* engines,
+      const LazyDfa& dfa,
+      uint32_t d,
+      rune_t rune,
+      std::vector<LazyDfa::Element>& next_set,
+      MatchContext& ctx)
+    {
+      next_set.clear();
+      for (auto e : *dfa.sets[d])
+      {
+        auto rule = static_cast<uint32_t>(e >> 32);
+        auto engine = engines[rule];
+        auto& state = engine->owned_states_[static_cast<uint32_t>(e)];
+        if (engine->accepts(&state, rune, ctx))
+          engine->dfa_add_closure(next_set, rule, state.next);
+      }
+    }
+
+    // Skip the run of bytes from pos on that DFA state `d` loops on. The
+    // first time the state loops, every ASCII byte without a cached
+    // transition is stepped through the NFAs to find the bytes that lead
+    // back to the same set. The targets are not interned, so this can't
+    // reset the cache.
+    static size_t dfa_skip_run(
+      const RegexEngine* const* engines,
+      LazyDfa& dfa,
+      uint32_t d,
+      const std::string_view& utf8_str,
+      size_t pos,
+      MatchContext& ctx)
+    {
+      uint32_t run = dfa.info[d].run;
+      if (run == LazyDfa::UncheckedRun)
+      {
+        auto& next_set = ctx.dfa_scratch_;
+        uint64_t bits[2] = {0, 0};
+        for (rune_t byte = 0; byte < 128; byte++)
+        {
+          auto& next = dfa.transitions[(size_t(d) << 7) | byte];
+          if (next == LazyDfa::Unknown)
+          {
+            dfa_follow(engines, dfa, d, byte, next_set, ctx);
+            std::sort(next_set.begin(), next_set.end());
+            next_set.erase(
+              std::unique(next_set.begin(), next_set.end()), next_set.end());
+            if (next_set == *dfa.sets[d])
+              next = d;
+          }
+
+          if (next == d)
+            bits[byte >> 6] |= uint64_t(1) << (byte & 63);
+        }
+
+        run = NoRun;
+        if ((bits[0] | bits[1]) != 0)
+        {
+          run = static_cast<uint32_t>(dfa.runs.size());
+          dfa.runs.emplace_back(bits);
+        }
+        dfa.info[d].run = run;
+      }
+
+      return (run == NoRun) ? pos : dfa.runs[run].scan(utf8_str, pos);
+    }
+
+    void dfa_add_closure(
+      std::vector<LazyDfa::Element>& set, uint32_t rule, uint32_t state) const
+    {
+      auto tag = LazyDfa::Element(rule) << 32;
+      for (auto terminal : epsilon_closure_cached(state, false, false, false))
+        set.push_back(tag | terminal);
+    }
+
+    // Find or add the DFA state for a set of NFA states. When the cache is
+    // full it is reset first, and after MaxDfaResets resets the DFA is
+    // marked as failed and Unknown is returned. If the context as a whole is
+    // full, the DFAs of the other engines are dropped as well.
+    static uint32_t dfa_intern(
+      const RegexEngine* const* engines,
+      LazyDfa& dfa,
+      std::vector<LazyDfa::Element>& set,
+      MatchContext& ctx)
+    {
+      std::sort(set.begin(), set.end());
+      set.erase(std::unique(set.begin(), set.end()), set.end());
+      auto it = dfa.index.find(set);
+      if (it != dfa.index.end())
+        return it->second;
+
+      if (
+        (dfa.sets.size() >= MaxDfaStates) ||
+        (ctx.dfa_states_total_ >= MaxDfaStatesPerContext))
+      {
+        if (++dfa.resets > MaxDfaResets)
+        {
+          dfa.failed = true;
+          ctx.clear_dfa(dfa);
+          return LazyDfa::Unknown;
+        }
+
+        if (ctx.dfa_states_total_ >= MaxDfaStatesPerContext)
+          ctx.clear_dfas();
+
+        // The reset reuses the scratch set, so keep a copy.
+        std::vector<LazyDfa::Element> keep = set;
+        dfa_reset(engines, dfa, ctx);
+        if (dfa.failed)
+          return LazyDfa::Unknown;
+        return dfa_intern(engines, dfa, keep, ctx);
+      }
+
+      uint32_t accept_rule = LazyDfa::NoRule;
+      for (auto e : set)
+      {
+        auto rule = static_cast<uint32_t>(e >> 32);
+        auto engine = engines[rule];
+        if (
+          &engine->owned_states_[static_cast<uint32_t>(e)] ==
+          engine->accept_state_)
+        {
+          accept_rule = rule;
+          break;
+        }
+      }
+
+      auto id = static_cast<uint32_t>(dfa.sets.size());
+      auto [entry, inserted] = dfa.index.emplace(set, id);
+      assert(inserted);
+      (void)inserted;
+      dfa.sets.push_back(&entry->first);
+      dfa.info.push_back(
+        {accept_rule,
+         set.empty() ? LazyDfa::NoRule : static_cast<uint32_t>(set[0] >> 32),
+         LazyDfa::UncheckedRun});
+      dfa.transitions.resize(dfa.transitions.size() + 128, LazyDfa::Unknown);
+      ctx.dfa_states_total_++;
+      return id;
+    }
+
+    // Empty the cache, leaving only the dead and start states.
+    static void dfa_reset(
+      const RegexEngine* const* engines, LazyDfa& dfa, MatchContext& ctx)
+    {
+      ctx.clear_dfa(dfa);
+
+      auto& set = ctx.dfa_scratch_;
+      set.clear();
+      dfa_intern(engines, dfa, set, ctx);
+      if (dfa.failed)
+        return;
+
+      set.clear();
+      for (uint32_t rule = 0; rule < dfa.rules; rule++)
+      {
+        if (engines[rule] != nullptr)
+        {
+          engines[rule]->dfa_add_closure(
+            set, rule, engines[rule]->index_of(engines[rule]->start_state_));
+        }
+      }
+      dfa.start = dfa_intern(engines, dfa, set, ctx);
+    }
+
+    // The lazy DFA behind RegexSet::find_prefix.
+    static DfaMatch find_prefix_set(
+      const RegexEngine* const* engines,
+      size_t count,
+      uint64_t id,
+      const std::string_view& utf8_str,
+      MatchContext& ctx)
+    {
+      ctx.reset_match_stats();
+      auto& dfa = ctx.dfa_for(id, count);
+      if (dfa.failed)
+      {
+        DfaMatch result;
+        result.failed = true;
+        return result;
+      }
+
+      return dfa_find_prefix(engines, dfa, utf8_str, ctx);
+    }
+
+    static uint64_t next_engine_id()
+    {
+      static std::atomic<uint64_t> next{1};
+      return next.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // An NFA state. `next` and `next_alt` are indices in owned_states_,
+    // or NoState. `ascii_class` is the offset in ascii_classes_ of the two
+    // words of bytes the state accepts, which states with the same bitmap
+    // share.
     struct StateDef
     {
-      rune_t label;
-      StateDef* next;
-      StateDef* next_alt;
-      size_t closure_index;
-      uint64_t ascii_accept[2] = {};
-      bool trivial_closure = false;
-    };
+      rune_t label;
+      uint32_t next;
+      uint32_t next_alt;
+      uint32_t ascii_class;
+    };
+
+    static_assert(sizeof(StateDef) == 16);
+
+    uint32_t index_of(State state) const
+    {
+      return static_cast<uint32_t>(state - owned_states_.data());
+    }
+
+    State state_at(uint32_t index) const
+    {
+      assert(index < owned_states_.size());
+      return owned_states_.data() + index;
+    }
+
+    // The state a link refers to, or nullptr for NoState.
+    State target(uint32_t link) const
+    {
+      return (link == NoState) ? nullptr : state_at(link);
+    }
+
+    uint32_t link_to(State state) const
+    {
+      return (state == nullptr) ? NoState : index_of(state);
+    }
+
+    // The ASCII bytes that `state` accepts, as two words.
+    const uint64_t* ascii_bitmap(State state) const
+    {
+      return &ascii_classes_[state->ascii_class];
+    }
+
+    State create_state(
+      const rune_t& label, State next = nullptr, State next_alt = nullptr)
+    {
+      if (owned_states_.size() >= owned_states_.capacity())
+      {
+        set_error(ErrorCode::ErrorInternalError);
+        return accept_state_;
+      }
+      owned_states_.push_back(
+        StateDef{label, link_to(next), link_to(next_alt), 0});
+      return &owned_states_.back();
+    }
+
+    // The number of states that Thompson's construction makes from postfix:
+    // one for the accept state, none for a catenation, two for a capture
+    // group, and one for any other token.
+    static size_t nfa_state_count(const std::vector<rune_t>& postfix)
+    {
+      size_t count = 1;
+      for (auto label : postfix)
+      {
+        if (label == Catenation)
+          continue;
+        if (label >= CaptureGroup && label < CaptureGroup + MaxCaptures)
+          count += 2;
+        else
+          count++;
+      }
+      return count;
+    }
+
+    // Release any storage reserved for states that Thompson's construction
+    // didn't need. Links are indices, so only the start and accept states
+    // have to be found again. If construction failed, links may still hold
+    // dangling lists, so only the accept state is kept.
+    void trim_states()
+    {
+      if (!ok())
+      {
+        owned_states_.resize(1);
+        owned_states_[0].next = NoState;
+        owned_states_[0].next_alt = NoState;
+        start_state_ = accept_state_;
+      }
+
+      uint32_t start = index_of(start_state_);
+      uint32_t accept = index_of(accept_state_);
+      owned_states_.shrink_to_fit();
+      start_state_ = state_at(start);
+      accept_state_ = state_at(accept);
+    }
+
+    // A link of a state under construction, as twice the index of the
+    // state, plus one for next_alt.
+    uint32_t slot_of(State state, bool alt) const
+    {
+      return (index_of(state) << 1) | (alt ? 1 : 0);
+    }
 
-    State create_state(
-      const rune_t& label, State next = nullptr, State next_alt = nullptr)
+    uint32_t& link_at(uint32_t slot)
     {
-      if (owned_states_.size() >= owned_states_.capacity())
-      {
-        set_error(ErrorCode::ErrorInternalError);
-        return accept_state_;
-      }
-      size_t idx = owned_states_.size();
-      owned_states_.push_back(StateDef{label, next, next_alt, idx});
-      return &owned_states_.back();
+      auto& def = owned_states_[slot >> 1];
+      return (slot & 1) ? def.next_alt : def.next;
     }
 
     // Iteratively follow epsilon states, recording capture positions.
@@ -1138,8 +2918,9 @@ namespace trieste::regex
     // and recursive function-call overhead.
     void add_state_capturing(
       std::vector<Thread>& threads,
-      State state,
+      uint32_t state,
       size_t caps_frame,
+      size_t start,
       size_t pos,
       size_t epoch,
       MatchContext& ctx,
@@ -1153,12 +2934,13 @@ namespace trieste::regex
 
       while (!stack.empty())
       {
-        auto [s, frame] = stack.back();
+        auto [index, frame] = stack.back();
         stack.pop_back();
 
-        if (s == nullptr || ctx.is_visited(s->closure_index, epoch))
+        if (index == NoState || ctx.is_visited(index, epoch))
           continue;
-        ctx.mark_visited(s->closure_index, epoch);
+        ctx.mark_visited(index, epoch);
+        State s = state_at(index);
 
         if (s->label == Split)
         {
@@ -1210,7 +2992,7 @@ namespace trieste::regex
           continue;
         }
 
-        threads.push_back({s, frame});
+        threads.push_back({s, frame, start});
       }
     }
 
@@ -1237,10 +3019,12 @@ namespace trieste::regex
     // than allocating fresh vectors.
     struct ClosureBuilder
     {
-      std::vector<State> closure;
-      std::vector<State> stack;
+      std::vector<uint32_t> closure;
+      std::vector<uint32_t> stack;
       std::vector<size_t> seen_epoch;
       size_t traversal_epoch = 0;
+      // The flags that the last closure depended on.
+      uint8_t consulted = 0;
     };
 
     void precompute_epsilon_closures()
@@ -1256,42 +3040,75 @@ namespace trieste::regex
       ClosureBuilder builder;
       builder.seen_epoch.resize(state_count, 0);
 
+      // Matching only enters the NFA at the start state and at the next
+      // state of a consuming state, so only those closures are looked up.
+      // The others are left empty: a long alternation is a chain of splits,
+      // and their closures would be quadratic in the number of branches.
+      std::vector<uint8_t> entry(state_count, 0);
+      entry[index_of(start_state_)] = 1;
+      for (auto& state : owned_states_)
+      {
+        if (!is_epsilon(state.label) && (state.next != NoState))
+          entry[state.next] = 1;
+      }
+
       // Compute closures, record offsets, and fill the flat buffer
       // in a single pass.
       closure_cache_offsets_.resize(slot_count + 1);
       closure_cache_flat_.reserve(slot_count);
       size_t total_entries = 0;
 
-      for (auto& state : owned_states_)
+      // Closures of the same state under flags that agree on every flag an
+      // earlier closure consulted are the same, and are copied rather than
+      // computed again. Most closures reach no anchor or word boundary.
+      uint8_t consulted[ClosureFlagCombinations];
+      for (uint32_t index = 0; index < state_count; index++)
       {
-        bool trivial = true;
         for (uint8_t flags = 0; flags < num_flag_combos; flags++)
         {
-          const size_t slot = (state.closure_index * num_flag_combos) | flags;
-          closure_cache_offsets_[slot] =
+          const size_t slot = (index * num_flag_combos) | flags;
+          const uint32_t begin =
             static_cast<uint32_t>(closure_cache_flat_.size());
-          compute_epsilon_closure(
-            &state,
-            (flags & 1) != 0,
-            (flags & 2) != 0,
-            (flags & 4) != 0,
-            builder);
-          closure_cache_flat_.insert(
-            closure_cache_flat_.end(),
-            builder.closure.begin(),
-            builder.closure.end());
-          total_entries += builder.closure.size();
+          closure_cache_offsets_[slot] = begin;
+          if (!entry[index])
+            continue;
+
+          uint8_t same = 0;
+          while ((same < flags) && (((same ^ flags) & consulted[same]) != 0))
+            same++;
+
+          if (same < flags)
+          {
+            consulted[flags] = consulted[same];
+            const size_t from = closure_cache_offsets_[slot - flags + same];
+            const size_t to = closure_cache_offsets_[slot - flags + same + 1];
+            for (size_t i = from; i < to; i++)
+            {
+              uint32_t state = closure_cache_flat_[i];
+              closure_cache_flat_.push_back(state);
+            }
+          }
+          else
+          {
+            compute_epsilon_closure(
+              index,
+              (flags & FlagBoundary) != 0,
+              (flags & FlagAtStart) != 0,
+              (flags & FlagAtEnd) != 0,
+              builder);
+            consulted[flags] = builder.consulted;
+            closure_cache_flat_.insert(
+              closure_cache_flat_.end(),
+              builder.closure.begin(),
+              builder.closure.end());
+          }
+          total_entries += closure_cache_flat_.size() - begin;
           if (total_entries > MaxClosureCacheEntries)
           {
             set_error(ErrorCode::ErrorPatternTooLarge);
             return;
           }
-          if (
-            trivial &&
-            (builder.closure.size() != 1 || builder.closure[0] != &state))
-            trivial = false;
         }
-        state.trivial_closure = trivial;
       }
       closure_cache_offsets_[slot_count] =
         static_cast<uint32_t>(closure_cache_flat_.size());
@@ -1315,45 +3132,295 @@ namespace trieste::regex
       }
     }
 
-    // Finalize NFA states: populate per-state ASCII acceptance bitmaps
-    // and release construction-only temporaries. States already live in
-    // contiguous storage (owned_states_ is a pre-reserved vector<StateDef>),
-    // so no copy or pointer remapping is needed.
+    // A pattern is literal if its NFA is a single chain of ASCII runes. Only
+    // ASCII is allowed so that comparing bytes agrees with decoding the input,
+    // which tolerates malformed UTF-8.
+    void detect_literal()
+    {
+      is_literal_ = false;
+      literal_.clear();
+      if (!ok())
+        return;
+
+      for (State s = start_state_; s != accept_state_; s = target(s->next))
+      {
+        if ((s == nullptr) || (s->label >= 128) || (s->next_alt != NoState))
+        {
+          literal_.clear();
+          return;
+        }
+
+        literal_.push_back(static_cast<char>(s->label));
+      }
+
+      is_literal_ = true;
+    }
+
+    // Capture states only record a position, so literals run through them.
+    State skip_captures(State s) const
+    {
+      while ((s != nullptr) &&
+             (is_capture_open(s->label) || is_capture_close(s->label)))
+        s = target(s->next);
+      return s;
+    }
+
+    // The ASCII string consumed by the chain of states starting at s.
+    std::string literal_from(State s) const
+    {
+      std::string result;
+      for (s = skip_captures(s); (s != nullptr) && (s->label < 128);
+           s = skip_captures(target(s->next)))
+        result.push_back(static_cast<char>(s->label));
+      return result;
+    }
+
+    // The prefix is the chain of ASCII states at the start of the NFA. An
+    // ASCII state that every path from the start to the accept state passes
+    // through is required, and so is the chain that follows it. Checking
+    // each state costs a walk of the NFA, so large patterns only look for
+    // a prefix.
+    void detect_required_literals()
+    {
+      literal_prefix_.clear();
+      required_literal_.clear();
+      if (!ok() || is_literal_)
+        return;
+
+      literal_prefix_ = literal_from(start_state_);
+      required_literal_ = literal_prefix_;
+
+      if (owned_states_.size() > MaxRequiredLiteralStates)
+        return;
+
+      std::vector<uint8_t> seen;
+      std::vector<uint32_t> stack;
+
+      for (auto& state : owned_states_)
+      {
+        if (state.label >= 128)
+          continue;
+
+        seen.assign(owned_states_.size(), 0);
+        seen[index_of(&state)] = 1;
+        stack.assign(1, index_of(start_state_));
+        bool required = true;
+
+        while (!stack.empty())
+        {
+          uint32_t s = stack.back();
+          stack.pop_back();
+          if ((s == NoState) || seen[s])
+            continue;
+
+          if (state_at(s) == accept_state_)
+          {
+            required = false;
+            break;
+          }
+
+          seen[s] = 1;
+          stack.push_back(state_at(s)->next);
+          stack.push_back(state_at(s)->next_alt);
+        }
+
+        if (!required)
+          continue;
+
+        auto literal = literal_from(&state);
+        if (literal.size() > required_literal_.size())
+          required_literal_ = std::move(literal);
+      }
+    }
+
+    // Number the states that epsilon closures lead to, which are the
+    // consuming states and the accept state, as bits of one or two words,
+    // and precompute the masks that find_prefix_bits steps with. Patterns
+    // with conditionals or more states keep bit_words_ at 0.
+    void build_bit_nfa()
+    {
+      bit_words_ = 0;
+      if (!ok() || has_conditionals_)
+        return;
+
+      constexpr uint32_t NoBit = static_cast<uint32_t>(-1);
+      std::vector<uint32_t> bit_of(owned_states_.size(), NoBit);
+      std::vector<State> states;
+
+      auto number = [&](uint32_t state) {
+        for (auto s : epsilon_closure_cached(state, false, false, false))
+        {
+          if (bit_of[s] == NoBit)
+          {
+            bit_of[s] = static_cast<uint32_t>(states.size());
+            states.push_back(state_at(s));
+          }
+        }
+      };
+
+      // Numbering stops as soon as there are too many states.
+      number(index_of(start_state_));
+      for (size_t i = 0; i < states.size(); i++)
+      {
+        if (states.size() > 64 * MaxBitNfaWords)
+          return;
+        if (states[i] != accept_state_)
+          number(states[i]->next);
+      }
+
+      if (states.size() > 64 * MaxBitNfaWords)
+        return;
+
+      size_t words = (states.size() + 63) >> 6;
+      auto set_closure = [&](uint64_t* row, uint32_t state) {
+        for (auto s : epsilon_closure_cached(state, false, false, false))
+        {
+          uint32_t bit = bit_of[s];
+          row[bit >> 6] |= uint64_t(1) << (bit & 63);
+        }
+      };
+
+      bit_start_.assign(words, 0);
+      set_closure(bit_start_.data(), index_of(start_state_));
+
+      bit_ascii_.assign(128 * words, 0);
+      bit_follow_.assign(states.size() * words, 0);
+      bit_run_.assign(states.size(), NoRun);
+      bit_runs_.clear();
+      for (size_t i = 0; i < states.size(); i++)
+      {
+        auto s = states[i];
+        if (s == accept_state_)
+        {
+          bit_accept_ = i;
+          continue;
+        }
+
+        for (size_t w = 0; w < 2; w++)
+        {
+          for (uint64_t m = ascii_bitmap(s)[w]; m != 0; m &= m - 1)
+          {
+            size_t b = (w << 6) + lowest_bit(m);
+            bit_ascii_[b * words + (i >> 6)] |= uint64_t(1) << (i & 63);
+          }
+        }
+
+        set_closure(&bit_follow_[i * words], s->next);
+      }
+
+      // A state whose follow set includes itself stays in that set on the
+      // bytes that no other state of the set accepts, so find_prefix_bits
+      // can skip a run of them.
+      for (size_t i = 0; i < states.size(); i++)
+      {
+        const uint64_t* follow = &bit_follow_[i * words];
+        bool loops = (follow[i >> 6] >> (i & 63)) & 1;
+        if ((states[i] == accept_state_) || !loops)
+          continue;
+
+        const uint64_t* own = ascii_bitmap(states[i]);
+        uint64_t run[2] = {own[0], own[1]};
+        for (size_t j = 0; j < states.size(); j++)
+        {
+          if ((j != i) && ((follow[j >> 6] >> (j & 63)) & 1))
+          {
+            const uint64_t* other = ascii_bitmap(states[j]);
+            run[0] &= ~other[0];
+            run[1] &= ~other[1];
+          }
+        }
+
+        if ((run[0] | run[1]) != 0)
+        {
+          bit_run_[i] = static_cast<uint32_t>(bit_runs_.size());
+          bit_runs_.emplace_back(run);
+        }
+      }
+
+      // The accept state is always reachable in a well-formed NFA, but
+      // without it there is nothing to report.
+      if (bit_of[index_of(accept_state_)] == NoBit)
+        return;
+
+      bit_states_ = std::move(states);
+      bit_words_ = words;
+    }
+
+    // Finalize NFA states: point each state at the bitmap of ASCII bytes
+    // it accepts. Bitmaps are shared, so a pattern has one per distinct
+    // class or ASCII literal, after the empty bitmap of epsilon states.
     void finalize_states()
     {
+      ascii_classes_.assign(2, 0);
       if (!ok())
         return;
 
+      for (auto& rc : rune_classes_)
+        rc.build_table();
+
       state_count_ = owned_states_.size();
       if (state_count_ == 0)
         return;
 
-      // Populate per-state ASCII acceptance bitmaps.
+      // Most states are single runes or share a class, so rows are looked up
+      // once per rune and per class rather than once per state.
+      std::map<std::pair<uint64_t, uint64_t>, uint32_t> offsets;
+      auto row_of = [&](uint64_t lo, uint64_t hi) -> uint32_t {
+        if ((lo | hi) == 0)
+          return 0;
+        auto [it, inserted] = offsets.emplace(
+          std::make_pair(lo, hi), static_cast<uint32_t>(ascii_classes_.size()));
+        if (inserted)
+        {
+          ascii_classes_.push_back(lo);
+          ascii_classes_.push_back(hi);
+        }
+        return it->second;
+      };
+
+      std::vector<uint32_t> rune_rows(128, 0);
+      std::vector<uint32_t> class_rows(rune_classes_.size(), 0);
       for (auto& s : owned_states_)
       {
+        s.ascii_class = 0;
         if (is_class_ref(s.label))
         {
           auto& rc = rune_classes_[class_ref_index(s.label)];
-          s.ascii_accept[0] = rc.ascii_bitmap[0];
-          s.ascii_accept[1] = rc.ascii_bitmap[1];
+          auto& row = class_rows[class_ref_index(s.label)];
+          if (row == 0)
+            row = row_of(rc.ascii_bitmap[0], rc.ascii_bitmap[1]);
+          s.ascii_class = row;
         }
         else if (s.label < 128)
         {
-          s.ascii_accept[s.label >> 6] |= uint64_t(1) << (s.label & 63);
+          auto& row = rune_rows[s.label];
+          if (row == 0)
+          {
+            uint64_t bit = uint64_t(1) << (s.label & 63);
+            row = (s.label < 64) ? row_of(bit, 0) : row_of(0, bit);
+          }
+          s.ascii_class = row;
         }
       }
     }
 
     void compute_epsilon_closure(
-      State state,
+      uint32_t state,
       bool boundary_match,
       bool at_start,
       bool at_end,
       ClosureBuilder& builder)
     {
       builder.closure.clear();
-      if (state == nullptr)
+      builder.consulted = 0;
+      if (state == NoState)
+        return;
+
+      if (!is_epsilon(state_at(state)->label))
+      {
+        builder.closure.push_back(state);
         return;
+      }
 
       builder.stack.clear();
       builder.stack.push_back(state);
@@ -1368,15 +3435,15 @@ namespace trieste::regex
 
       while (!builder.stack.empty())
       {
-        auto s = builder.stack.back();
+        auto index = builder.stack.back();
         builder.stack.pop_back();
-        if (s == nullptr)
+        if (index == NoState)
           continue;
 
-        size_t seen_idx = s->closure_index;
-        if (builder.seen_epoch[seen_idx] == current_epoch)
+        if (builder.seen_epoch[index] == current_epoch)
           continue;
-        builder.seen_epoch[seen_idx] = current_epoch;
+        builder.seen_epoch[index] = current_epoch;
+        State s = state_at(index);
 
         if (s->label == Split)
         {
@@ -1393,6 +3460,7 @@ namespace trieste::regex
 
         if (s->label == WordBoundary)
         {
+          builder.consulted |= FlagBoundary;
           if (boundary_match)
             builder.stack.push_back(s->next);
           continue;
@@ -1400,6 +3468,7 @@ namespace trieste::regex
 
         if (s->label == StartAnchor)
         {
+          builder.consulted |= FlagAtStart;
           if (at_start)
             builder.stack.push_back(s->next);
           continue;
@@ -1407,44 +3476,49 @@ namespace trieste::regex
 
         if (s->label == EndAnchor)
         {
+          builder.consulted |= FlagAtEnd;
           if (at_end)
             builder.stack.push_back(s->next);
           continue;
         }
 
-        builder.closure.push_back(s);
+        builder.closure.push_back(index);
       }
     }
 
+    // The indices of the consuming states and the accept state that a
+    // state's epsilon closure reaches.
     struct ClosureSpan
     {
-      const State* data;
+      const uint32_t* data;
       uint32_t size;
-      const State* begin() const
+      const uint32_t* begin() const
       {
         return data;
       }
-      const State* end() const
+      const uint32_t* end() const
       {
         return data + size;
       }
     };
 
+    // The closure of an entry state: the start state, or the next state of a
+    // consuming state. Other states have an empty closure in the cache.
     ClosureSpan epsilon_closure_cached(
-      State state, bool boundary_match, bool at_start, bool at_end) const
+      uint32_t state, bool boundary_match, bool at_start, bool at_end) const
     {
-      if (state == nullptr)
+      if (state == NoState)
         return {nullptr, 0};
 
       size_t slot;
       if (has_conditionals_)
       {
-        slot = (state->closure_index * ClosureFlagCombinations) |
+        slot = (size_t(state) * ClosureFlagCombinations) |
           closure_flags(boundary_match, at_start, at_end);
       }
       else
       {
-        slot = state->closure_index;
+        slot = state;
       }
       assert(slot + 1 < closure_cache_offsets_.size());
       uint32_t begin = closure_cache_offsets_[slot];
@@ -1456,27 +3530,42 @@ namespace trieste::regex
     // literal runes so that escaped operators like \* are not confused
     // with the ZeroOrMore operator).
 
+    // A fragment of the NFA under construction. Its dangling links, which
+    // are still to be patched, form a list threaded through the links
+    // themselves: each holds the slot (see slot_of) of the next, and the
+    // last holds NoState. Building a fragment doesn't allocate.
     struct Frag
     {
-      State start;
-      // Raw pointers to the `next` or `next_alt` member of States owned
-      // by Frag objects on the stack. These must be patched (via patch())
-      // before the owning State is moved or destroyed.
-      std::vector<State*> dangling;
+      State start = nullptr;
+      uint32_t first = NoState;
+      uint32_t last = NoState;
     };
 
-    static inline std::vector<State*>&
-    append(std::vector<State*>& lhs, std::vector<State*>& rhs)
+    Frag dangling(State start, uint32_t slot) const
+    {
+      return {start, slot, slot};
+    }
+
+    // Appends the dangling links of rhs to those of lhs.
+    void append(Frag& lhs, const Frag& rhs)
     {
-      lhs.insert(lhs.end(), rhs.begin(), rhs.end());
-      return lhs;
+      if (rhs.first == NoState)
+        return;
+      if (lhs.first == NoState)
+        lhs.first = rhs.first;
+      else
+        link_at(lhs.last) = rhs.first;
+      lhs.last = rhs.last;
     }
 
-    static inline void patch(std::vector<State*>& targets, State target)
+    void patch(const Frag& frag, State target)
     {
-      for (auto& entry : targets)
+      uint32_t to = link_to(target);
+      for (uint32_t slot = frag.first; slot != NoState;)
       {
-        *entry = target;
+        uint32_t& link = link_at(slot);
+        slot = link;
+        link = to;
       }
     }
 
@@ -1678,7 +3767,25 @@ namespace trieste::regex
 
       // -- Rune class management --
 
-      rune_t make_class_ref(const RuneClass& rc)
+      // Categories recur across the patterns of a grammar, so the table of
+      // each category and of its complement is built once per process.
+      static std::shared_ptr<const RuneTable> category_table(
+        const unicode::range_t* category, bool negate, const RuneClass& rc)
+      {
+        static std::mutex mutex;
+        static std::map<
+          std::pair<const unicode::range_t*, bool>,
+          std::shared_ptr<const RuneTable>>
+          tables;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto [it, inserted] = tables.try_emplace({category, negate});
+        if (inserted)
+          it->second = rc.make_table();
+        return it->second;
+      }
+
+      rune_t make_class_ref(RuneClass rc)
       {
         size_t idx = rune_classes.size();
         if (idx > (RuneClassMax - RuneClassBase))
@@ -1686,7 +3793,7 @@ namespace trieste::regex
           set_error(ErrorCode::ErrorPatternTooLarge);
           return RuneClassBase;
         }
-        rune_classes.push_back(rc);
+        rune_classes.push_back(std::move(rc));
         return RuneClassBase + static_cast<rune_t>(idx);
       }
 
@@ -1727,11 +3834,25 @@ namespace trieste::regex
       // Parse \p{Xx} or \P{Xx} Unicode General Category escape.
       rune_t parse_unicode_category(
         const std::string_view& pattern, size_t& pos, bool negate)
+      {
+        RuneClass rc;
+        if (!parse_unicode_category(pattern, pos, negate, rc))
+          return RuneClassBase;
+        return make_class_ref(std::move(rc));
+      }
+
+      // As above, into rc rather than a class of its own, for a category
+      // inside a bracket expression.
+      bool parse_unicode_category(
+        const std::string_view& pattern,
+        size_t& pos,
+        bool negate,
+        RuneClass& rc)
       {
         if (pos >= pattern.size() || pattern[pos] != '{')
         {
           set_error(ErrorCode::ErrorBadCharClass);
-          return RuneClassBase;
+          return false;
         }
         pos++; // skip '{'
 
@@ -1742,7 +3863,7 @@ namespace trieste::regex
         if (pos >= pattern.size())
         {
           set_error(ErrorCode::ErrorBadCharClass);
-          return RuneClassBase;
+          return false;
         }
 
         std::string_view cat_name(
@@ -1752,24 +3873,24 @@ namespace trieste::regex
         if (cat_name.empty() || cat_name.size() > 3)
         {
           set_error(ErrorCode::ErrorBadCharClass);
-          return RuneClassBase;
+          return false;
         }
 
         auto info = unicode::find_category(cat_name);
         if (info.ranges == nullptr)
         {
           set_error(ErrorCode::ErrorBadCharClass);
-          return RuneClassBase;
+          return false;
         }
 
-        RuneClass rc;
         rc.ranges.assign(info.ranges, info.ranges + info.count);
         rc.ascii_bitmap[0] = info.ascii_bitmap.words[0];
         rc.ascii_bitmap[1] = info.ascii_bitmap.words[1];
         rc.finalize();
         if (negate)
           rc = rc.complement();
-        return make_class_ref(rc);
+        rc.table = category_table(info.ranges, negate, rc);
+        return true;
       }
 
       // Parse a POSIX character class like [:alpha:] inside a bracket
@@ -1923,11 +4044,10 @@ namespace trieste::regex
             {
               // \p{...}/\P{...} inside class — merge.
               bool neg = (esc_rune.value == 'P');
-              auto ref = parse_unicode_category(pattern, pos, neg);
-              if (!ok())
+              RuneClass category;
+              if (!parse_unicode_category(pattern, pos, neg, category))
                 return RuneClassBase;
-              // Extract the class and merge it.
-              rc.merge(rune_classes[class_ref_index(ref)]);
+              rc.merge(category);
               continue;
             }
 
@@ -2047,7 +4167,7 @@ namespace trieste::regex
         if (negated)
           rc = rc.complement();
 
-        return make_class_ref(rc);
+        return make_class_ref(std::move(rc));
       }
 
       // -- Predicates for non-trivial conditions --
@@ -2201,7 +4321,7 @@ namespace trieste::regex
             }
             if (rune_value != lower)
               rc = rc.complement();
-            auto ref = make_class_ref(rc);
+            auto ref = make_class_ref(std::move(rc));
             emit_atom(ref);
             return true;
           }
@@ -2795,9 +4915,7 @@ namespace trieste::regex
 
       // Greedy: next=match, next_alt=skip
       // Lazy:   next=skip,  next_alt=match
-      auto unpatched_branch = [&]() -> State* {
-        return lazy ? &state->next : &state->next_alt;
-      };
+      auto unpatched_branch = [&]() { return slot_of(state, !lazy); };
 
       switch (kind)
       {
@@ -2806,8 +4924,9 @@ namespace trieste::regex
             state = create_state(Split, nullptr, operand.start);
           else
             state = create_state(Split, operand.start);
-          operand.dangling.push_back(unpatched_branch());
-          stack.push_back({state, operand.dangling});
+          append(operand, dangling(state, unpatched_branch()));
+          operand.start = state;
+          stack.push_back(operand);
           break;
 
         case QuantifierKind::QZeroOrMore:
@@ -2815,8 +4934,8 @@ namespace trieste::regex
             state = create_state(Split, nullptr, operand.start);
           else
             state = create_state(Split, operand.start);
-          patch(operand.dangling, state);
-          stack.push_back({state, {unpatched_branch()}});
+          patch(operand, state);
+          stack.push_back(dangling(state, unpatched_branch()));
           break;
 
         case QuantifierKind::QOneOrMore:
@@ -2824,8 +4943,8 @@ namespace trieste::regex
             state = create_state(Split, nullptr, operand.start);
           else
             state = create_state(Split, operand.start);
-          patch(operand.dangling, state);
-          stack.push_back({operand.start, {unpatched_branch()}});
+          patch(operand, state);
+          stack.push_back(dangling(operand.start, unpatched_branch()));
           break;
       }
     }
@@ -2864,8 +4983,9 @@ namespace trieste::regex
             stack.pop_back();
             left = stack.back();
             stack.pop_back();
-            patch(left.dangling, right.start);
-            stack.push_back({left.start, right.dangling});
+            patch(left, right.start);
+            right.start = left.start;
+            stack.push_back(right);
             break;
 
           case Alternation:
@@ -2879,7 +4999,9 @@ namespace trieste::regex
             left = stack.back();
             stack.pop_back();
             state = create_state(Split, left.start, right.start);
-            stack.push_back({state, append(left.dangling, right.dangling)});
+            append(left, right);
+            left.start = state;
+            stack.push_back(left);
             break;
 
           case ZeroOrOne:
@@ -2921,14 +5043,14 @@ namespace trieste::regex
               size_t idx = static_cast<size_t>(label - CaptureGroup);
               auto close =
                 create_state(CaptureClose + static_cast<rune_t>(idx));
-              patch(operand.dangling, close);
+              patch(operand, close);
               auto open = create_state(
                 CaptureOpen + static_cast<rune_t>(idx), operand.start);
-              stack.push_back({open, {&close->next}});
+              stack.push_back(dangling(open, slot_of(close, false)));
               break;
             }
             state = create_state(label);
-            stack.push_back({state, {&state->next}});
+            stack.push_back(dangling(state, slot_of(state, false)));
             break;
         }
       }
@@ -2939,7 +5061,7 @@ namespace trieste::regex
         return accept_state_;
       }
 
-      patch(stack.back().dangling, accept_state_);
+      patch(stack.back(), accept_state_);
       return stack.back().start;
     }
 
@@ -2971,35 +5093,67 @@ namespace trieste::regex
 
     void add_state(
       std::vector<State>& states,
-      State state,
+      uint32_t state,
       size_t epoch,
       MatchContext& ctx,
       bool boundary_match = false,
       bool at_start = false,
       bool at_end = false) const
     {
-      if (state == nullptr)
+      if (state == NoState)
+        return;
+
+      // The base is hoisted as push_back could otherwise alias it.
+      State base = owned_states_.data();
+      if (!is_epsilon(base[state].label))
+      {
+        if (!already_visited(state, epoch, ctx))
+          states.push_back(base + state);
+        return;
+      }
+
+      auto closure =
+        epsilon_closure_cached(state, boundary_match, at_start, at_end);
+      for (auto terminal : closure)
+      {
+        if (!already_visited(terminal, epoch, ctx))
+          states.push_back(base + terminal);
+      }
+    }
+
+    // As add_state, for threads of an unanchored search.
+    void add_search_state(
+      std::vector<Thread>& threads,
+      uint32_t state,
+      size_t start,
+      size_t epoch,
+      MatchContext& ctx,
+      bool boundary_match,
+      bool at_start,
+      bool at_end) const
+    {
+      if (state == NoState)
         return;
 
-      if (state->trivial_closure)
+      if (!is_epsilon(state_at(state)->label))
       {
-        if (!already_visited(state->closure_index, epoch, ctx))
-          states.push_back(state);
+        if (!already_visited(state, epoch, ctx))
+          threads.push_back({state_at(state), npos, start});
         return;
       }
 
       auto closure =
         epsilon_closure_cached(state, boundary_match, at_start, at_end);
-      for (auto& terminal : closure)
+      for (auto terminal : closure)
       {
-        if (!already_visited(terminal->closure_index, epoch, ctx))
-          states.push_back(terminal);
+        if (!already_visited(terminal, epoch, ctx))
+          threads.push_back({state_at(terminal), npos, start});
       }
     }
 
     void start_list(
       std::vector<State>& states,
-      State state,
+      uint32_t state,
       size_t& epoch,
       MatchContext& ctx,
       bool boundary_match = false,
@@ -3014,7 +5168,9 @@ namespace trieste::regex
       add_state(states, state, epoch, ctx, boundary_match, at_start, at_end);
     }
 
-    void step(
+    // Inlined into its one caller; left to the inliner it isn't, as the
+    // index links make add_state larger.
+    TRIESTE_FAST_PATH void step(
       std::vector<State>& current_states,
       const rune_t& rune,
       std::vector<State>& next_states,
@@ -3030,9 +5186,11 @@ namespace trieste::regex
       next_states.clear();
       if (rune < 128)
       {
+        const uint64_t* classes = ascii_classes_.data() + (rune >> 6);
+        uint64_t bit = uint64_t(1) << (rune & 63);
         for (auto& state : current_states)
         {
-          if ((state->ascii_accept[rune >> 6] >> (rune & 63)) & 1)
+          if (classes[state->ascii_class] & bit)
             add_state(
               next_states,
               state->next,
@@ -3081,15 +5239,31 @@ namespace trieste::regex
     ErrorCode error_code_; // Error code if pattern failed to parse.
     std::string error_arg_; // Fragment of pattern that caused the error.
     bool has_conditionals_ = false; // True if NFA has anchors or \b.
+    bool is_literal_ = false; // True if the NFA only matches literal_.
+    std::string literal_; // The string matched by a literal pattern.
+    std::string literal_prefix_; // ASCII prefix of every match.
+    std::string required_literal_; // ASCII string in every match.
+    // Bit-parallel NFA; bit_words_ is 0 when it isn't used.
+    size_t bit_words_ = 0;
+    size_t bit_accept_ = 0; // Bit of the accept state.
+    std::vector<State> bit_states_; // State of each bit.
+    std::vector<uint64_t> bit_start_; // Closure of the start state.
+    std::vector<uint64_t> bit_ascii_; // States accepting each ASCII byte.
+    std::vector<uint64_t> bit_follow_; // Closure after each state's next.
+    std::vector<uint32_t> bit_run_; // Index in bit_runs_ of each state's run.
+    std::vector<AsciiRun> bit_runs_; // Bytes a state alone loops on.
     size_t num_captures_; // Number of capturing groups.
     size_t state_count_ = 0; // Total states in owned_states_.
     SyntaxMode syntax_mode_ = SyntaxMode::Extended;
+    uint64_t pattern_hash_ = 0; // hash_pattern() of the source pattern.
     std::vector<StateDef>
       owned_states_; // Pre-reserved contiguous state storage.
     std::vector<RuneClass> rune_classes_; // Indexed by class-ref label offset.
-    std::vector<State> closure_cache_flat_;
+    std::vector<uint64_t> ascii_classes_ = {0, 0}; // Shared ASCII bitmaps.
+    std::vector<uint32_t> closure_cache_flat_; // State indices.
     std::vector<uint32_t> closure_cache_offsets_;
     FirstCharInfo first_char_info_;
+    uint64_t id_ = next_engine_id(); // Distinguishes engines in lazy DFAs.
 
     FirstCharInfo compute_first_char_info() const
     {
@@ -3110,12 +5284,12 @@ namespace trieste::regex
         bool at_start = has_conditionals_ ? ((combo & FlagAtStart) != 0) : true;
         bool at_end = has_conditionals_ && (combo & FlagAtEnd);
 
-        auto closure =
-          epsilon_closure_cached(start_state_, boundary, at_start, at_end);
+        auto closure = epsilon_closure_cached(
+          index_of(start_state_), boundary, at_start, at_end);
 
         for (auto it = closure.begin(); it != closure.end(); ++it)
         {
-          auto s = *it;
+          auto s = state_at(*it);
 
           // Accept state: marks empty-matchable, but skip its label
           // (0xAFFFFF) to avoid poisoning can_match_nonascii.
@@ -3126,8 +5300,8 @@ namespace trieste::regex
           }
 
           // OR the ASCII acceptance bitmap.
-          info.bitmap[0] |= s->ascii_accept[0];
-          info.bitmap[1] |= s->ascii_accept[1];
+          info.bitmap[0] |= ascii_bitmap(s)[0];
+          info.bitmap[1] |= ascii_bitmap(s)[1];
 
           // Check for non-ASCII acceptance.
           if (is_class_ref(s->label))
@@ -3153,4 +5327,218 @@ namespace trieste::regex
     }
   };
 
+  // An ordered list of engines matched together, in one scan of the input,
+  // on a lazy DFA built from all of their NFAs. The engines must outlive the
+  // set. Engines with anchors or \b, and malformed engines, are left out:
+  // they never match here and have to be tried on their own.
+  class RegexSet
+  {
+  public:
+    struct Match
+    {
+      size_t index = RegexEngine::npos;
+      size_t len = 0;
+
+      bool found() const
+      {
+        return index != RegexEngine::npos;
+      }
+    };
+
+    RegexSet() = default;
+
+    explicit RegexSet(const std::vector<const RegexEngine*>& engines)
+    : id_(RegexEngine::next_engine_id())
+    {
+      for (auto engine : engines)
+      {
+        bool include =
+          (engine != nullptr) && engine->ok() && !engine->has_conditionals_;
+        engines_.push_back(include ? engine : nullptr);
+      }
+    }
+
+    size_t size() const
+    {
+      return engines_.size();
+    }
+
+    bool includes(size_t i) const
+    {
+      return engines_[i] != nullptr;
+    }
+
+    bool includes_all() const
+    {
+      return std::find(engines_.begin(), engines_.end(), nullptr) ==
+        engines_.end();
+    }
+
+    // The first included engine with a match for a prefix of utf8_str, and
+    // the length of its longest match, as if find_prefix were called on each
+    // in turn. Returns nullopt if the DFA had to give up because its cache
+    // thrashed, in which case the engines should be tried one at a time.
+    std::optional<Match> find_prefix(
+      const std::string_view& utf8_str, RegexEngine::MatchContext& ctx) const
+    {
+      auto result = RegexEngine::find_prefix_set(
+        engines_.data(), engines_.size(), id_, utf8_str, ctx);
+      if (result.failed)
+        return std::nullopt;
+
+      Match match;
+      if (result.rule != RegexEngine::LazyDfa::NoRule)
+      {
+        match.index = result.rule;
+        match.len = result.len;
+      }
+      return match;
+    }
+
+  private:
+    uint64_t id_ = 0;
+    std::vector<const RegexEngine*> engines_;
+  };
+
+  // Process-wide cache of compiled engines, keyed by pattern and syntax
+  // mode. Engines are immutable once built, so one engine can be shared by
+  // every user of the same pattern, on any thread. The cache is off until it
+  // is given a capacity, and then keeps the most recently used engines whose
+  // memory_usage() fits in it. Evicted engines live on as long as they are
+  // in use.
+  class RegexCache
+  {
+  public:
+    struct Stats
+    {
+      size_t hits = 0;
+      size_t misses = 0;
+      size_t evictions = 0;
+      size_t entries = 0;
+      size_t bytes = 0;
+    };
+
+    // The cache TRegex compiles its patterns through.
+    static RegexCache& global()
+    {
+      static RegexCache cache;
+      return cache;
+    }
+
+    // Budget in bytes for cached engines. 0 turns the cache off and empties
+    // it.
+    void set_capacity(size_t bytes)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      capacity_.store(bytes, std::memory_order_relaxed);
+      evict();
+    }
+
+    size_t capacity() const
+    {
+      return capacity_.load(std::memory_order_relaxed);
+    }
+
+    // The engine for pattern in mode. On a miss it is compiled outside the
+    // lock, so patterns compile in parallel; if two threads race on the same
+    // pattern, the first engine cached is the one both get. With the cache
+    // off every call compiles a new engine, without building a key or taking
+    // the lock.
+    std::shared_ptr<const RegexEngine> get(
+      std::string_view pattern,
+      RegexEngine::SyntaxMode mode = RegexEngine::SyntaxMode::Extended)
+    {
+      if (capacity_.load(std::memory_order_relaxed) == 0)
+        return std::make_shared<const RegexEngine>(pattern, mode);
+
+      std::string key = make_key(pattern, mode);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(key);
+        if (it != index_.end())
+        {
+          stats_.hits++;
+          lru_.splice(lru_.begin(), lru_, it->second);
+          return it->second->engine;
+        }
+        stats_.misses++;
+      }
+
+      auto engine = std::make_shared<const RegexEngine>(pattern, mode);
+      size_t bytes = engine->memory_usage() + key.capacity();
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = index_.find(key);
+      if (it != index_.end())
+      {
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return it->second->engine;
+      }
+
+      // The cache may have been turned off while this engine compiled.
+      if (bytes > capacity_.load(std::memory_order_relaxed))
+        return engine;
+
+      lru_.push_front({key, engine, bytes});
+      index_.emplace(std::move(key), lru_.begin());
+      stats_.entries++;
+      stats_.bytes += bytes;
+      evict();
+      return engine;
+    }
+
+    Stats stats() const
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return stats_;
+    }
+
+    // Drop every cached engine, and reset the counters.
+    void clear()
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      lru_.clear();
+      index_.clear();
+      stats_ = {};
+    }
+
+  private:
+    struct Entry
+    {
+      std::string key;
+      std::shared_ptr<const RegexEngine> engine;
+      size_t bytes;
+    };
+
+    mutable std::mutex mutex_;
+    // Written under the lock, but read without it so that get() doesn't
+    // serialize compilation while the cache is off.
+    std::atomic<size_t> capacity_{0};
+    std::list<Entry> lru_; // Most recently used first.
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    Stats stats_;
+
+    static std::string
+    make_key(std::string_view pattern, RegexEngine::SyntaxMode mode)
+    {
+      std::string key;
+      key.reserve(pattern.size() + 1);
+      key += static_cast<char>(mode);
+      key += pattern;
+      return key;
+    }
+
+    void evict()
+    {
+      while (stats_.bytes > capacity_.load(std::memory_order_relaxed))
+      {
+        auto& entry = lru_.back();
+        stats_.bytes -= entry.bytes;
+        stats_.entries--;
+        stats_.evictions++;
+        index_.erase(entry.key);
+        lru_.pop_back();
+      }
+    }
+  };
 }
@@ -11,7 +11,9 @@
 #include <array>
 #include <cassert>
 #include <functional>
+#include <string>
 #include <trieste/compiler.h>
+#include <utility>
 
 namespace trieste
 {
@@ -23,6 +25,12 @@ namespace trieste
     size_t index{0};
     std::vector<std::pair<bool, std::map<Token, NodeRange>>> captures{16};
 
+    // Dirty-region tracking for dir::incremental. While a parent is watched,
+    // the leaf matchers record one past the furthest child of that parent
+    // that any match attempt has examined.
+    const NodeDef* watched{nullptr};
+    size_t horizon_{0};
+
   public:
     Match() {}
     Match(const Match&) = delete;
@@ -109,6 +117,27 @@ namespace trieste
       index = 0;
       captures[0].first = false;
     }
+
+    void watch(const NodeDef* parent, size_t pos = 0)
+    {
+      watched = parent;
+      horizon_ = pos;
+    }
+
+    size_t horizon() const
+    {
+      return horizon_;
+    }
+
+    TRIESTE_FAST_PATH void examine(const NodeIt& it, const Node& parent)
+    {
+      if (TRIESTE_UNLIKELY(parent.get() == watched))
+      {
+        size_t pos = static_cast<size_t>(it - parent->begin()) + 1;
+        if (pos > horizon_)
+          horizon_ = pos;
+      }
+    }
   };
 
   namespace detail
@@ -299,10 +328,17 @@ namespace trieste
     class PatternDef;
     using PatternPtr = intrusive_ptr<PatternDef>;
 
-    class PatternDef : public intrusive_refcounted<PatternDef>
+    class PatternDef : public intrusive_refcounted<PatternDef, ast_refcount>
     {
       PatternPtr continuation{};
 
+      // Set by clone_step() until the copy constructor of the step runs.
+      static bool& cloning_step()
+      {
+        thread_local bool flag = false;
+        return flag;
+      }
+
     public:
       virtual ~PatternDef() = default;
 
@@ -324,7 +360,11 @@ namespace trieste
 
       PatternDef(const PatternDef& copy)
       {
-        if (copy.continuation)
+        // Only the outermost copy made by clone_step() skips the
+        // continuation; sub-patterns it copies keep theirs.
+        bool step_only = std::exchange(cloning_step(), false);
+
+        if (copy.continuation && !step_only)
         {
           continuation = copy.continuation->clone();
         }
@@ -375,6 +415,70 @@ namespace trieste
         if (continuation)
           continuation->reify(parent);
       }
+
+      // Appends a key for this step, ignoring the continuation, such that two
+      // steps with the same key match the same nodes in the same way. Returns
+      // false if the step cannot be keyed, for example because it runs user
+      // code. Used to share common prefixes between the rules of a pass.
+      virtual bool step_key(std::string&) const
+      {
+        return false;
+      }
+
+      // Appends a key for this step and its continuation.
+      bool chain_key(std::string& out) const
+      {
+        out += '(';
+
+        for (auto p = this; p; p = p->continuation.get())
+        {
+          if (!p->step_key(out))
+            return false;
+        }
+
+        out += ')';
+        return true;
+      }
+
+      const PatternPtr& next() const
+      {
+        return continuation;
+      }
+
+      // A copy of this step without its continuation. Unlike clone(), this
+      // does not copy the rest of the chain, so copying every step of a
+      // chain is linear in its length.
+      PatternPtr clone_step() const
+      {
+        cloning_step() = true;
+        PatternPtr step;
+
+        try
+        {
+          step = clone();
+        }
+        catch (...)
+        {
+          cloning_step() = false;
+          throw;
+        }
+
+        cloning_step() = false;
+        return step;
+      }
+
+      // If this step is a Children pattern, returns its parent and children
+      // patterns.
+      virtual bool split_children(PatternPtr&, PatternPtr&) const
+      {
+        return false;
+      }
+
+      static void token_key(std::string& out, const Token& type)
+      {
+        out += std::to_string(type.default_map_hash());
+        out += ',';
+      }
     };
 
     class Cap : public PatternDef
@@ -398,6 +502,13 @@ namespace trieste
         return intrusive_ptr<Cap>::make(*this);
       }
 
+      bool step_key(std::string& out) const override
+      {
+        out += 'C';
+        token_key(out, name);
+        return pattern->chain_key(out);
+      }
+
       bool match(NodeIt& it, const Node& parent, Match& match) const& override
       {
         auto begin = it;
@@ -434,8 +545,16 @@ namespace trieste
         return intrusive_ptr<Anything>::make(*this);
       }
 
+      bool step_key(std::string& out) const override
+      {
+        out += '.';
+        return true;
+      }
+
       bool match(NodeIt& it, const Node& parent, Match& match) const& override
       {
+        match.examine(it, parent);
+
         if (it == parent->end())
           return false;
 
@@ -465,8 +584,18 @@ namespace trieste
         return intrusive_ptr<TokenMatch>::make(*this);
       }
 
+      bool step_key(std::string& out) const override
+      {
+        out += 'T';
+        for (const auto& t : types)
+          token_key(out, t);
+        return true;
+      }
+
       bool match(NodeIt& it, const Node& parent, Match& match) const& override
       {
+        match.examine(it, parent);
+
         if (it == parent->end())
           return false;
 
@@ -518,8 +647,21 @@ namespace trieste
         return intrusive_ptr<RegexMatch>::make(*this);
       }
 
+      bool step_key(std::string& out) const override
+      {
+        const auto& re = regex->pattern();
+        out += 'R';
+        token_key(out, type);
+        out += std::to_string(re.size());
+        out += ':';
+        out += re;
+        return true;
+      }
+
       bool match(NodeIt& it, const Node& parent, Match& match) const& override
       {
+        match.examine(it, parent);
+
         if ((it == parent->end()) || ((*it)->type() != type))
           return false;
 
@@ -559,6 +701,12 @@ namespace trieste
         return intrusive_ptr<Opt>::make(*this);
       }
 
+      bool step_key(std::string& out) const override
+      {
+        out += '?';
+        return pattern->chain_key(out);
+      }
+
       bool match(NodeIt& it, const Node& parent, Match& match) const& override
       {
         auto backtrack_it = it;
@@ -610,6 +758,12 @@ namespace trieste
         return {};
       }
 
+      bool step_key(std::string& out) const override
+      {
+        out += '*';
+        return pattern->chain_key(out);
+      }
+
       bool match(NodeIt& it, const Node& parent, Match& match) const& override
       {
         NodeIt curr = it;
@@ -654,8 +808,16 @@ namespace trieste
         return intrusive_ptr<Not>::make(*this);
       }
 
+      bool step_key(std::string& out) const override
+      {
+        out += '!';
+        return pattern->chain_key(out);
+      }
+
       bool match(NodeIt& it, const Node& parent, Match& match) const& override
       {
+        match.examine(it, parent);
+
         if (it == parent->end())
           return false;
 
@@ -705,6 +867,12 @@ namespace trieste
         return intrusive_ptr<Choice>::make(*this);
       }
 
+      bool step_key(std::string& out) const override
+      {
+        out += '|';
+        return first->chain_key(out) && second->chain_key(out);
+      }
+
       bool match(NodeIt& it, const Node& parent, Match& match) const& override
       {
         auto backtrack_it = it;
@@ -765,6 +933,14 @@ namespace trieste
           "Rep(InsideStar) not allowed! ((In(T,...)++)++");
       }
 
+      bool step_key(std::string& out) const override
+      {
+        out += 'S';
+        for (const auto& type : types)
+          token_key(out, type);
+        return true;
+      }
+
       bool match(NodeIt& it, const Node& parent, Match& match) const& override
       {
         NodeDef* p = &*parent;
@@ -814,6 +990,14 @@ namespace trieste
         return {};
       }
 
+      bool step_key(std::string& out) const override
+      {
+        out += 'I';
+        for (const auto& type : types)
+          token_key(out, type);
+        return true;
+      }
+
       bool match(NodeIt& it, const Node& parent, Match& match) const& override
       {
         for (const auto& type : types)
@@ -851,6 +1035,12 @@ namespace trieste
         throw std::runtime_error("Rep(First) not allowed! (Start)++");
       }
 
+      bool step_key(std::string& out) const override
+      {
+        out += '^';
+        return true;
+      }
+
       bool match(NodeIt& it, const Node& parent, Match& match) const& override
       {
         return (it == parent->begin()) && match_continuation(it, parent, match);
@@ -883,8 +1073,15 @@ namespace trieste
         throw std::runtime_error("Continuation not allowed after `End`");
       }
 
-      bool match(NodeIt& it, const Node& parent, Match&) const& override
+      bool step_key(std::string& out) const override
       {
+        out += '$';
+        return true;
+      }
+
+      bool match(NodeIt& it, const Node& parent, Match& match) const& override
+      {
+        match.examine(it, parent);
         return it == parent->end();
       }
 
@@ -916,6 +1113,20 @@ namespace trieste
         return intrusive_ptr<Children>::make(*this);
       }
 
+      bool step_key(std::string& out) const override
+      {
+        out += '<';
+        return pattern->chain_key(out) && children->chain_key(out);
+      }
+
+      bool split_children(PatternPtr& pattern_, PatternPtr& children_)
+        const override
+      {
+        pattern_ = pattern;
+        children_ = children;
+        return true;
+      }
+
       bool match(NodeIt& it, const Node& parent, Match& match) const& override
       {
         auto begin = it;
@@ -971,6 +1182,12 @@ namespace trieste
         throw std::runtime_error("Rep(Pred) not allowed! (++Pattern)++");
       }
 
+      bool step_key(std::string& out) const override
+      {
+        out += '&';
+        return pattern->chain_key(out);
+      }
+
       bool match(NodeIt& it, const Node& parent, Match& match) const& override
       {
         auto begin = it;
@@ -1012,6 +1229,12 @@ namespace trieste
         throw std::runtime_error("Rep(NegPred) not allowed! (--Pattern)++");
       }
 
+      bool step_key(std::string& out) const override
+      {
+        out += '-';
+        return pattern->chain_key(out);
+      }
+
       bool match(NodeIt& it, const Node& parent, Match& match) const& override
       {
         auto begin = it;
@@ -1094,6 +1317,11 @@ namespace trieste
         return pattern->match(it, parent, match);
       }
 
+      const PatternPtr& get_pattern() const
+      {
+        return pattern;
+      }
+
       Node reify() const
       {
         Node top = NodeDef::create(Top);
@@ -1386,7 +1614,7 @@ namespace trieste
 
   inline Node operator<<(Node node, Nodes range)
   {
-    node->push_back({range.begin(), range.end()});
+    node->push_back({range.data(), range.data() + range.size()});
     return node;
   }
 
@@ -12,6 +12,7 @@ namespace trieste
     const wf::Wellformed* wf_;
     bool debug_enabled_;
     bool wf_check_enabled_;
+    bool profile_enabled_;
     std::filesystem::path debug_path_;
 
   public:
@@ -24,6 +25,7 @@ namespace trieste
       wf_(&input_wf),
       debug_enabled_(false),
       wf_check_enabled_(true),
+      profile_enabled_(false),
       debug_path_(".")
     {}
 
@@ -41,6 +43,7 @@ namespace trieste
       summary << "---------" << std::endl;
       auto result = Process(pass_range)
                       .set_check_well_formed(wf_check_enabled_)
+                      .set_profile(profile_enabled_)
                       .set_default_pass_complete(summary, name_, debug_path)
                       .run(ast);
       summary << "---------" << std::endl;
@@ -69,6 +72,17 @@ namespace trieste
       return wf_check_enabled_;
     }
 
+    Rewriter& profile_enabled(bool value)
+    {
+      profile_enabled_ = value;
+      return *this;
+    }
+
+    bool profile_enabled() const
+    {
+      return profile_enabled_;
+    }
+
     Rewriter& debug_path(const std::filesystem::path& path)
     {
       debug_path_ = path;
@@ -0,0 +1,241 @@
+#pragma once
+
+#include "rewrite.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace trieste::detail
+{
+  /**
+   * The rules that can apply at one position, merged into a tree that shares
+   * the steps their patterns have in common.
+   *
+   * Each pattern is split into the steps of its top-level sequence, and
+   * `P << C` is split further into the steps of P, a step that enters the
+   * first node P matched, the steps of C, and a step that returns. A rule only
+   * shares steps with the rule added immediately before it, so a depth-first
+   * walk of the tree reaches the rules in the order they were added, and a
+   * prefix common to a run of adjacent rules is matched once per position.
+   *
+   * This relies on a step never backtracking into its continuation: once a
+   * step succeeds, it has committed to what it consumed, so matching a
+   * pattern is the same as matching each of its steps in turn.
+   */
+  class RuleTree
+  {
+  public:
+    enum class Kind : uint8_t
+    {
+      Root,
+      Match,
+      Mark,
+      Enter,
+      Exit,
+      Accept,
+    };
+
+    struct Step
+    {
+      Kind kind;
+      // Steps are shared only if their kinds and keys are equal. An empty key
+      // is never shared.
+      std::string key;
+      // The pattern to match, without its continuation, for a Match step.
+      PatternPtr pattern;
+    };
+
+    using Path = std::vector<Step>;
+
+  private:
+    struct TreeNode
+    {
+      Kind kind;
+      std::string key;
+      PatternPtr pattern;
+      // The position of the rule in the order it was added, for Accept.
+      size_t rule;
+      // In the order the rules were added.
+      std::vector<size_t> children;
+    };
+
+    // The position saved by a Mark or Enter step, kept on the stack of the
+    // walk until the matching Enter or Exit step.
+    struct Frame
+    {
+      NodeIt it;
+      const Node* parent;
+      const Frame* up;
+    };
+
+    std::vector<TreeNode> nodes;
+    size_t rules{0};
+
+    static void flatten(const PatternPtr& pattern, Path& path)
+    {
+      for (auto step = pattern.get(); step; step = step->next().get())
+      {
+        PatternPtr parent;
+        PatternPtr children;
+
+        if (step->split_children(parent, children))
+        {
+          path.push_back({Kind::Mark, "mark", {}});
+          flatten(parent, path);
+          path.push_back({Kind::Enter, "enter", {}});
+          flatten(children, path);
+          path.push_back({Kind::Exit, "exit", {}});
+        }
+        else
+        {
+          std::string key;
+          if (!step->step_key(key))
+            key.clear();
+          path.push_back({Kind::Match, std::move(key), step->clone_step()});
+        }
+      }
+    }
+
+    static bool same_step(const Step& step, const TreeNode& node)
+    {
+      return (step.kind == node.kind) && !step.key.empty() &&
+        (step.key == node.key);
+    }
+
+    template<typename Accept>
+    bool walk(
+      size_t index,
+      NodeIt it,
+      const Node* parent,
+      const Frame* frame,
+      Match& match,
+      Accept& accept) const
+    {
+      const auto& node = nodes[index];
+      Frame saved{};
+
+      switch (node.kind)
+      {
+        case Kind::Root:
+          break;
+
+        case Kind::Match:
+          if (!node.pattern->match(it, *parent, match))
+            return false;
+          break;
+
+        case Kind::Mark:
+          saved = {it, parent, frame};
+          frame = &saved;
+          break;
+
+        case Kind::Enter:
+        {
+          auto begin = frame->it;
+          saved = {it, parent, frame->up};
+          frame = &saved;
+          parent = begin;
+          it = (*begin)->begin();
+          break;
+        }
+
+        case Kind::Exit:
+          it = frame->it;
+          parent = frame->parent;
+          frame = frame->up;
+          break;
+
+        case Kind::Accept:
+          return accept(node.rule, it);
+      }
+
+      const auto& children = node.children;
+      size_t last = children.size() - 1;
+
+      for (size_t i = 0; i < last; i++)
+      {
+        // Captures made by a branch that fails are not seen by the next one.
+        auto backtrack_frame = match.add_frame();
+        if (walk(children[i], it, parent, frame, match, accept))
+          return true;
+        match.return_to_frame(backtrack_frame);
+      }
+
+      return walk(children[last], it, parent, frame, match, accept);
+    }
+
+  public:
+    RuleTree() : nodes{{Kind::Root, {}, {}, 0, {}}} {}
+
+    /**
+     * Split a pattern into the steps that can be added to a tree.
+     */
+    static Path flatten(const Pattern& pattern)
+    {
+      Path path;
+      flatten(pattern.get_pattern(), path);
+      return path;
+    }
+
+    /**
+     * Returns true if a rule with path `b`, added after one with path `a`,
+     * would share a step with it.
+     */
+    static bool shares_prefix(const Path& a, const Path& b)
+    {
+      return !a.empty() && !b.empty() && (a.front().kind == b.front().kind) &&
+        !b.front().key.empty() && (a.front().key == b.front().key);
+    }
+
+    /**
+     * Add the next rule. The accept callback passed to match() identifies it
+     * by the number of rules added before it.
+     */
+    void add(const Path& path)
+    {
+      size_t at = 0;
+
+      for (const auto& step : path)
+      {
+        const auto& children = nodes[at].children;
+
+        if (!children.empty() && same_step(step, nodes[children.back()]))
+        {
+          at = children.back();
+          continue;
+        }
+
+        nodes.push_back({step.kind, step.key, step.pattern, 0, {}});
+        nodes[at].children.push_back(nodes.size() - 1);
+        at = nodes.size() - 1;
+      }
+
+      nodes.push_back({Kind::Accept, {}, {}, rules++, {}});
+      nodes[at].children.push_back(nodes.size() - 1);
+    }
+
+    bool empty() const
+    {
+      return nodes.front().children.empty();
+    }
+
+    /**
+     * Match the rules in order at `start`. Each rule whose pattern matches is
+     * passed to `accept(rule, end)` with the end of the matched range, and
+     * matching stops when that returns true. Returns false if no rule was
+     * accepted.
+     */
+    template<typename Accept>
+    bool match(
+      const NodeIt& start, const Node& parent, Match& match, Accept&& accept)
+      const
+    {
+      if (empty())
+        return false;
+
+      match.reset();
+      return walk(0, start, &parent, nullptr, match, accept);
+    }
+  };
+}
@@ -6,10 +6,13 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
 #include <iterator>
+#include <limits>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -20,7 +23,7 @@ namespace trieste
 
   using Source = intrusive_ptr<SourceDef>;
 
-  class SourceDef final : public intrusive_refcounted<SourceDef>
+  class SourceDef final : public intrusive_refcounted<SourceDef, ast_refcount>
   {
   private:
     std::string origin_;
@@ -133,6 +136,10 @@ namespace trieste
     // case.
     void find_lines()
     {
+      // Locations store 32-bit positions.
+      if (contents.size() > std::numeric_limits<uint32_t>::max())
+        throw std::length_error("source is larger than 4 GiB: " + origin_);
+
       // Find the lines.
       auto pos = contents.find('\n');
 
@@ -147,18 +154,28 @@ namespace trieste
   struct Location
   {
     Source source;
-    size_t pos;
-    size_t len;
+    // Sources are limited to 4 GiB, which keeps nodes small.
+    uint32_t pos;
+    uint32_t len;
 
     Location() = default;
 
     Location(Source source_, size_t pos_, size_t len_)
-    : source(source_), pos(pos_), len(len_)
-    {}
+    : source(source_),
+      pos(static_cast<uint32_t>(pos_)),
+      len(static_cast<uint32_t>(len_))
+    {
+      assert(pos_ <= std::numeric_limits<uint32_t>::max());
+      assert(len_ <= std::numeric_limits<uint32_t>::max());
+    }
 
     Location(const std::string& s)
-    : source(SourceDef::synthetic(s)), pos(0), len(s.size())
-    {}
+    : source(SourceDef::synthetic(s)),
+      pos(0),
+      len(static_cast<uint32_t>(s.size()))
+    {
+      assert(s.size() <= std::numeric_limits<uint32_t>::max());
+    }
 
     std::string_view view() const
     {
@@ -328,4 +345,8 @@ namespace trieste
       return !(*this < that);
     }
   };
+
+  static_assert(
+    (sizeof(void*) != 8) || (sizeof(Location) <= 16),
+    "Location is larger than 16 bytes");
 }
@@ -0,0 +1,972 @@
+#pragma once
+
+#include "rewrite.h"
+
+#include <array>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Static patterns are an alternative to the pattern DSL in rewrite.h in which
+ * every pattern has its own C++ type. `sp::T(A) * sp::T(B)[B]` is a
+ * `Seq<Tokens<1>, Cap<Tokens<1>>>`, and matching it is a chain of inlined
+ * calls rather than one virtual call and continuation per step.
+ *
+ * Static patterns match exactly as the dynamic patterns of the same shape do,
+ * and they convert to `detail::Pattern`. A rule can be written with them
+ * (`sp::T(A) * sp::T(B) >> effect`) next to rules using dynamic patterns in
+ * the same pass, and a static pattern can be combined with a dynamic one,
+ * which gives a dynamic pattern. A static pattern is a single step to a rule
+ * tree, so it never shares a prefix with another rule.
+ *
+ * Patterns that are not allowed by the dynamic DSL, such as captures inside
+ * iteration, are compile errors rather than exceptions.
+ */
+namespace trieste::sp
+{
+  namespace detail
+  {
+    using FastPattern = trieste::detail::FastPattern;
+    using DynamicPattern = trieste::detail::Pattern;
+
+    struct PatternTag
+    {};
+
+    template<typename P>
+    inline constexpr bool is_pattern_v =
+      std::is_base_of_v<PatternTag, std::decay_t<P>>;
+
+    template<typename P>
+    using enable_pattern = std::enable_if_t<is_pattern_v<P>, int>;
+
+    template<typename P>
+    class Cap;
+    template<typename P>
+    class Opt;
+    template<typename P>
+    class Not;
+    template<typename P>
+    class Pred;
+    template<typename P>
+    class NegPred;
+    template<typename P, typename F>
+    class Action;
+    template<typename A, typename B>
+    class Seq;
+    template<typename P, typename C>
+    class Children;
+    template<typename P>
+    class Adapter;
+
+    template<typename P>
+    auto rep(const P& pattern);
+    template<typename A, typename B>
+    auto choice(const A& first, const B& second);
+
+    // Each pattern provides:
+    //   static constexpr bool has_captures
+    //   static constexpr bool repeatable, false if `P++` is not allowed
+    //   static constexpr bool last, true if nothing may follow it
+    //   bool match(NodeIt& it, const Node& parent, Match& match) const
+    //   FastPattern fast() const
+    //   void reify(Node parent) const
+    // and gets the DSL operators from PatternBase.
+    template<typename Self>
+    class PatternBase : public PatternTag
+    {
+    private:
+      const Self& self() const
+      {
+        return static_cast<const Self&>(*this);
+      }
+
+    public:
+      static constexpr bool has_captures = false;
+      static constexpr bool repeatable = true;
+      static constexpr bool last = false;
+
+      operator DynamicPattern() const
+      {
+        return {intrusive_ptr<Adapter<Self>>::make(self()), self().fast()};
+      }
+
+      template<typename F>
+      Action<Self, std::decay_t<F>> operator()(F&& action) const
+      {
+        return {self(), std::forward<F>(action)};
+      }
+
+      Cap<Self> operator[](const Token& name) const
+      {
+        return {self(), name};
+      }
+
+      Opt<Self> operator~() const
+      {
+        return {self()};
+      }
+
+      Pred<Self> operator++() const
+      {
+        return {self()};
+      }
+
+      NegPred<Self> operator--() const
+      {
+        return {self()};
+      }
+
+      auto operator++(int) const
+      {
+        return rep(self());
+      }
+
+      Not<Self> operator!() const
+      {
+        return {self()};
+      }
+
+      template<typename P, enable_pattern<P> = 0>
+      Seq<Self, P> operator*(const P& rhs) const
+      {
+        return {self(), rhs};
+      }
+
+      DynamicPattern operator*(const DynamicPattern& rhs) const
+      {
+        return DynamicPattern(*this) * rhs;
+      }
+
+      template<typename P, enable_pattern<P> = 0>
+      auto operator/(const P& rhs) const
+      {
+        return choice(self(), rhs);
+      }
+
+      DynamicPattern operator/(const DynamicPattern& rhs) const
+      {
+        return DynamicPattern(*this) / rhs;
+      }
+
+      template<typename P, enable_pattern<P> = 0>
+      Children<Self, P> operator<<(const P& rhs) const
+      {
+        return {self(), rhs};
+      }
+
+      DynamicPattern operator<<(const DynamicPattern& rhs) const
+      {
+        return DynamicPattern(*this) << rhs;
+      }
+    };
+
+    template<size_t N>
+    class Tokens : public PatternBase<Tokens<N>>
+    {
+    public:
+      std::array<Token, N> types;
+
+      Tokens(const std::array<Token, N>& types_) : types(types_) {}
+
+      TRIESTE_FAST_PATH bool
+      match(NodeIt& it, const Node& parent, Match& match) const
+      {
+        match.examine(it, parent);
+
+        if (it == parent->end())
+          return false;
+
+        for (const auto& t : types)
+        {
+          if ((*it)->type() == t)
+          {
+            ++it;
+            return true;
+          }
+        }
+
+        return false;
+      }
+
+      FastPattern fast() const
+      {
+        return FastPattern::match_token({types.begin(), types.end()});
+      }
+
+      void reify(Node parent) const
+      {
+        Node match = reified::TokenMatch;
+        for (const auto& t : types)
+          match->push_back(NodeDef::create(reified::Token, Location(t.str())));
+        parent->push_back(match);
+      }
+    };
+
+    class Regex : public PatternBase<Regex>
+    {
+    private:
+      Token type;
+      std::shared_ptr<TRegex> regex;
+
+    public:
+      Regex(const Token& type_, const std::string& re)
+      : type(type_), regex(std::make_shared<TRegex>(re))
+      {}
+
+      TRIESTE_FAST_PATH bool
+      match(NodeIt& it, const Node& parent, Match& match) const
+      {
+        match.examine(it, parent);
+
+        if ((it == parent->end()) || ((*it)->type() != type))
+          return false;
+
+        if (!TRegex::FullMatch((*it)->location().view(), *regex))
+          return false;
+
+        ++it;
+        return true;
+      }
+
+      FastPattern fast() const
+      {
+        return FastPattern::match_token({type});
+      }
+
+      void reify(Node parent) const
+      {
+        Node match = reified::RegexMatch;
+        match->push_back(NodeDef::create(reified::Token, Location(type.str())));
+        match->push_back(
+          NodeDef::create(reified::Regex, Location(regex->pattern())));
+        parent->push_back(match);
+      }
+    };
+
+    class Anything : public PatternBase<Anything>
+    {
+    public:
+      TRIESTE_FAST_PATH bool
+      match(NodeIt& it, const Node& parent, Match& match) const
+      {
+        match.examine(it, parent);
+
+        if (it == parent->end())
+          return false;
+
+        ++it;
+        return true;
+      }
+
+      FastPattern fast() const
+      {
+        return FastPattern::match_any();
+      }
+
+      void reify(Node parent) const
+      {
+        parent->push_back(reified::Any);
+      }
+    };
+
+    class First : public PatternBase<First>
+    {
+    public:
+      static constexpr bool repeatable = false;
+
+      TRIESTE_FAST_PATH bool
+      match(NodeIt& it, const Node& parent, Match&) const
+      {
+        return it == parent->begin();
+      }
+
+      FastPattern fast() const
+      {
+        return FastPattern::match_pred();
+      }
+
+      void reify(Node parent) const
+      {
+        parent->push_back(reified::First);
+      }
+    };
+
+    class Last : public PatternBase<Last>
+    {
+    public:
+      static constexpr bool repeatable = false;
+      static constexpr bool last = true;
+
+      TRIESTE_FAST_PATH bool
+      match(NodeIt& it, const Node& parent, Match& match) const
+      {
+        match.examine(it, parent);
+        return it == parent->end();
+      }
+
+      FastPattern fast() const
+      {
+        return FastPattern::match_pred();
+      }
+
+      void reify(Node parent) const
+      {
+        parent->push_back(reified::Last);
+      }
+    };
+
+    template<size_t N>
+    class Inside : public PatternBase<Inside<N>>
+    {
+    public:
+      std::array<Token, N> types;
+
+      Inside(const std::array<Token, N>& types_) : types(types_) {}
+
+      TRIESTE_FAST_PATH bool
+      match(NodeIt&, const Node& parent, Match&) const
+      {
+        for (const auto& type : types)
+        {
+          if (parent->type() == type)
+            return true;
+        }
+
+        return false;
+      }
+
+      FastPattern fast() const
+      {
+        return FastPattern::match_parent({types.begin(), types.end()});
+      }
+
+      void reify(Node parent) const
+      {
+        Node inside = reified::Inside;
+        for (const auto& type : types)
+          inside->push_back(
+            NodeDef::create(reified::Token, Location(type.str())));
+        parent->push_back(inside);
+      }
+    };
+
+    template<size_t N>
+    class InsideStar : public PatternBase<InsideStar<N>>
+    {
+    private:
+      std::array<Token, N> types;
+
+    public:
+      static constexpr bool repeatable = false;
+
+      InsideStar(const std::array<Token, N>& types_) : types(types_) {}
+
+      TRIESTE_FAST_PATH bool
+      match(NodeIt&, const Node& parent, Match&) const
+      {
+        NodeDef* p = &*parent;
+
+        while (p)
+        {
+          for (const auto& type : types)
+            if (p->type() == type)
+              return true;
+
+          p = p->parent_unsafe();
+        }
+
+        return false;
+      }
+
+      FastPattern fast() const
+      {
+        // As for the dynamic In(...)++, this overapproximates.
+        return FastPattern::match_any();
+      }
+
+      void reify(Node parent) const
+      {
+        Node inside_star = reified::InsideStar;
+        for (const auto& type : types)
+          inside_star->push_back(
+            NodeDef::create(reified::Token, Location(type.str())));
+        parent->push_back(inside_star);
+      }
+    };
+
+    template<typename A, typename B>
+    class Seq : public PatternBase<Seq<A, B>>
+    {
+    private:
+      A first;
+      B second;
+
+    public:
+      static_assert(!A::last, "Continuation not allowed after `End`");
+
+      static constexpr bool has_captures = A::has_captures || B::has_captures;
+      static constexpr bool repeatable = A::repeatable;
+      static constexpr bool last = B::last;
+
+      Seq(const A& first_, const B& second_) : first(first_), second(second_)
+      {}
+
+      TRIESTE_FAST_PATH bool
+      match(NodeIt& it, const Node& parent, Match& match) const
+      {
+        return first.match(it, parent, match) &&
+          second.match(it, parent, match);
+      }
+
+      FastPattern fast() const
+      {
+        return FastPattern::match_seq(first.fast(), second.fast());
+      }
+
+      void reify(Node parent) const
+      {
+        first.reify(parent);
+        second.reify(parent);
+      }
+    };
+
+    template<typename P>
+    class Cap : public PatternBase<Cap<P>>
+    {
+    private:
+      P pattern;
+      Token name;
+
+    public:
+      static constexpr bool has_captures = true;
+      static constexpr bool repeatable = P::repeatable;
+      static constexpr bool last = P::last;
+
+      Cap(const P& pattern_, const Token& name_)
+      : pattern(pattern_), name(name_)
+      {}
+
+      TRIESTE_FAST_PATH bool
+      match(NodeIt& it, const Node& parent, Match& match) const
+      {
+        auto begin = it;
+
+        if (!pattern.match(it, parent, match))
+          return false;
+
+        match.set(name, {begin, it});
+        return true;
+      }
+
+      FastPattern fast() const
+      {
+        return pattern.fast();
+      }
+
+      void reify(Node parent) const
+      {
+        Node cap = reified::Cap;
+
+        Node group = Group;
+        pattern.reify(group);
+        cap->push_back(group);
+
+        cap->push_back(NodeDef::create(reified::Token, Location(name.str())));
+        parent->push_back(cap);
+      }
+    };
+
+    template<typename P>
+    class Opt : public PatternBase<Opt<P>>
+    {
+    private:
+      P pattern;
+
+    public:
+      static constexpr bool has_captures = P::has_captures;
+
+      Opt(const P& pattern_) : pattern(pattern_) {}
+
+      TRIESTE_FAST_PATH bool
+      match(NodeIt& it, const Node& parent, Match& match) const
+      {
+        auto backtrack_it = it;
+        auto backtrack_frame = match.add_frame();
+
+        if (!pattern.match(it, parent, match))
+        {
+          it = backtrack_it;
+          match.return_to_frame(backtrack_frame);
+        }
+
+        return true;
+      }
+
+      FastPattern fast() const
+      {
+        return FastPattern::match_opt(pattern.fast());
+      }
+
+      void reify(Node parent) const
+      {
+        Node opt = reified::Opt;
+
+        Node group = Group;
+        pattern.reify(group);
+        opt->push_back(group);
+        parent->push_back(opt);
+      }
+    };
+
+    template<typename P>
+    class Rep : public PatternBase<Rep<P>>
+    {
+    private:
+      P pattern;
+
+    public:
+      static_assert(
+        !P::has_captures, "Captures not allowed inside iteration (Pattern++)!");
+      static_assert(P::repeatable, "Pattern not allowed inside iteration!");
+
+      Rep(const P& pattern_) : pattern(pattern_) {}
+
+      TRIESTE_FAST_PATH bool
+      match(NodeIt& it, const Node& parent, Match& match) const
+      {
+        NodeIt curr = it;
+        auto end = parent->end();
+
+        while ((it != end) && pattern.match(it, parent, match))
+          curr = it;
+
+        // Last match failed so backtrack it.
+        it = curr;
+        return true;
+      }
+
+      FastPattern fast() const
+      {
+        return FastPattern::match_opt(pattern.fast());
+      }
+
+      void reify(Node parent) const
+      {
+        Node rep = reified::Rep;
+
+        Node group = Group;
+        pattern.reify(group);
+        rep->push_back(group);
+        parent->push_back(rep);
+      }
+    };
+
+    template<typename P>
+    class Not : public PatternBase<Not<P>>
+    {
+    private:
+      P pattern;
+
+    public:
+      static_assert(
+        !P::has_captures, "Captures not allowed inside Not (!Pattern)!");
+
+      Not(const P& pattern_) : pattern(pattern_) {}
+
+      TRIESTE_FAST_PATH bool
+      match(NodeIt& it, const Node& parent, Match& match) const
+      {
+        match.examine(it, parent);
+
+        if (it == parent->end())
+          return false;
+
+        auto begin = it;
+        it = begin + 1;
+        return !pattern.match(begin, parent, match);
+      }
+
+      FastPattern fast() const
+      {
+        return FastPattern::match_pred();
+      }
+
+      void reify(Node parent) const
+      {
+        Node not_node = reified::Not;
+
+        Node group = Group;
+        pattern.reify(group);
+        not_node->push_back(group);
+        parent->push_back(not_node);
+      }
+    };
+
+    template<typename A, typename B>
+    class Choice : public PatternBase<Choice<A, B>>
+    {
+    private:
+      A first;
+      B second;
+
+    public:
+      static constexpr bool has_captures = A::has_captures || B::has_captures;
+
+      Choice(const A& first_, const B& second_)
+      : first(first_), second(second_)
+      {}
+
+      TRIESTE_FAST_PATH bool
+      match(NodeIt& it, const Node& parent, Match& match) const
+      {
+        auto backtrack_it = it;
+        [[maybe_unused]] size_t backtrack_frame = 0;
+
+        if constexpr (A::has_captures)
+          backtrack_frame = match.add_frame();
+
+        if (first.match(it, parent, match))
+          return true;
+
+        it = backtrack_it;
+
+        if constexpr (A::has_captures)
+          match.return_to_frame(backtrack_frame);
+
+        return second.match(it, parent, match);
+      }
+
+      FastPattern fast() const
+      {
+        return FastPattern::match_choice(first.fast(), second.fast());
+      }
+
+      void reify(Node parent) const
+      {
+        Node choice = reified::Choice;
+
+        Node group1 = Group;
+        Node group2 = Group;
+        first.reify(group1);
+        second.reify(group2);
+        choice->push_back(group1);
+        choice->push_back(group2);
+        parent->push_back(choice);
+      }
+    };
+
+    template<typename P, typename C>
+    class Children : public PatternBase<Children<P, C>>
+    {
+    private:
+      P pattern;
+      C children;
+
+    public:
+      static constexpr bool has_captures = P::has_captures || C::has_captures;
+
+      Children(const P& pattern_, const C& children_)
+      : pattern(pattern_), children(children_)
+      {}
+
+      TRIESTE_FAST_PATH bool
+      match(NodeIt& it, const Node& parent, Match& match) const
+      {
+        auto begin = it;
+
+        if (!pattern.match(it, parent, match))
+          return false;
+
+        auto it2 = (*begin)->begin();
+        return children.match(it2, *begin, match);
+      }
+
+      FastPattern fast() const
+      {
+        return pattern.fast();
+      }
+
+      void reify(Node parent) const
+      {
+        Node children_node = reified::Children;
+
+        Node parent_group = Group;
+        pattern.reify(parent_group);
+        children_node->push_back(parent_group);
+
+        Node children_group = Group;
+        children.reify(children_group);
+        children_node->push_back(children_group);
+        parent->push_back(children_node);
+      }
+    };
+
+    template<typename P>
+    class Pred : public PatternBase<Pred<P>>
+    {
+    private:
+      P pattern;
+
+    public:
+      static_assert(
+        !P::has_captures, "Captures not allowed inside Pred (++Pattern)!");
+
+      static constexpr bool repeatable = false;
+
+      Pred(const P& pattern_) : pattern(pattern_) {}
+
+      TRIESTE_FAST_PATH bool
+      match(NodeIt& it, const Node& parent, Match& match) const
+      {
+        auto begin = it;
+        return pattern.match(begin, parent, match);
+      }
+
+      FastPattern fast() const
+      {
+        return FastPattern::match_pred();
+      }
+
+      void reify(Node parent) const
+      {
+        Node pred = reified::Pred;
+        Node group = Group;
+        pattern.reify(group);
+        pred->push_back(group);
+        parent->push_back(pred);
+      }
+    };
+
+    template<typename P>
+    class NegPred : public PatternBase<NegPred<P>>
+    {
+    private:
+      P pattern;
+
+    public:
+      static_assert(
+        !P::has_captures, "Captures not allowed inside NegPred (--Pattern)!");
+
+      static constexpr bool repeatable = false;
+
+      NegPred(const P& pattern_) : pattern(pattern_) {}
+
+      TRIESTE_FAST_PATH bool
+      match(NodeIt& it, const Node& parent, Match& match) const
+      {
+        auto begin = it;
+        return !pattern.match(begin, parent, match);
+      }
+
+      FastPattern fast() const
+      {
+        return FastPattern::match_pred();
+      }
+
+      void reify(Node parent) const
+      {
+        Node neg_pred = reified::NegPred;
+        Node group = Group;
+        pattern.reify(group);
+        neg_pred->push_back(group);
+        parent->push_back(neg_pred);
+      }
+    };
+
+    template<typename P, typename F>
+    class Action : public PatternBase<Action<P, F>>
+    {
+    private:
+      P pattern;
+      F action;
+
+    public:
+      static constexpr bool has_captures = P::has_captures;
+      static constexpr bool repeatable = P::repeatable;
+      static constexpr bool last = P::last;
+
+      template<typename G>
+      Action(const P& pattern_, G&& action_)
+      : pattern(pattern_), action(std::forward<G>(action_))
+      {}
+
+      TRIESTE_FAST_PATH bool
+      match(NodeIt& it, const Node& parent, Match& match) const
+      {
+        auto begin = it;
+
+        if (!pattern.match(it, parent, match))
+          return false;
+
+        NodeRange range = {begin, it};
+        return action(range);
+      }
+
+      FastPattern fast() const
+      {
+        return pattern.fast();
+      }
+
+      void reify(Node parent) const
+      {
+        Node action_node = reified::Action;
+        Node group = Group;
+        pattern.reify(group);
+        action_node->push_back(group);
+        parent->push_back(action_node);
+      }
+    };
+
+    template<typename P>
+    struct is_tokens : std::false_type
+    {};
+
+    template<size_t N>
+    struct is_tokens<Tokens<N>> : std::true_type
+    {};
+
+    // A static pattern as one step of a dynamic pattern.
+    template<typename P>
+    class Adapter : public trieste::detail::PatternDef
+    {
+    private:
+      P pattern;
+
+    public:
+      Adapter(const P& pattern_) : pattern(pattern_) {}
+
+      bool has_captures_local() const& override
+      {
+        return P::has_captures;
+      }
+
+      trieste::detail::PatternPtr clone() const& override
+      {
+        return intrusive_ptr<Adapter>::make(*this);
+      }
+
+      void set_continuation(trieste::detail::PatternPtr next) override
+      {
+        if constexpr (P::last)
+          throw std::runtime_error("Continuation not allowed after `End`");
+
+        PatternDef::set_continuation(next);
+      }
+
+      std::vector<Token> only_tokens() const override
+      {
+        if constexpr (is_tokens<P>::value)
+        {
+          if (no_continuation())
+            return {pattern.types.begin(), pattern.types.end()};
+        }
+
+        return {};
+      }
+
+      bool match(NodeIt& it, const Node& parent, Match& match) const& override
+      {
+        return pattern.match(it, parent, match) &&
+          match_continuation(it, parent, match);
+      }
+
+      void reify(Node parent) const override
+      {
+        pattern.reify(parent);
+        reify_continuation(parent);
+      }
+    };
+
+    template<typename P>
+    auto rep(const P& pattern)
+    {
+      return Rep<P>(pattern);
+    }
+
+    // Rep(Rep(P)) -> Rep(P)
+    template<typename P>
+    auto rep(const Rep<P>& pattern)
+    {
+      return pattern;
+    }
+
+    // Rep(Inside) -> InsideStar
+    template<size_t N>
+    auto rep(const Inside<N>& pattern)
+    {
+      return InsideStar<N>(pattern.types);
+    }
+
+    template<typename A, typename B>
+    auto choice(const A& first, const B& second)
+    {
+      return Choice<A, B>(first, second);
+    }
+
+    // T(a) / T(b) -> T(a, b)
+    template<size_t N, size_t M>
+    auto choice(const Tokens<N>& first, const Tokens<M>& second)
+    {
+      std::array<Token, N + M> types;
+
+      for (size_t i = 0; i < N; i++)
+        types[i] = first.types[i];
+      for (size_t i = 0; i < M; i++)
+        types[N + i] = second.types[i];
+
+      return Tokens<N + M>(types);
+    }
+
+    // The left-hand side of `>>`. The conversion happens where the rule is
+    // written, so that is the location recorded for the rule.
+    struct Rule
+    {
+      trieste::detail::Located<DynamicPattern> pattern;
+
+      template<typename P, enable_pattern<P> = 0>
+      Rule(const P& pattern_, trieste::detail::DebugLocation l = {})
+      : pattern(DynamicPattern(pattern_), l)
+      {}
+    };
+
+    template<typename F>
+    inline auto operator>>(Rule rule, F effect)
+      -> trieste::detail::PatternEffect<decltype(effect(
+        std::declval<Match&>()))>
+    {
+      return {rule.pattern, effect};
+    }
+  }
+
+  inline const auto Any = detail::Anything();
+  inline const auto Start = detail::First();
+  inline const auto End = detail::Last();
+
+  inline detail::Tokens<1> T(const Token& type)
+  {
+    return {{type}};
+  }
+
+  template<typename... Ts>
+  inline detail::Tokens<2 + sizeof...(Ts)>
+  T(const Token& type1, const Token& type2, const Ts&... types)
+  {
+    return {{type1, type2, types...}};
+  }
+
+  inline detail::Regex T(const Token& type, const std::string& r)
+  {
+    return {type, r};
+  }
+
+  template<typename... Ts>
+  inline detail::Inside<1 + sizeof...(Ts)>
+  In(const Token& type, const Ts&... types)
+  {
+    return {{type, types...}};
+  }
+}
@@ -24,6 +24,7 @@ namespace trieste
   {
     static constexpr void intrusive_inc_ref(NodeDef*);
     inline static void intrusive_dec_ref(NodeDef*);
+    inline static void intrusive_delete(NodeDef*);
   };
 
   using Node = intrusive_ptr<NodeDef>;
@@ -42,16 +43,15 @@ namespace trieste
     const char* name;
     flag fl;
 
-    // Hash id for this token.  This is used to determine the hash function for
-    // the default map for the main rewrite loop.  This is not a general purpose
-    // hash function.
+    // Dense id for this token, unique across all tokens in the program. This
+    // is used to index the tables of the default map for the main rewrite
+    // loop.
     uint32_t default_map_id;
-    static constexpr size_t DEFAULT_MAP_TABLE_SIZE{128};
 
     TokenDef(const char* name_, flag fl_ = 0) : name(name_), fl(fl_)
     {
       static std::atomic<uint32_t> next_id = 0;
-      default_map_id = (next_id++ % DEFAULT_MAP_TABLE_SIZE) * sizeof(void*);
+      default_map_id = next_id++;
 
       detail::register_token(*this);
     }
@@ -77,12 +77,12 @@ namespace trieste
     operator Node() const;
 
     /**
-     * Special hash for looking up in tables of size DEFAULT_MAP_TABLE_SIZE with
-     * elements of size sizeof(void*).
+     * Dense index for looking up in the tables of a DefaultMap. No two tokens
+     * share an index.
      */
     uint32_t default_map_hash() const
     {
-      return def->default_map_id / sizeof(void*);
+      return def->default_map_id;
     }
 
     bool operator&(TokenDef::flag f) const
@@ -179,6 +179,7 @@ namespace trieste
     Destination destination_;
     bool debug_enabled_;
     bool wf_check_enabled_;
+    bool profile_enabled_;
     std::filesystem::path debug_path_;
 
   public:
@@ -193,6 +194,7 @@ namespace trieste
       write_file_(write_file),
       debug_enabled_(false),
       wf_check_enabled_(true),
+      profile_enabled_(false),
       debug_path_(".")
     {
       console();
@@ -214,6 +216,7 @@ namespace trieste
       auto result =
         Process(pass_range)
           .set_check_well_formed(wf_check_enabled_)
+          .set_profile(profile_enabled_)
           .set_default_pass_complete(summary, language_name_, debug_path)
           .run(ast);
       summary << "---------" << std::endl;
@@ -292,6 +295,17 @@ namespace trieste
       return wf_check_enabled_;
     }
 
+    Writer& profile_enabled(bool value)
+    {
+      profile_enabled_ = value;
+      return *this;
+    }
+
+    bool profile_enabled() const
+    {
+      return profile_enabled_;
+    }
+
     Writer& debug_path(const std::filesystem::path& path)
     {
       debug_path_ = path;
@@ -86,7 +86,7 @@ namespace
     PassDef structure = {
       "structure",
       json::wf,
-      dir::bottomup,
+      dir::bottomup | dir::incremental,
       {
         In(ArrayGroup) * (Start * ValueToken[Value]) >>
           [](Match& _) { return (Value << _(Value)); },
@@ -0,0 +1,196 @@
+#include <iostream>
+#include <trieste/trieste.h>
+
+using namespace trieste;
+
+namespace
+{
+  inline const auto TestRoot = TokenDef("test-root");
+  inline const auto TestScope = TokenDef("test-scope", flag::symtab);
+  inline const auto TestA = TokenDef("test-a");
+  inline const auto TestB = TokenDef("test-b");
+
+  size_t failures = 0;
+  size_t destroyed = 0;
+
+  struct Counted : intrusive_refcounted<Counted, refcount::nonatomic>
+  {
+    ~Counted()
+    {
+      destroyed++;
+    }
+  };
+
+  void check(bool ok, const std::string& what)
+  {
+    if (!ok)
+    {
+      std::cout << what << std::endl;
+      failures++;
+    }
+  }
+
+  // Build a node with the given number of children, each with a distinct
+  // location so that the order can be checked.
+  Node make_node(size_t size)
+  {
+    Node node = TestRoot;
+
+    for (size_t i = 0; i < size; i++)
+      node << NodeDef::create(TestA, Location(std::to_string(i)));
+
+    return node;
+  }
+
+  bool in_order(Node node, const std::vector<std::string>& expected)
+  {
+    if (node->size() != expected.size())
+      return false;
+
+    for (size_t i = 0; i < expected.size(); i++)
+    {
+      if (node->at(i)->location().view() != expected[i])
+        return false;
+      if (node->at(i)->parent() != node)
+        return false;
+    }
+
+    return true;
+  }
+
+  void test_children()
+  {
+    std::cout << "  children" << std::endl;
+
+    // Cover the inline storage, the transition to the heap, and the heap.
+    for (size_t size = 0; size < 8; size++)
+    {
+      std::vector<std::string> expected;
+      for (size_t i = 0; i < size; i++)
+        expected.push_back(std::to_string(i));
+
+      auto node = make_node(size);
+      check(in_order(node, expected), "push_back order");
+
+      auto copy = node->clone();
+      check(in_order(copy, expected), "clone order");
+      check(node->equals(copy), "clone not equal");
+
+      for (size_t pos = 0; pos <= size; pos++)
+      {
+        auto inserted = node->clone();
+        inserted->insert(
+          inserted->begin() + pos, NodeDef::create(TestB, Location("x")));
+        auto with_x = expected;
+        with_x.insert(with_x.begin() + pos, "x");
+        check(in_order(inserted, with_x), "insert order");
+
+        Nodes range = {
+          NodeDef::create(TestB, Location("y")),
+          NodeDef::create(TestB, Location("z"))};
+        auto ranged = node->clone();
+        ranged->insert(
+          ranged->begin() + pos, range.data(), range.data() + range.size());
+        auto with_yz = expected;
+        with_yz.insert(with_yz.begin() + pos, {"y", "z"});
+        check(in_order(ranged, with_yz), "range insert order");
+
+        if (pos < size)
+        {
+          auto erased = node->clone();
+          erased->erase(erased->begin() + pos, erased->end());
+          auto prefix = expected;
+          prefix.erase(prefix.begin() + pos, prefix.end());
+          check(in_order(erased, prefix), "erase order");
+
+          auto replaced = node->clone();
+          replaced->replace(
+            replaced->at(pos), NodeDef::create(TestB, Location("r")));
+          auto with_r = expected;
+          with_r[pos] = "r";
+          check(in_order(replaced, with_r), "replace order");
+        }
+      }
+
+      std::vector<std::string> reversed;
+      for (auto it = node->rbegin(); it != node->rend(); ++it)
+        reversed.push_back(std::string((*it)->location().view()));
+      check(
+        std::equal(reversed.begin(), reversed.end(), expected.rbegin()),
+        "reverse iteration order");
+
+      while (!node->empty())
+      {
+        node->pop_back();
+        expected.pop_back();
+        check(in_order(node, expected), "pop_back order");
+      }
+    }
+  }
+
+  void test_symtab()
+  {
+    std::cout << "  symtab" << std::endl;
+
+    Node plain = TestRoot;
+    check(plain->includes().empty(), "plain node has includes");
+
+    // Symbol tables work for nodes with flag::symtab, inside and outside of
+    // an arena.
+    for (auto arena : {static_cast<NodeArena*>(nullptr), NodeArena::make()})
+    {
+      NodeArena::Scope scope(arena);
+      Node scope_node = TestScope;
+      Node def = NodeDef::create(TestA, Location("x"));
+      scope_node << def;
+
+      check(scope_node->arena() == arena, "symtab node arena");
+      check(def->bind(def->location()), "bind failed");
+      check(
+        scope_node->look(def->location()) == Nodes{def}, "lookup failed");
+
+      auto copy = scope_node->clone();
+      check(copy->arena() == arena, "symtab clone arena");
+      check(copy->equals(scope_node), "symtab clone");
+    }
+  }
+
+  void test_refcount()
+  {
+    std::cout << "  refcount" << std::endl;
+
+    // Both policies fit in a word, so neither changes the size of a node.
+    check(
+      sizeof(detail::copyable_refcount<refcount::nonatomic>) ==
+        sizeof(detail::copyable_refcount<refcount::atomic>),
+      "refcount policies differ in size");
+
+    auto a = intrusive_ptr<Counted>::make();
+    {
+      auto b = a;
+      auto c = std::move(b);
+      c = a;
+    }
+    check(destroyed == 0, "non-atomic refcount released early");
+    a = nullptr;
+    check(destroyed == 1, "non-atomic refcount not released");
+  }
+}
+
+int main()
+{
+  std::cout << "Running ast tests" << std::endl;
+
+  test_children();
+  test_symtab();
+  test_refcount();
+
+  if (failures > 0)
+  {
+    std::cout << failures << " test(s) failed" << std::endl;
+    return 1;
+  }
+
+  std::cout << "All ast tests passed" << std::endl;
+  return 0;
+}
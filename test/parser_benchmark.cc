@@ -0,0 +1,637 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+
+// Offline throughput benchmark for the parser, the pass engine and the
+// writers. Each case generates a deterministic synthetic corpus, then times
+// parsing, every reader pass and the writer separately. Nothing is fetched or
+// read from disk, so the results are comparable across machines and runs.
+//
+// Trieste parsers tokenise and group in a single scan, so the "parse" stage
+// covers lexing as well; there is no separate lex stage to report.
+
+#include "infix.h"
+#include "shrubbery.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <trieste/json.h>
+#include <trieste/trieste.h>
+#include <trieste/xoroshiro.h>
+#include <trieste/yaml.h>
+#include <vector>
+
+#if defined(_WIN32)
+// Peak RSS is not reported on Windows.
+#else
+#  include <sys/resource.h>
+#endif
+
+namespace
+{
+  using namespace trieste;
+
+  using Rand = xoroshiro::p128r32;
+
+  struct Language
+  {
+    std::string name;
+    std::string extension;
+    std::function<std::string(size_t, Rand&)> generate;
+    std::function<Reader()> reader;
+    // Empty for languages without a writer.
+    std::function<Writer()> writer;
+  };
+
+  struct StageResult
+  {
+    std::string stage;
+    double ns;
+  };
+
+  struct CaseResult
+  {
+    std::string language;
+    size_t bytes;
+    size_t nodes;
+    std::vector<StageResult> stages;
+    size_t peak_rss_kb;
+  };
+
+  constexpr uint64_t CorpusSeed = 0x7269657374650001;
+  constexpr int DefaultRepeats = 5;
+  constexpr int QuickRepeats = 1;
+
+  double median(std::vector<double> values)
+  {
+    if (values.empty())
+      return 0.0;
+
+    std::sort(values.begin(), values.end());
+    const size_t mid = values.size() / 2;
+    if ((values.size() % 2) == 1)
+      return values[mid];
+    return (values[mid - 1] + values[mid]) / 2.0;
+  }
+
+  bool parse_int_arg(const std::string& value, int min_value, int& out)
+  {
+    try
+    {
+      const int parsed = std::stoi(value);
+      if (parsed < min_value)
+        return false;
+      out = parsed;
+      return true;
+    }
+    catch (...)
+    {
+      return false;
+    }
+  }
+
+  bool parse_sizes_arg(const std::string& value, std::vector<size_t>& out)
+  {
+    std::vector<size_t> sizes;
+    std::istringstream in(value);
+    std::string item;
+    while (std::getline(in, item, ','))
+    {
+      int kb = 0;
+      if (!parse_int_arg(item, 1, kb))
+        return false;
+      sizes.push_back(static_cast<size_t>(kb));
+    }
+
+    if (sizes.empty())
+      return false;
+
+    out = sizes;
+    return true;
+  }
+
+  size_t pick(Rand& rand, size_t n)
+  {
+    return rand() % n;
+  }
+
+  std::string word(Rand& rand)
+  {
+    static const char* words[] = {
+      "alpha", "bravo",  "charlie", "delta", "echo",    "foxtrot",
+      "golf",  "hotel",  "india",   "julia", "kilo",    "lima",
+      "mike",  "oscar",  "papa",    "romeo", "sierra",  "tango",
+      "value", "record", "node",    "pass",  "rewrite", "token"};
+    return words[pick(rand, sizeof(words) / sizeof(words[0]))];
+  }
+
+  std::string number(Rand& rand)
+  {
+    if (pick(rand, 3) == 0)
+      return std::to_string(pick(rand, 1000)) + "." +
+        std::to_string(pick(rand, 100));
+    return std::to_string(pick(rand, 100000));
+  }
+
+  // An array of records with nested objects and arrays of every value type.
+  std::string generate_json(size_t target, Rand& rand)
+  {
+    std::string out = "[\n";
+    for (size_t id = 0; out.size() < target; id++)
+    {
+      if (id > 0)
+        out += ",\n";
+      out += "  {\"id\": " + std::to_string(id);
+      out += ", \"name\": \"" + word(rand) + "_" + std::to_string(id) + "\"";
+      out += ", \"score\": " + number(rand);
+      out += ", \"active\": ";
+      out += pick(rand, 2) ? "true" : "false";
+      out += ", \"parent\": null";
+      out += ",\n   \"tags\": [";
+      for (size_t i = 0, n = pick(rand, 5); i < n; i++)
+        out += (i ? ", \"" : "\"") + word(rand) + "\"";
+      out += "]";
+      out += ",\n   \"meta\": {\"depth\": " + std::to_string(pick(rand, 8));
+      out += ", \"note\": \"" + word(rand) + " " + word(rand) + "\\n\"";
+      out += ", \"points\": [[" + number(rand) + ", " + number(rand) + "], [" +
+        number(rand) + ", " + number(rand) + "]]}}";
+    }
+    out += "\n]\n";
+    return out;
+  }
+
+  // A stream of documents, each a block sequence of mappings mixing plain,
+  // quoted, flow and literal scalars. Documents are kept to a few KiB so that
+  // the corpus size scales the number of documents rather than the length of
+  // a single sequence.
+  std::string generate_yaml(size_t target, Rand& rand)
+  {
+    constexpr size_t DocumentSize = 4096;
+    std::string out = "---\n";
+    size_t doc_start = 0;
+    for (size_t id = 0; out.size() < target; id++)
+    {
+      if (out.size() - doc_start >= DocumentSize)
+      {
+        doc_start = out.size();
+        out += "---\n";
+      }
+
+      out += "- id: " + std::to_string(id) + "\n";
+      out += "  name: " + word(rand) + "_" + std::to_string(id) + "\n";
+      out += "  score: " + number(rand) + "\n";
+      out += "  active: ";
+      out += pick(rand, 2) ? "true\n" : "false\n";
+      out += "  tags: [";
+      for (size_t i = 0, n = pick(rand, 4) + 1; i < n; i++)
+        out += (i ? ", " : "") + word(rand);
+      out += "]\n";
+      out += "  meta:\n";
+      out += "    depth: " + std::to_string(pick(rand, 8)) + "\n";
+      out += "    note: \"" + word(rand) + " " + word(rand) + "\"\n";
+      out += "    items:\n";
+      for (size_t i = 0, n = pick(rand, 3) + 1; i < n; i++)
+        out += "      - " + word(rand) + "\n";
+      if (pick(rand, 4) == 0)
+      {
+        out += "    text: |\n";
+        out += "      " + word(rand) + " " + word(rand) + "\n";
+        out += "      " + word(rand) + "\n";
+      }
+    }
+    out += "...\n";
+    return out;
+  }
+
+  // Assignments over previously defined variables, with occasional output.
+  std::string generate_infix(size_t target, Rand& rand)
+  {
+    static const char* ops[] = {" + ", " - ", " * ", " / "};
+    std::string out;
+    for (size_t id = 0; out.size() < target; id++)
+    {
+      auto operand = [&]() {
+        if (id > 0 && pick(rand, 2) == 0)
+          return "v" + std::to_string(pick(rand, id));
+        return number(rand);
+      };
+
+      out += "v" + std::to_string(id) + " = ";
+      if (pick(rand, 3) == 0)
+        out += "(" + operand() + ops[pick(rand, 4)] + operand() + ")" +
+          ops[pick(rand, 4)];
+      for (size_t i = 0, n = pick(rand, 4); i < n; i++)
+        out += operand() + ops[pick(rand, 4)];
+      out += operand() + ";\n";
+
+      if (pick(rand, 8) == 0)
+        out += "print \"v" + std::to_string(id) + "\" v" + std::to_string(id) +
+          ";\n";
+    }
+    return out;
+  }
+
+  // Definitions with indented blocks, alternatives, groups and operators.
+  std::string generate_shrubbery(size_t target, Rand& rand)
+  {
+    static const char* ops[] = {" + ", " - ", " * ", " == ", " <= ", " ++ "};
+    std::string out;
+    for (size_t id = 0; out.size() < target; id++)
+    {
+      auto expr = [&]() {
+        std::string e = word(rand);
+        for (size_t i = 0, n = pick(rand, 3); i < n; i++)
+          e += ops[pick(rand, 6)] + (pick(rand, 2) ? word(rand) : number(rand));
+        return e;
+      };
+
+      out += "fun " + word(rand) + "_" + std::to_string(id) + "(" + word(rand) +
+        ", " + word(rand) + "):\n";
+      out += "  let x = [" + expr() + ", " + expr() + "]\n";
+      out += "  match " + expr() + "\n";
+      out += "  | 0: \"" + word(rand) + "\"\n";
+      out += "  | n: {" + expr() + "}; " + expr() + "\n";
+      if (pick(rand, 2) == 0)
+        out += "  " + expr() + "\n    + " + expr() + "\n";
+    }
+    return out;
+  }
+
+  std::vector<Language> languages()
+  {
+    return {
+      {"json",
+       ".json",
+       generate_json,
+       []() { return json::reader(); },
+       []() { return json::writer("out.json"); }},
+      {"yaml",
+       ".yaml",
+       generate_yaml,
+       []() { return yaml::reader(); },
+       []() { return yaml::writer("out.yaml"); }},
+      {"infix",
+       ".infix",
+       generate_infix,
+       []() { return infix::reader(); },
+       []() { return infix::writer("out.infix"); }},
+      {"shrubbery",
+       ".shrubbery",
+       generate_shrubbery,
+       []() { return shrubbery::reader(); },
+       nullptr},
+    };
+  }
+
+  // Reports the peak resident set size of the process in KiB, or 0 where this
+  // is not available.
+  size_t peak_rss_kb()
+  {
+#if defined(_WIN32)
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+      return 0;
+#  if defined(__APPLE__)
+    return static_cast<size_t>(usage.ru_maxrss) / 1024;
+#  else
+    return static_cast<size_t>(usage.ru_maxrss);
+#  endif
+#endif
+  }
+
+  // Resets the kernel's peak RSS counter so that each case reports its own
+  // peak. This is best effort: it is Linux only, and elsewhere the reported
+  // peak is that of the whole process so far.
+  void reset_peak_rss()
+  {
+#if defined(__linux__)
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    if (clear_refs)
+      clear_refs << "5";
+#endif
+  }
+
+  double elapsed_ns(
+    std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end)
+  {
+    return static_cast<double>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+        .count());
+  }
+
+  // Runs parse, the reader passes and the writer once, adding each stage's
+  // time to `samples`. Returns false and reports the errors if any stage
+  // fails.
+  bool run_once(
+    const Language& lang,
+    const Source& source,
+    std::vector<StageResult>& samples,
+    size_t& nodes)
+  {
+    auto reader = lang.reader();
+    samples.clear();
+
+    auto start = std::chrono::steady_clock::now();
+    Node ast = reader.parser().parse(source);
+    samples.push_back(
+      {"parse", elapsed_ns(start, std::chrono::steady_clock::now())});
+
+    // Mirror Reader::read(), but time each pass with a finer clock than the
+    // microseconds in PassStatistics. The time includes the symbol table
+    // rebuild and error scan that Process performs after each pass.
+    auto passes = reader.passes();
+    PassRange pass_range(passes, reader.parser().wf(), "parse");
+    auto pass_start = std::chrono::steady_clock::now();
+    auto result = Process(pass_range)
+                    .set_check_well_formed(false)
+                    .set_pass_complete([&](
+                                         Node&,
+                                         std::string name,
+                                         size_t index,
+                                         PassStatistics&) {
+                      auto now = std::chrono::steady_clock::now();
+                      // Some pass names contain spaces, which would split the
+                      // key=value report lines.
+                      std::replace(name.begin(), name.end(), ' ', '_');
+                      if (index > 0)
+                        samples.push_back(
+                          {"pass:" + name, elapsed_ns(pass_start, now)});
+                      pass_start = now;
+                      return true;
+                    })
+                    .run(ast);
+
+    if (!result.ok)
+    {
+      logging::Error err;
+      err << lang.name << ": ";
+      result.print_errors(err);
+      return false;
+    }
+
+    nodes = 0;
+    result.ast->traverse([&](Node&) {
+      nodes++;
+      return true;
+    });
+
+    if (!lang.writer)
+      return true;
+
+    auto writer = lang.writer();
+    writer.synthetic();
+    start = std::chrono::steady_clock::now();
+    auto written = writer.write(result.ast);
+    samples.push_back(
+      {"write", elapsed_ns(start, std::chrono::steady_clock::now())});
+
+    if (!written.ok)
+    {
+      logging::Error err;
+      err << lang.name << " writer: ";
+      written.print_errors(err);
+      return false;
+    }
+
+    return true;
+  }
+
+  double mb_per_s(size_t bytes, double ns)
+  {
+    if (ns <= 0.0)
+      return 0.0;
+    return static_cast<double>(bytes) * 1000.0 / ns;
+  }
+
+  bool run_case(
+    const Language& lang,
+    size_t size_kb,
+    int repeats,
+    CaseResult& out)
+  {
+    Rand rand(CorpusSeed + size_kb);
+    const auto text = lang.generate(size_kb * 1024, rand);
+    const auto source = SourceDef::synthetic(text, "corpus" + lang.extension);
+
+    reset_peak_rss();
+
+    std::vector<std::vector<double>> stage_ns;
+    std::vector<std::string> stage_names;
+    std::vector<StageResult> samples;
+    size_t nodes = 0;
+
+    // One untimed warmup run, which also checks that the corpus is accepted.
+    if (!run_once(lang, source, samples, nodes))
+      return false;
+
+    for (auto& sample : samples)
+      stage_names.push_back(sample.stage);
+    stage_ns.resize(stage_names.size());
+
+    for (int r = 0; r < repeats; r++)
+    {
+      if (!run_once(lang, source, samples, nodes))
+        return false;
+
+      for (size_t i = 0; i < samples.size() && i < stage_ns.size(); i++)
+        stage_ns[i].push_back(samples[i].ns);
+    }
+
+    out = {lang.name, text.size(), nodes, {}, peak_rss_kb()};
+    double total = 0.0;
+    for (size_t i = 0; i < stage_names.size(); i++)
+    {
+      const double med = median(stage_ns[i]);
+      total += med;
+      out.stages.push_back({stage_names[i], med});
+    }
+    out.stages.push_back({"total", total});
+    return true;
+  }
+
+  void print_case(const CaseResult& result)
+  {
+    std::cout << std::fixed << std::setprecision(1);
+    for (auto& stage : result.stages)
+    {
+      std::cout << "BENCH lang=" << result.language
+                << " bytes=" << result.bytes << " stage=" << stage.stage
+                << " median_us=" << stage.ns / 1000.0
+                << " mb_s=" << mb_per_s(result.bytes, stage.ns) << std::endl;
+    }
+    std::cout << "BENCH lang=" << result.language << " bytes=" << result.bytes
+              << " nodes=" << result.nodes
+              << " peak_rss_kb=" << result.peak_rss_kb << std::endl;
+  }
+
+  bool write_json(
+    const std::string& path,
+    const std::vector<CaseResult>& results,
+    int repeats)
+  {
+    std::ofstream f(path, std::ios::binary | std::ios::out);
+    if (!f)
+    {
+      std::cerr << "ERROR: could not open " << path << " for writing"
+                << std::endl;
+      return false;
+    }
+
+    // Stage and language names are plain identifiers, so nothing needs
+    // escaping.
+    f << std::fixed << std::setprecision(1);
+    f << "{\n  \"benchmark\": \"trieste_parser_benchmark\",\n"
+      << "  \"seed\": " << CorpusSeed << ",\n  \"repeats\": " << repeats
+      << ",\n  \"cases\": [";
+    for (size_t c = 0; c < results.size(); c++)
+    {
+      auto& result = results[c];
+      f << (c ? "," : "") << "\n    {\"language\": \"" << result.language
+        << "\", \"bytes\": " << result.bytes << ", \"nodes\": " << result.nodes
+        << ", \"peak_rss_kb\": " << result.peak_rss_kb << ", \"stages\": [";
+      for (size_t s = 0; s < result.stages.size(); s++)
+      {
+        auto& stage = result.stages[s];
+        f << (s ? "," : "") << "\n      {\"stage\": \"" << stage.stage
+          << "\", \"median_ns\": " << stage.ns
+          << ", \"mb_per_s\": " << mb_per_s(result.bytes, stage.ns) << "}";
+      }
+      f << "]}";
+    }
+    f << "\n  ]\n}\n";
+    return bool(f);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  std::vector<size_t> sizes_kb = {64, 512, 4096};
+  int repeats = DefaultRepeats;
+  std::string focus_lang;
+  std::string json_path;
+  bool quick = false;
+  bool repeats_set = false;
+  bool dump = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    if (arg.rfind("--lang=", 0) == 0)
+    {
+      focus_lang = arg.substr(std::string("--lang=").size());
+    }
+    else if (arg.rfind("--sizes=", 0) == 0)
+    {
+      if (!parse_sizes_arg(
+            arg.substr(std::string("--sizes=").size()), sizes_kb))
+      {
+        std::cerr << "ERROR: --sizes must be a comma-separated list of "
+                     "integers >= 1 (KiB)"
+                  << std::endl;
+        return 1;
+      }
+    }
+    else if (arg.rfind("--repeats=", 0) == 0)
+    {
+      if (!parse_int_arg(
+            arg.substr(std::string("--repeats=").size()), 1, repeats))
+      {
+        std::cerr << "ERROR: --repeats must be an integer >= 1" << std::endl;
+        return 1;
+      }
+      repeats_set = true;
+    }
+    else if (arg.rfind("--json=", 0) == 0)
+    {
+      json_path = arg.substr(std::string("--json=").size());
+    }
+    else if (arg == "--quick")
+    {
+      quick = true;
+    }
+    else if (arg == "--dump")
+    {
+      dump = true;
+    }
+    else if (arg == "--help")
+    {
+      std::cout << "Usage: trieste_parser_benchmark [--lang=<name>]"
+                << " [--sizes=<kib>[,<kib>...]] [--repeats=<n>] [--quick]"
+                << " [--json=<path>] [--dump]" << std::endl
+                << "Languages: json, yaml, infix, shrubbery" << std::endl;
+      return 0;
+    }
+    else
+    {
+      std::cerr << "ERROR: unknown argument " << arg << std::endl;
+      return 1;
+    }
+  }
+
+  if (quick)
+  {
+    sizes_kb = {16, 128};
+    if (!repeats_set)
+      repeats = QuickRepeats;
+  }
+
+  auto langs = languages();
+  if (
+    !focus_lang.empty() &&
+    std::none_of(langs.begin(), langs.end(), [&](auto& lang) {
+      return lang.name == focus_lang;
+    }))
+  {
+    std::cerr << "ERROR: unknown language " << focus_lang << std::endl;
+    return 1;
+  }
+
+  // Print the first corpus of each language, for inspecting the generators.
+  if (dump)
+  {
+    for (auto& lang : langs)
+    {
+      if (!focus_lang.empty() && lang.name != focus_lang)
+        continue;
+      Rand rand(CorpusSeed + sizes_kb.front());
+      std::cout << lang.generate(sizes_kb.front() * 1024, rand);
+    }
+    return 0;
+  }
+
+  std::cout << "BENCH seed=" << CorpusSeed << " repeats=" << repeats
+            << " sizes_kb=";
+  for (size_t i = 0; i < sizes_kb.size(); i++)
+    std::cout << (i ? "," : "") << sizes_kb[i];
+  std::cout << std::endl;
+
+  std::vector<CaseResult> results;
+  for (auto& lang : langs)
+  {
+    if (!focus_lang.empty() && lang.name != focus_lang)
+      continue;
+
+    for (auto size_kb : sizes_kb)
+    {
+      CaseResult result;
+      if (!run_case(lang, size_kb, repeats, result))
+        return 1;
+      print_case(result);
+      results.push_back(result);
+    }
+  }
+
+  if (!json_path.empty() && !write_json(json_path, results, repeats))
+    return 1;
+
+  return 0;
+}
@@ -0,0 +1,476 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+
+// Benchmark for the rewrite engine in PassDef. Each case builds a
+// deterministic synthetic tree of a given width and depth, then times one
+// pass made of a single rule shape (or all of them together) in one
+// traversal mode. Tree construction and cloning are not timed.
+//
+// Rule attempts and node allocations are only counted when the target is
+// built with TRIESTE_PASS_ENABLE_STATS and TRIESTE_AST_ENABLE_STATS, which the
+// CMake target does; otherwise they are reported as zero.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <trieste/trieste.h>
+#include <trieste/xoroshiro.h>
+#include <vector>
+
+namespace
+{
+  using namespace trieste;
+
+  using Rand = xoroshiro::p128r32;
+
+  inline const auto BenchRoot = TokenDef("bench-root");
+  inline const auto BenchGroup = TokenDef("bench-group");
+  inline const auto BenchWrap = TokenDef("bench-wrap");
+  inline const auto BenchA = TokenDef("bench-a");
+  inline const auto BenchB = TokenDef("bench-b");
+  inline const auto BenchC = TokenDef("bench-c");
+  inline const auto BenchD = TokenDef("bench-d");
+
+  using Rules = std::vector<detail::PatternEffect<Node>>;
+
+  // Every rule removes an A, turns a B into a D, removes or dissolves a group
+  // or moves a D out of a group, and no rule creates an A or a group, so every
+  // combination of them terminates.
+  struct RuleShape
+  {
+    std::string name;
+    std::function<Rules()> rules;
+  };
+
+  std::vector<RuleShape> rule_shapes()
+  {
+    return {
+      {"seq",
+       []() -> Rules {
+         return {
+           T(BenchA) * T(BenchB) >> [](Match&) -> Node { return BenchC; }};
+       }},
+      {"in",
+       []() -> Rules {
+         return {
+           In(BenchGroup) * T(BenchA) >>
+           [](Match&) -> Node { return BenchB; }};
+       }},
+      {"repeat",
+       []() -> Rules {
+         return {
+           T(BenchC)[BenchC] * (T(BenchD)++)[BenchD] * T(BenchA) >>
+           [](Match& _) { return BenchWrap << _(BenchC) << _[BenchD]; }};
+       }},
+      {"pred",
+       []() -> Rules {
+         return {
+           T(BenchB) * ++T(BenchC) >> [](Match&) -> Node { return BenchD; }};
+       }},
+      {"children",
+       []() -> Rules {
+         return {
+           T(BenchGroup)[BenchGroup] << (T(BenchA) * T(BenchB)) >>
+           [](Match& _) { return BenchWrap << *_[BenchGroup]; }};
+       }},
+      {"lift",
+       []() -> Rules {
+         return {
+           In(BenchGroup) * T(BenchD)[BenchD] >>
+           [](Match& _) { return Lift << BenchRoot << _(BenchD); }};
+       }},
+      // Adjacent rules that share a long prefix, as in the YAML reader, so
+      // the pass merges them into a rule tree.
+      {"prefix",
+       []() -> Rules {
+         return {
+           In(BenchRoot, BenchGroup) * T(BenchGroup)[BenchGroup]
+               << (T(BenchA) * T(BenchB) * End) >>
+             [](Match& _) { return Seq << *_[BenchGroup]; },
+           In(BenchRoot, BenchGroup) * T(BenchGroup)[BenchGroup]
+               << (T(BenchA) * T(BenchC) * End) >>
+             [](Match&) -> Node { return BenchC; },
+           In(BenchRoot, BenchGroup) * T(BenchGroup)[BenchGroup]
+               << (T(BenchA) * T(BenchD)) >>
+             [](Match& _) { return Seq << *_[BenchGroup]; },
+           In(BenchRoot, BenchGroup) * T(BenchGroup)[BenchGroup]
+               << (T(BenchA) * T(BenchA)) >>
+             [](Match&) -> Node { return BenchD; },
+           In(BenchRoot, BenchGroup) * T(BenchGroup)[BenchGroup]
+               << (T(BenchA) * End) >>
+             [](Match&) -> Node { return {}; },
+         };
+       }},
+    };
+  }
+
+  // All of the shapes in one pass, as a stand-in for a real pass with many
+  // rules competing for the same positions.
+  Rules all_rules(const std::vector<RuleShape>& shapes)
+  {
+    Rules rules;
+    for (auto& shape : shapes)
+    {
+      auto r = shape.rules();
+      rules.insert(rules.end(), r.begin(), r.end());
+    }
+    return rules;
+  }
+
+  struct Mode
+  {
+    std::string name;
+    dir::flag direction;
+  };
+
+  const std::vector<Mode> modes = {
+    {"topdown", dir::topdown},
+    {"bottomup", dir::bottomup},
+    {"once", dir::topdown | dir::once},
+    {"incremental", dir::topdown | dir::incremental},
+  };
+
+  struct Shape
+  {
+    size_t width;
+    size_t depth;
+  };
+
+  struct CaseResult
+  {
+    std::string rules;
+    std::string mode;
+    Shape shape;
+    size_t nodes;
+    double ns;
+    size_t iterations;
+    size_t changes;
+    size_t rule_attempts;
+    size_t tree_walks;
+    size_t rule_matches;
+    size_t allocations;
+  };
+
+  constexpr uint64_t TreeSeed = 0x7061737300000001;
+  constexpr int DefaultRepeats = 5;
+  constexpr int QuickRepeats = 1;
+
+  double median(std::vector<double> values)
+  {
+    if (values.empty())
+      return 0.0;
+
+    std::sort(values.begin(), values.end());
+    const size_t mid = values.size() / 2;
+    if ((values.size() % 2) == 1)
+      return values[mid];
+    return (values[mid - 1] + values[mid]) / 2.0;
+  }
+
+  bool parse_int_arg(const std::string& value, int min_value, int& out)
+  {
+    try
+    {
+      const int parsed = std::stoi(value);
+      if (parsed < min_value)
+        return false;
+      out = parsed;
+      return true;
+    }
+    catch (...)
+    {
+      return false;
+    }
+  }
+
+  // Each child of a group above the deepest level is itself a group half of
+  // the time, so the tree mixes leaves and subtrees at every level.
+  Node make_tree(Rand& rand, Node root, size_t width, size_t depth)
+  {
+    const Token leaves[] = {BenchA, BenchB, BenchC, BenchD};
+
+    for (size_t i = 0; i < width; i++)
+    {
+      if ((depth > 0) && ((rand() % 2) == 0))
+        root << make_tree(rand, BenchGroup, width, depth - 1);
+      else
+        root << NodeDef::create(leaves[rand() % 4]);
+    }
+
+    return root;
+  }
+
+  size_t count_nodes(Node ast)
+  {
+    size_t nodes = 0;
+    ast->traverse([&](Node&) {
+      nodes++;
+      return true;
+    });
+    return nodes;
+  }
+
+  double per_second(size_t count, double ns)
+  {
+    if (ns <= 0.0)
+      return 0.0;
+    return static_cast<double>(count) * 1e9 / ns;
+  }
+
+  CaseResult run_case(
+    const std::string& rules_name,
+    const Rules& rules,
+    const Mode& mode,
+    Shape shape,
+    int repeats)
+  {
+    Rand rand(TreeSeed + shape.width * 1000 + shape.depth);
+    auto input = make_tree(rand, BenchRoot, shape.width, shape.depth);
+
+    Pass pass = PassDef(mode.direction);
+    for (auto& rule : rules)
+      pass->rules(rule);
+
+    CaseResult result{
+      rules_name, mode.name, shape, count_nodes(input), 0, 0, 0, 0, 0, 0, 0};
+    std::vector<double> samples;
+
+    // The first run is an untimed warmup.
+    for (int r = 0; r <= repeats; r++)
+    {
+      auto ast = input->clone();
+      pass->reset_stats();
+      size_t allocations = NodeDef::allocations();
+
+      auto start = std::chrono::steady_clock::now();
+      auto [out, iterations, changes] = pass->run(ast);
+      auto end = std::chrono::steady_clock::now();
+
+      // Every run does the same work, so the counts of the last one stand
+      // for all of them.
+      result.iterations = iterations;
+      result.changes = changes;
+      result.rule_attempts = pass->stats().rule_attempts;
+      result.tree_walks = pass->stats().tree_walks;
+      result.rule_matches = pass->stats().rule_matches;
+      result.allocations = NodeDef::allocations() - allocations;
+
+      if (r > 0)
+        samples.push_back(static_cast<double>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count()));
+    }
+
+    result.ns = median(samples);
+    return result;
+  }
+
+  void print_case(const CaseResult& result)
+  {
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "BENCH rules=" << result.rules << " mode=" << result.mode
+              << " width=" << result.shape.width
+              << " depth=" << result.shape.depth << " nodes=" << result.nodes
+              << " median_us=" << result.ns / 1000.0
+              << " nodes_per_s=" << per_second(result.nodes, result.ns)
+              << " attempts=" << result.rule_attempts
+              << " attempts_per_s="
+              << per_second(result.rule_attempts, result.ns)
+              << " tree_walks=" << result.tree_walks
+              << " matches=" << result.rule_matches
+              << " allocations=" << result.allocations
+              << " iterations=" << result.iterations
+              << " changes=" << result.changes << std::endl;
+  }
+
+  bool write_json(
+    const std::string& path,
+    const std::vector<CaseResult>& results,
+    int repeats)
+  {
+    std::ofstream f(path, std::ios::binary | std::ios::out);
+    if (!f)
+    {
+      std::cerr << "ERROR: could not open " << path << " for writing"
+                << std::endl;
+      return false;
+    }
+
+    // Rule and mode names are plain identifiers, so nothing needs escaping.
+    f << std::fixed << std::setprecision(1);
+    f << "{\n  \"benchmark\": \"trieste_pass_benchmark\",\n"
+      << "  \"seed\": " << TreeSeed << ",\n  \"repeats\": " << repeats
+      << ",\n  \"cases\": [";
+    for (size_t c = 0; c < results.size(); c++)
+    {
+      auto& result = results[c];
+      f << (c ? "," : "") << "\n    {\"rules\": \"" << result.rules
+        << "\", \"mode\": \"" << result.mode
+        << "\", \"width\": " << result.shape.width
+        << ", \"depth\": " << result.shape.depth
+        << ", \"nodes\": " << result.nodes << ", \"median_ns\": " << result.ns
+        << ", \"nodes_per_s\": " << per_second(result.nodes, result.ns)
+        << ", \"rule_attempts\": " << result.rule_attempts
+        << ", \"attempts_per_s\": "
+        << per_second(result.rule_attempts, result.ns)
+        << ", \"tree_walks\": " << result.tree_walks
+        << ", \"rule_matches\": " << result.rule_matches
+        << ", \"allocations\": " << result.allocations
+        << ", \"iterations\": " << result.iterations
+        << ", \"changes\": " << result.changes << "}";
+    }
+    f << "\n  ]\n}\n";
+    return bool(f);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  std::vector<Shape> shapes = {{8, 6}, {64, 2}, {4, 12}};
+  int repeats = DefaultRepeats;
+  int width = 0;
+  int depth = -1;
+  std::string focus_rules;
+  std::string focus_mode;
+  std::string json_path;
+  bool quick = false;
+  bool repeats_set = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    if (arg.rfind("--rules=", 0) == 0)
+    {
+      focus_rules = arg.substr(std::string("--rules=").size());
+    }
+    else if (arg.rfind("--mode=", 0) == 0)
+    {
+      focus_mode = arg.substr(std::string("--mode=").size());
+    }
+    else if (arg.rfind("--width=", 0) == 0)
+    {
+      if (!parse_int_arg(arg.substr(std::string("--width=").size()), 1, width))
+      {
+        std::cerr << "ERROR: --width must be an integer >= 1" << std::endl;
+        return 1;
+      }
+    }
+    else if (arg.rfind("--depth=", 0) == 0)
+    {
+      if (!parse_int_arg(arg.substr(std::string("--depth=").size()), 0, depth))
+      {
+        std::cerr << "ERROR: --depth must be an integer >= 0" << std::endl;
+        return 1;
+      }
+    }
+    else if (arg.rfind("--repeats=", 0) == 0)
+    {
+      if (!parse_int_arg(
+            arg.substr(std::string("--repeats=").size()), 1, repeats))
+      {
+        std::cerr << "ERROR: --repeats must be an integer >= 1" << std::endl;
+        return 1;
+      }
+      repeats_set = true;
+    }
+    else if (arg.rfind("--json=", 0) == 0)
+    {
+      json_path = arg.substr(std::string("--json=").size());
+    }
+    else if (arg == "--quick")
+    {
+      quick = true;
+    }
+    else if (arg == "--help")
+    {
+      std::cout << "Usage: trieste_pass_benchmark [--rules=<name>]"
+                << " [--mode=<name>] [--width=<n>] [--depth=<n>]"
+                << " [--repeats=<n>] [--quick] [--json=<path>]" << std::endl
+                << "Rules: seq, in, repeat, pred, children, lift, prefix, all"
+                << std::endl
+                << "Modes: topdown, bottomup, once, incremental" << std::endl;
+      return 0;
+    }
+    else
+    {
+      std::cerr << "ERROR: unknown argument " << arg << std::endl;
+      return 1;
+    }
+  }
+
+  if (quick)
+  {
+    shapes = {{8, 4}, {32, 2}, {4, 8}};
+    if (!repeats_set)
+      repeats = QuickRepeats;
+  }
+
+  // An explicit width or depth replaces the default shapes with one tree.
+  if ((width > 0) || (depth >= 0))
+  {
+    shapes = {
+      {(width > 0) ? static_cast<size_t>(width) : 8,
+       (depth >= 0) ? static_cast<size_t>(depth) : 6}};
+  }
+
+  auto rule_sets = rule_shapes();
+  rule_sets.push_back({"all", [&]() { return all_rules(rule_shapes()); }});
+
+  if (
+    !focus_rules.empty() &&
+    std::none_of(rule_sets.begin(), rule_sets.end(), [&](auto& r) {
+      return r.name == focus_rules;
+    }))
+  {
+    std::cerr << "ERROR: unknown rules " << focus_rules << std::endl;
+    return 1;
+  }
+
+  if (
+    !focus_mode.empty() &&
+    std::none_of(modes.begin(), modes.end(), [&](auto& m) {
+      return m.name == focus_mode;
+    }))
+  {
+    std::cerr << "ERROR: unknown mode " << focus_mode << std::endl;
+    return 1;
+  }
+
+  std::cout << "BENCH seed=" << TreeSeed << " repeats=" << repeats
+            << " shapes=";
+  for (size_t i = 0; i < shapes.size(); i++)
+    std::cout << (i ? "," : "") << shapes[i].width << "x" << shapes[i].depth;
+  std::cout << std::endl;
+
+  std::vector<CaseResult> results;
+  for (auto& rule_set : rule_sets)
+  {
+    if (!focus_rules.empty() && rule_set.name != focus_rules)
+      continue;
+
+    auto rules = rule_set.rules();
+    for (auto& mode : modes)
+    {
+      if (!focus_mode.empty() && mode.name != focus_mode)
+        continue;
+
+      for (auto shape : shapes)
+      {
+        auto result = run_case(rule_set.name, rules, mode, shape, repeats);
+        print_case(result);
+        results.push_back(result);
+      }
+    }
+  }
+
+  if (!json_path.empty() && !write_json(json_path, results, repeats))
+    return 1;
+
+  return 0;
+}
@@ -0,0 +1,650 @@
+#include <deque>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <trieste/trieste.h>
+
+using namespace trieste;
+
+namespace
+{
+  inline const auto TestRoot = TokenDef("test-root");
+  inline const auto TestA = TokenDef("test-a");
+  inline const auto TestB = TokenDef("test-b");
+  inline const auto TestC = TokenDef("test-c");
+  inline const auto TestD = TokenDef("test-d");
+  inline const auto TestGroup = TokenDef("test-group");
+  inline const auto TestWrap = TokenDef("test-wrap");
+
+  size_t failures = 0;
+
+  // Every rule shrinks the tree or removes a TestD, so the pass always
+  // terminates. The rules cascade to the left of a replacement, reapply in
+  // place, delete nodes and depend on End and Not, so every restart path is
+  // exercised. The group rules look into and move subtrees, and the TestWrap
+  // rules depend on distant ancestors, so changes propagate between levels.
+  PassDef make_pass(dir::flag direction)
+  {
+    return {
+      "test",
+      wf::empty,
+      direction,
+      {
+        T(TestA) * T(TestB) >> [](Match&) -> Node { return TestC; },
+        T(TestC) * T(TestC) >> [](Match&) -> Node { return TestA; },
+        T(TestD) * T(TestA) >>
+          [](Match&) -> Node { return Reapply << TestB; },
+        T(TestB) * End >> [](Match&) -> Node { return {}; },
+        T(TestD) * T(TestD) * !T(TestC) >>
+          [](Match&) -> Node { return Seq << TestD << TestC; },
+        T(TestGroup) << End >> [](Match&) -> Node { return {}; },
+        T(TestGroup) << (T(TestC)[TestC] * End) >>
+          [](Match& _) { return _(TestC); },
+        In(TestGroup) * T(TestA) * T(TestGroup)[TestGroup] >>
+          [](Match& _) { return TestGroup << *_[TestGroup]; },
+        T(TestB) * T(TestB) * T(TestGroup)[TestGroup] >>
+          [](Match& _) { return TestWrap << _(TestGroup); },
+        In(TestWrap)++ * T(TestD) >> [](Match&) -> Node { return TestA; },
+      }};
+  }
+
+  Node make_tree(std::mt19937& rng, Node root, size_t size, size_t depth)
+  {
+    const Token tokens[] = {TestA, TestB, TestC, TestD};
+
+    for (size_t i = 0; i < size; i++)
+    {
+      if ((depth < 3) && ((rng() % 5) == 0))
+        root << make_tree(rng, TestGroup, rng() % 8, depth + 1);
+      else
+        root << NodeDef::create(tokens[rng() % 4]);
+    }
+
+    return root;
+  }
+
+  std::string to_string(Node node)
+  {
+    std::ostringstream out;
+    node->str(out);
+    return out.str();
+  }
+
+  void check_incremental(std::mt19937& rng, size_t size, dir::flag direction)
+  {
+    auto input = make_tree(rng, TestRoot, size, 0);
+    auto expected = input->clone();
+    auto actual = input->clone();
+
+    Pass full = make_pass(direction);
+    Pass incremental = make_pass(direction | dir::incremental);
+
+    auto [expected_node, expected_count, expected_changes] =
+      full->run(expected);
+    auto [actual_node, actual_count, actual_changes] =
+      incremental->run(actual);
+
+    if (
+      (to_string(expected_node) != to_string(actual_node)) ||
+      (expected_count != actual_count) ||
+      (expected_changes != actual_changes))
+    {
+      std::cout << "incremental mismatch on:" << std::endl
+                << to_string(input) << "expected (" << expected_changes
+                << " changes):" << std::endl
+                << to_string(expected_node) << "actual (" << actual_changes
+                << " changes):" << std::endl
+                << to_string(actual_node);
+      failures++;
+    }
+  }
+
+  void test_default_map()
+  {
+    std::cout << "  default_map" << std::endl;
+
+    // Use more tokens than a fixed-size table would hold, so that any
+    // aliasing of slots between tokens shows up.
+    static std::deque<std::string> names;
+    static std::deque<TokenDef> tokens;
+
+    for (size_t i = 0; i < 300; i++)
+    {
+      names.push_back("test-default-map-" + std::to_string(i));
+      tokens.emplace_back(names.back().c_str());
+    }
+
+    detail::DefaultMap<std::vector<size_t>> map;
+
+    for (size_t i = 0; i < tokens.size(); i += 2)
+      map.modify(tokens[i]).push_back(i);
+
+    map.modify_all([](std::vector<size_t>& v) { v.push_back(SIZE_MAX); });
+
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+      std::vector<size_t> expected;
+      if ((i % 2) == 0)
+        expected.push_back(i);
+      expected.push_back(SIZE_MAX);
+
+      if (map.get(tokens[i]) != expected)
+      {
+        std::cout << "default map mismatch for " << tokens[i].name
+                  << std::endl;
+        failures++;
+      }
+    }
+
+    // A token that was never modified, past the end of the table.
+    names.push_back("test-default-map-last");
+    tokens.emplace_back(names.back().c_str());
+
+    if (map.get(tokens.back()) != std::vector<size_t>{SIZE_MAX})
+    {
+      std::cout << "default map mismatch past the end of the table"
+                << std::endl;
+      failures++;
+    }
+  }
+
+  void test_incremental()
+  {
+    std::cout << "  incremental" << std::endl;
+    std::mt19937 rng(42);
+
+    for (size_t i = 0; i < 500; i++)
+    {
+      size_t size = 1 + (rng() % 64);
+      check_incremental(rng, size, dir::topdown);
+      check_incremental(rng, size, dir::bottomup);
+    }
+  }
+
+  PassDef make_profile_pass()
+  {
+    return {
+      "profile",
+      wf::empty,
+      dir::topdown | dir::once,
+      {
+        T(TestA) * T(TestB) >> [](Match&) -> Node { return TestC; },
+        T(TestD) >> [](Match&) -> Node { return NoChange; },
+        T(TestGroup) >> [](Match&) -> Node { return TestWrap; },
+      }};
+  }
+
+  void check_profile(
+    const std::string& what,
+    const RuleProfile& rule,
+    size_t attempts,
+    size_t matches,
+    size_t errors,
+    size_t no_change)
+  {
+    if (
+      (rule.attempts != attempts) || (rule.matches != matches) ||
+      (rule.errors != errors) || (rule.no_change != no_change))
+    {
+      std::cout << "profile mismatch for " << what << " at " << rule.location
+                << ": " << rule.attempts << " attempts, " << rule.matches
+                << " matches, " << rule.errors << " errors, "
+                << rule.no_change << " no change" << std::endl;
+      failures++;
+    }
+  }
+
+  void test_profile()
+  {
+    std::cout << "  profile" << std::endl;
+
+    // The first rule changes the tree, the second matches but makes no
+    // change, and the third matches a range that contains an error.
+    Pass pass = make_profile_pass();
+    pass->profile(true);
+
+    Node input = TestRoot;
+    input << TestA << TestB << TestD
+          << (TestGroup << (Error << (ErrorMsg ^ "error")));
+    pass->run(input);
+
+    auto& rules = pass->rule_profile();
+    if (rules.size() != 3)
+    {
+      std::cout << "profile has " << rules.size() << " rules" << std::endl;
+      failures++;
+      return;
+    }
+
+    check_profile("pass", rules[0], 1, 1, 0, 0);
+    check_profile("pass", rules[1], 1, 1, 0, 1);
+    check_profile("pass", rules[2], 1, 0, 1, 0);
+
+    for (size_t i = 0; i < rules.size(); i++)
+    {
+      if (
+        (rules[i].location.find("pass_test.cc") == std::string::npos) &&
+        (rules[i].location != ("rule " + std::to_string(i))))
+      {
+        std::cout << "profile has unexpected location " << rules[i].location
+                  << std::endl;
+        failures++;
+      }
+    }
+
+    // Process collects the counters of each pass and then restores the
+    // previous profiling state.
+    std::vector<Pass> passes = {make_profile_pass()};
+    Node ast = TestRoot;
+    ast << TestA << TestB << TestD;
+
+    auto result = Process(PassRange(passes, wf::empty, "start"))
+                    .set_check_well_formed(false)
+                    .set_profile(true)
+                    .set_pass_complete(
+                      [](Node&, std::string, size_t index, PassStatistics& s) {
+                        return (index == 0) || (s.rules.size() == 3);
+                      })
+                    .run(ast);
+
+    if (
+      !result.ok || (result.profile.size() != 1) ||
+      (result.profile[0].pass != "profile") || passes[0]->profile())
+    {
+      std::cout << "process did not report the profile" << std::endl;
+      failures++;
+      return;
+    }
+
+    check_profile("process", result.profile[0].rules[0], 1, 1, 0, 0);
+    check_profile("process", result.profile[0].rules[1], 1, 1, 0, 1);
+    check_profile("process", result.profile[0].rules[2], 0, 0, 0, 0);
+  }
+
+  // Runs of adjacent rules share prefixes, including captures, children
+  // patterns and optional steps, so they are merged into rule trees. Every
+  // rule shrinks the tree, except one that matches and makes no change.
+  PassDef make_prefix_pass(dir::flag direction)
+  {
+    return {
+      "prefix",
+      wf::empty,
+      direction,
+      {
+        T(TestA)[TestA] * T(TestB) * T(TestC) >>
+          [](Match& _) { return _(TestA); },
+        T(TestA)[TestA] * T(TestB) * T(TestD) >>
+          [](Match&) -> Node { return NoChange; },
+        T(TestA)[TestA] * T(TestB) * End >>
+          [](Match&) -> Node { return TestC; },
+        T(TestGroup) << (T(TestA) * T(TestB)[TestB] * End) >>
+          [](Match& _) { return _(TestB); },
+        T(TestGroup) << (T(TestA) * T(TestC)) >>
+          [](Match&) -> Node { return TestD; },
+        T(TestGroup) << End >> [](Match&) -> Node { return {}; },
+        T(TestD) * T(TestD) * T(TestB) >> [](Match&) -> Node { return TestA; },
+        T(TestD) * T(TestD) * ~T(TestC)[TestC] >>
+          [](Match& _) { return Seq << TestD << _[TestC]; },
+        T(TestC) * T(TestGroup) >> [](Match&) -> Node { return TestC; },
+        T(TestC) * T(TestC) >> [](Match&) -> Node { return TestC; },
+      }};
+  }
+
+  // Profiling always tries the rules one at a time, so compare against that.
+  void check_rule_tree(
+    const std::string& what, Pass tree, Pass sequential, Node input)
+  {
+    sequential->profile(true);
+
+    auto [expected_node, expected_count, expected_changes] =
+      sequential->run(input->clone());
+    auto [actual_node, actual_count, actual_changes] =
+      tree->run(input->clone());
+
+    if (
+      (to_string(expected_node) != to_string(actual_node)) ||
+      (expected_count != actual_count) ||
+      (expected_changes != actual_changes))
+    {
+      std::cout << what << " rule tree mismatch on:" << std::endl
+                << to_string(input) << "expected (" << expected_changes
+                << " changes):" << std::endl
+                << to_string(expected_node) << "actual (" << actual_changes
+                << " changes):" << std::endl
+                << to_string(actual_node);
+      failures++;
+    }
+  }
+
+  void test_rule_tree()
+  {
+    std::cout << "  rule_tree" << std::endl;
+
+    using detail::RuleTree;
+    auto a = RuleTree::flatten(T(TestA)[TestA] * T(TestB) * T(TestC));
+    auto b = RuleTree::flatten(T(TestA)[TestA] * T(TestB) * End);
+    auto c = RuleTree::flatten(T(TestA)[TestB] * T(TestB));
+    auto d = RuleTree::flatten(T(TestGroup) << (T(TestA) * End));
+    auto e = RuleTree::flatten(
+      T(TestA)([](auto&) { return true; }) * T(TestB));
+
+    if (
+      (a.size() != 3) || (d.size() != 6) || !RuleTree::shares_prefix(a, b) ||
+      RuleTree::shares_prefix(a, c) || RuleTree::shares_prefix(e, e))
+    {
+      std::cout << "rule tree steps are not shared as expected" << std::endl;
+      failures++;
+    }
+
+    // Each step is copied without its continuation, but sub-patterns keep
+    // theirs.
+    auto f = RuleTree::flatten(~(T(TestA) * T(TestB)) * T(TestC));
+    std::string key;
+
+    if (
+      (f.size() != 2) || !f[0].pattern->no_continuation() ||
+      !f[1].pattern->no_continuation() || !f[0].pattern->step_key(key) ||
+      (key != f[0].key))
+    {
+      std::cout << "rule tree steps are not copied as expected" << std::endl;
+      failures++;
+    }
+
+    std::mt19937 rng(42);
+    const dir::flag directions[] = {
+      dir::topdown,
+      dir::bottomup,
+      dir::topdown | dir::once,
+      dir::bottomup | dir::incremental,
+    };
+
+    for (size_t i = 0; i < 200; i++)
+    {
+      auto input = make_tree(rng, TestRoot, 1 + (rng() % 64), 0);
+
+      // Matches that include an error are discarded.
+      if ((rng() % 4) == 0)
+      {
+        input->insert(
+          input->begin() + (rng() % (input->size() + 1)),
+          TestGroup << (Error << (ErrorMsg ^ "error")));
+      }
+
+      for (auto direction : directions)
+      {
+        check_rule_tree(
+          "prefix",
+          make_prefix_pass(direction),
+          make_prefix_pass(direction),
+          input);
+        check_rule_tree(
+          "test", make_pass(direction), make_pass(direction), input);
+      }
+    }
+  }
+
+  // make_pass, with most patterns written as static patterns and some mixed
+  // with dynamic ones.
+  PassDef make_static_pass(dir::flag direction)
+  {
+    return {
+      "test",
+      wf::empty,
+      direction,
+      {
+        sp::T(TestA) * sp::T(TestB) >> [](Match&) -> Node { return TestC; },
+        sp::T(TestC) * T(TestC) >> [](Match&) -> Node { return TestA; },
+        T(TestD) * sp::T(TestA) >>
+          [](Match&) -> Node { return Reapply << TestB; },
+        sp::T(TestB) * sp::End >> [](Match&) -> Node { return {}; },
+        sp::T(TestD) * sp::T(TestD) * !sp::T(TestC) >>
+          [](Match&) -> Node { return Seq << TestD << TestC; },
+        sp::T(TestGroup) << sp::End >> [](Match&) -> Node { return {}; },
+        sp::T(TestGroup) << (sp::T(TestC)[TestC] * sp::End) >>
+          [](Match& _) { return _(TestC); },
+        sp::In(TestGroup) * sp::T(TestA) * sp::T(TestGroup)[TestGroup] >>
+          [](Match& _) { return TestGroup << *_[TestGroup]; },
+        sp::T(TestB) * T(TestB) * sp::T(TestGroup)[TestGroup] >>
+          [](Match& _) { return TestWrap << _(TestGroup); },
+        sp::In(TestWrap)++ * sp::T(TestD) >>
+          [](Match&) -> Node { return TestA; },
+      }};
+  }
+
+  // Rules that cover the remaining pattern forms, written with dynamic
+  // patterns. Every rule shrinks the tree.
+  PassDef make_forms_pass(dir::flag direction)
+  {
+    return {
+      "forms",
+      wf::empty,
+      direction,
+      {
+        T(TestA) * (T(TestB) / T(TestC))[TestB] * ++T(TestD) >>
+          [](Match& _) { return _(TestB); },
+        (T(TestC)[TestC] * T(TestA) / T(TestD)[TestC]) * T(TestC) *
+            --T(TestA) >>
+          [](Match& _) { return _(TestC); },
+        T(TestD) * ~T(TestB)[TestB] * T(TestD) >>
+          [](Match& _) { return Seq << TestC << _[TestB]; },
+        Start * (T(TestB)++)[TestB] * T(TestA) >>
+          [](Match& _) { return Seq << _[TestB]; },
+        T(TestGroup)(
+          [](auto& n) { return n.front()->size() > 2; })[TestGroup] >>
+          [](Match& _) { return Seq << *_[TestGroup]; },
+        Any * T(TestGroup) << (Any * End) >>
+          [](Match&) -> Node { return TestD; },
+      }};
+  }
+
+  PassDef make_static_forms_pass(dir::flag direction)
+  {
+    return {
+      "forms",
+      wf::empty,
+      direction,
+      {
+        sp::T(TestA) * (sp::T(TestB) / sp::T(TestC))[TestB] *
+            ++sp::T(TestD) >>
+          [](Match& _) { return _(TestB); },
+        (sp::T(TestC)[TestC] * sp::T(TestA) / sp::T(TestD)[TestC]) *
+            sp::T(TestC) * --sp::T(TestA) >>
+          [](Match& _) { return _(TestC); },
+        sp::T(TestD) * ~sp::T(TestB)[TestB] * sp::T(TestD) >>
+          [](Match& _) { return Seq << TestC << _[TestB]; },
+        sp::Start * (sp::T(TestB)++)[TestB] * sp::T(TestA) >>
+          [](Match& _) { return Seq << _[TestB]; },
+        sp::T(TestGroup)(
+          [](auto& n) { return n.front()->size() > 2; })[TestGroup] >>
+          [](Match& _) { return Seq << *_[TestGroup]; },
+        sp::Any * sp::T(TestGroup) << (sp::Any * sp::End) >>
+          [](Match&) -> Node { return TestD; },
+      }};
+  }
+
+  void check_static(
+    const std::string& what, Pass dynamic, Pass static_, Node input)
+  {
+    auto [expected_node, expected_count, expected_changes] =
+      dynamic->run(input->clone());
+    auto [actual_node, actual_count, actual_changes] =
+      static_->run(input->clone());
+
+    if (
+      (to_string(expected_node) != to_string(actual_node)) ||
+      (expected_count != actual_count) ||
+      (expected_changes != actual_changes))
+    {
+      std::cout << what << " static pattern mismatch on:" << std::endl
+                << to_string(input) << "expected (" << expected_changes
+                << " changes):" << std::endl
+                << to_string(expected_node) << "actual (" << actual_changes
+                << " changes):" << std::endl
+                << to_string(actual_node);
+      failures++;
+    }
+  }
+
+  void check_static_reify(const std::string& what, Pass dynamic, Pass static_)
+  {
+    auto expected = dynamic->reify_patterns();
+    auto actual = static_->reify_patterns();
+
+    for (size_t i = 0; i < expected.size(); i++)
+    {
+      if (to_string(expected[i]) != to_string(actual[i]))
+      {
+        std::cout << what << " static pattern " << i
+                  << " reifies differently:" << std::endl
+                  << to_string(expected[i]) << "actual:" << std::endl
+                  << to_string(actual[i]);
+        failures++;
+      }
+    }
+  }
+
+  void test_static_pattern()
+  {
+    std::cout << "  static_pattern" << std::endl;
+
+    static_assert(std::is_same_v<
+                  decltype(sp::T(TestA) * sp::T(TestB)[TestB]),
+                  sp::detail::Seq<
+                    sp::detail::Tokens<1>,
+                    sp::detail::Cap<sp::detail::Tokens<1>>>>);
+    static_assert(std::is_same_v<
+                  decltype(sp::T(TestA) / sp::T(TestB, TestC)),
+                  sp::detail::Tokens<3>>);
+    static_assert(std::is_same_v<
+                  decltype(sp::T(TestA) * T(TestB)),
+                  detail::Pattern>);
+
+    check_static_reify(
+      "test", make_pass(dir::topdown), make_static_pass(dir::topdown));
+    check_static_reify(
+      "forms",
+      make_forms_pass(dir::topdown),
+      make_static_forms_pass(dir::topdown));
+
+    auto regex = T(TestA, "a+") * T(TestB) / In(TestGroup, TestWrap);
+    auto static_regex =
+      sp::T(TestA, "a+") * sp::T(TestB) / sp::In(TestGroup, TestWrap);
+    auto expected = to_string(regex.reify());
+    auto actual = to_string(detail::Pattern(static_regex).reify());
+
+    if (expected != actual)
+    {
+      std::cout << "regex static pattern reifies differently:" << std::endl
+                << expected << "actual:" << std::endl
+                << actual;
+      failures++;
+    }
+
+    // The location of a static rule is where it was written.
+    Pass located = make_static_pass(dir::topdown);
+    located->profile(true);
+    auto location = located->rule_profile()[0].location;
+
+    if (
+      (location.find("pass_test") == std::string::npos) &&
+      (location != "rule 0"))
+    {
+      std::cout << "static rule has location " << location << std::endl;
+      failures++;
+    }
+
+    std::mt19937 rng(42);
+    const dir::flag directions[] = {
+      dir::topdown,
+      dir::bottomup,
+      dir::topdown | dir::once,
+      dir::bottomup | dir::incremental,
+    };
+
+    for (size_t i = 0; i < 200; i++)
+    {
+      auto input = make_tree(rng, TestRoot, 1 + (rng() % 64), 0);
+
+      for (auto direction : directions)
+      {
+        check_static(
+          "test", make_pass(direction), make_static_pass(direction), input);
+        check_static(
+          "forms",
+          make_forms_pass(direction),
+          make_static_forms_pass(direction),
+          input);
+      }
+    }
+  }
+
+  bool all_in_arena(Node node, NodeArena* arena)
+  {
+    bool ok = true;
+    node->traverse([&](Node& n) {
+      ok = ok && (n->arena() == arena);
+      return true;
+    });
+    return ok;
+  }
+
+  void test_arena()
+  {
+    std::cout << "  arena" << std::endl;
+    std::mt19937 rng(42);
+
+    for (size_t i = 0; i < 50; i++)
+    {
+      Node input;
+      NodeArena* arena = NodeArena::make();
+
+      {
+        NodeArena::Scope scope(arena);
+        input = make_tree(rng, TestRoot, 1 + (rng() % 64), 0);
+      }
+
+      // Rewrites and clones allocate from the arena of the tree, even outside
+      // of the scope that created it.
+      auto copy = input->clone();
+      Pass pass = make_pass(dir::topdown | dir::incremental);
+      auto [output, count, changes] = pass->run(input);
+
+      if (!all_in_arena(output, arena) || !all_in_arena(copy, arena))
+      {
+        std::cout << "arena: node allocated outside of the arena" << std::endl;
+        failures++;
+      }
+
+      // Without a scope, nodes come from the heap.
+      Node heap = TestRoot;
+      heap << TestA;
+
+      if (!all_in_arena(heap, nullptr))
+      {
+        std::cout << "arena: node allocated outside of the heap" << std::endl;
+        failures++;
+      }
+    }
+  }
+}
+
+int main()
+{
+  std::cout << "Running pass tests" << std::endl;
+
+  test_default_map();
+  test_incremental();
+  test_arena();
+  test_profile();
+  test_rule_tree();
+  test_static_pattern();
+
+  if (failures > 0)
+  {
+    std::cout << failures << " test(s) failed" << std::endl;
+    return 1;
+  }
+
+  std::cout << "All pass tests passed" << std::endl;
+  return 0;
+}
@@ -3,7 +3,9 @@
 
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <thread>
 #include <trieste/regex.h>
 #include <trieste/regex_engine.h>
 #include <vector>
@@ -1291,6 +1293,138 @@ namespace
     }
   }
 
+  void test_find_captures()
+  {
+    std::cout << "  find_captures" << std::endl;
+    using Span = std::pair<size_t, size_t>;
+
+    struct CaptureCase
+    {
+      std::string pattern;
+      std::string input;
+      size_t len;
+      bool found;
+      std::vector<Span> caps;
+    };
+
+    const size_t none = RegexEngine::npos;
+
+    // Captures of a match of exactly len bytes, which need not be the
+    // longest. Anchors and \b still see the input after len.
+    std::vector<CaptureCase> cases = {
+      {"(a+)(b*)", "aabbc", 4, true, {{0, 2}, {2, 4}}},
+      {"(a+)(b*)", "aabbc", 3, true, {{0, 2}, {2, 3}}},
+      {"(a+)(b*)", "aabbc", 2, true, {{0, 2}, {2, 2}}},
+      {"(a+)(b*)", "aabbc", 5, false, {}},
+      {"(a)|(b)", "b", 1, true, {{none, none}, {0, 1}}},
+      {"(a+)$", "aab", 2, false, {}},
+      {"(a+)$", "aa", 2, true, {{0, 2}}},
+      {"(a+)\\b", "aa b", 2, true, {{0, 2}}},
+      {"(a+)\\b", "aab", 2, false, {}},
+      {"a+", "aab", 1, true, {}},
+      {"a+", "b", 0, false, {}},
+    };
+
+    RegexEngine::MatchContext ctx;
+    for (auto& tc : cases)
+    {
+      RegexEngine re(tc.pattern);
+      std::vector<RegexEngine::Capture> caps;
+      bool found = re.find_captures(tc.input, tc.len, caps, ctx);
+      bool same = found == tc.found;
+      if (same && found)
+      {
+        same = caps.size() == tc.caps.size();
+        for (size_t i = 0; same && (i < caps.size()); i++)
+          same = (caps[i].start == tc.caps[i].first) &&
+            (caps[i].end == tc.caps[i].second);
+      }
+
+      if (!same)
+      {
+        std::cerr << "  FAIL: find_captures /" << tc.pattern << "/ on '"
+                  << tc.input << "' len " << tc.len << std::endl;
+        failures++;
+      }
+    }
+
+    // A long span keeps the capture frames bounded by compacting them.
+    {
+      RegexEngine re("(?:x(a|b))*");
+      std::string text;
+      for (size_t i = 0; i < 200000; i++)
+        text += (i % 3) ? "xa" : "xb";
+
+      std::vector<RegexEngine::Capture> caps;
+      size_t len = re.find_prefix(text, caps, ctx);
+      if (
+        (len != text.size()) || (caps.size() != 1) ||
+        (caps[0].start != text.size() - 1) || (caps[0].end != text.size()))
+      {
+        std::cerr << "  FAIL: find_prefix captures over a long span"
+                  << std::endl;
+        failures++;
+      }
+    }
+
+    // search reports the captures of find_prefix at the match, with or
+    // without a literal prefix.
+    {
+      RegexEngine digits("([0-9]+)-([a-z]+)");
+      RegexEngine prefixed("id([0-9]+)-([a-z]+)");
+      RegexEngine word("\\b(ab)");
+      std::vector<RegexEngine::Capture> caps;
+
+      auto r = digits.search("xx 12-ab yy", caps, ctx);
+      bool ok = r.found() && (r.match_start == 3) && (r.match_len == 5) &&
+        (caps.size() == 2) && (caps[0].start == 3) && (caps[0].end == 5) &&
+        (caps[1].start == 6) && (caps[1].end == 8);
+
+      r = prefixed.search("xx id12-ab yy", caps, ctx);
+      ok = ok && r.found() && (r.match_start == 3) && (caps.size() == 2) &&
+        (caps[0].start == 5) && (caps[1].end == 10);
+
+      r = word.search("cab ab", caps, ctx);
+      ok = ok && r.found() && (r.match_start == 4) && (caps.size() == 1) &&
+        (caps[0].start == 4) && (caps[0].end == 6);
+
+      if (!ok)
+      {
+        std::cerr << "  FAIL: search captures" << std::endl;
+        failures++;
+      }
+    }
+
+    // TRegexMatch only finds the captures it has room for.
+    {
+      trieste::TRegex re("([a-z]+)([0-9]+)");
+      auto source = trieste::SourceDef::synthetic(std::string("ab12 cd34"));
+
+      trieste::TRegexMatch none_wanted;
+      trieste::TRegexIterator it(source);
+      bool ok = it.consume(re, none_wanted) && (none_wanted.at(0).len == 4) &&
+        (none_wanted.at(1).len == 4);
+
+      trieste::TRegexMatch one_wanted(1);
+      trieste::TRegexIterator it1(source);
+      ok = ok && it1.consume(re, one_wanted) &&
+        (one_wanted.parse<std::string>(1) == "ab") &&
+        (one_wanted.at(2).len == 4);
+
+      trieste::TRegexMatch all_wanted(2);
+      trieste::TRegexIterator it2(source);
+      ok = ok && it2.consume(re, all_wanted) &&
+        (all_wanted.parse<std::string>(1) == "ab") &&
+        (all_wanted.parse<int>(2) == 12);
+
+      if (!ok)
+      {
+        std::cerr << "  FAIL: TRegexMatch capture limit" << std::endl;
+        failures++;
+      }
+    }
+  }
+
   void test_word_boundary()
   {
     std::cout << "  word boundary (\\b)" << std::endl;
@@ -1889,6 +2023,537 @@ namespace
     }
   }
 
+  void test_lazy_dfa()
+  {
+    std::cout << "  lazy dfa" << std::endl;
+
+    struct DfaCase
+    {
+      std::string pattern;
+      std::string input;
+      size_t expected;
+    };
+
+    const size_t none = RegexEngine::npos;
+    auto repeat = [](const std::string& s, size_t n) {
+      std::string out;
+      for (size_t i = 0; i < n; i++)
+        out += s;
+      return out;
+    };
+
+    // Patterns without anchors or \b that are too large for the bit NFA run
+    // on the lazy DFA from the second call on. Alternate between the engines
+    // on one context, as TRegexSet does, so each DFA is picked up again from
+    // the cache.
+    std::vector<DfaCase> cases = {
+      {"[a-z]{130}", std::string(131, 'a'), 130},
+      {"(?:ab|cd){70}", "ab" + repeat("cd", 68) + "!", none},
+      {"(?:ab|cd){70}", "ab" + repeat("cd", 69) + "!", 140},
+      {"[a-z_][a-z0-9_]*", "foo_1 = 2", 5},
+      {"[0-9]+(\\.[0-9]+)?", "3.14)", 4},
+      {"[0-9]+(\\.[0-9]+)?", "3.x", 1},
+      {"\"([^\"\\\\]|\\\\.)*\"", "\"a\\\"b\" c", 6},
+      {"(a|ab)(c|bcd)(d*)", "abcd", 4},
+      {"x*", "yyy", 0},
+      {"[é-ü]+a", "éüa!", 5},
+      {"é|e", "a", none},
+    };
+
+    std::vector<RegexEngine> engines;
+    for (auto& tc : cases)
+      engines.emplace_back(tc.pattern);
+
+    RegexEngine::MatchContext ctx;
+    for (size_t round = 0; round < 3; round++)
+    {
+      for (size_t i = 0; i < cases.size(); i++)
+      {
+        size_t got = engines[i].find_prefix(cases[i].input, ctx);
+        if (got != cases[i].expected)
+        {
+          std::cerr << "  FAIL: lazy dfa /" << cases[i].pattern << "/ on '"
+                    << cases[i].input << "' round " << round << " got "
+                    << got << std::endl;
+          failures++;
+        }
+      }
+    }
+
+    // More engines than a context caches DFAs for.
+    {
+      std::vector<RegexEngine> many;
+      for (size_t i = 0; i < 2 * MaxCachedDfas; i++)
+        many.emplace_back("a{" + std::to_string(i % 7 + 130) + "}b");
+
+      for (size_t round = 0; round < 2; round++)
+      {
+        for (size_t i = 0; i < many.size(); i++)
+        {
+          size_t n = i % 7 + 130;
+          std::string text = std::string(n, 'a') + "bb";
+          if (
+            (many[i].find_prefix(text, ctx) != n + 1) ||
+            (many[i].find_prefix("a" + text, ctx) != none))
+          {
+            std::cerr << "  FAIL: lazy dfa with many engines, a{" << n
+                      << "}b" << std::endl;
+            failures++;
+          }
+        }
+      }
+    }
+
+    // The DFA of this pattern has more states than the cache holds, so the
+    // cache resets until the context falls back to the NFA for it.
+    {
+      RegexEngine re("(a|b)*a(a|b){70}");
+      std::string text;
+      uint32_t bits = 12345;
+      for (size_t i = 0; i < 20000; i++)
+      {
+        bits = bits * 1103515245 + 12345;
+        text += ((bits >> 16) & 1) ? 'a' : 'b';
+      }
+
+      size_t expected = none;
+      for (size_t end = 71; end <= text.size(); end++)
+      {
+        if (text[end - 71] == 'a')
+          expected = end;
+      }
+
+      for (size_t round = 0; round < 3; round++)
+      {
+        if (re.find_prefix(text, ctx) != expected)
+        {
+          std::cerr << "  FAIL: lazy dfa thrash round " << round
+                    << std::endl;
+          failures++;
+        }
+      }
+    }
+  }
+
+  void test_bit_nfa()
+  {
+    std::cout << "  bit nfa" << std::endl;
+
+    // Small patterns without anchors or \b run on the bit-parallel NFA, in
+    // one word up to 64 states and in two up to 128. An unmatchable
+    // alternative of 130 states pushes the same pattern onto the lazy DFA,
+    // which serves as the reference.
+    std::vector<std::string> patterns = {
+      "[a-c_][a-c0-9_]*",
+      "(a|ab)(c|bcd)(d*)",
+      "a*b?c+",
+      "x*",
+      "(?:a|b)*a(?:a|b){3}",
+      "[é-ü]+a",
+      ".*é",
+      "[^a]+b",
+      "é|e",
+      "\\w+ \\d",
+      "[a-c]{70}",
+      "(?:a|b)*a(?:a|b){40}",
+      "(?:ab|c){30}|a+é",
+    };
+
+    const std::string runes[] = {"a", "b", "c", "d", "_", "1", " ", "é", "ü"};
+    std::vector<std::string> inputs = {"", "a", "é", "abcd", "ééa", "a 1"};
+    uint32_t bits = 4242;
+    for (size_t i = 0; i < 300; i++)
+    {
+      std::string text;
+      bits = bits * 1103515245 + 12345;
+      size_t len = (bits >> 16) % 100;
+      for (size_t j = 0; j < len; j++)
+      {
+        bits = bits * 1103515245 + 12345;
+        // Favour a and b so that the repetitions get long runs.
+        size_t k = (bits >> 16) % 12;
+        text += runes[k < 9 ? k : k % 2];
+      }
+      inputs.push_back(text);
+    }
+
+    RegexEngine::MatchContext ctx;
+    for (auto& pattern : patterns)
+    {
+      RegexEngine re(pattern);
+      RegexEngine ref(pattern + "|#{130}");
+      for (auto& input : inputs)
+      {
+        size_t got = re.find_prefix(input, ctx);
+        size_t expected = ref.find_prefix(input, ctx);
+        if (got != expected)
+        {
+          std::cerr << "  FAIL: bit nfa /" << pattern << "/ on '" << input
+                    << "' got " << got << " expected " << expected
+                    << std::endl;
+          failures++;
+        }
+      }
+    }
+  }
+
+  void test_ascii_runs()
+  {
+    std::cout << "  ascii runs" << std::endl;
+
+    // AsciiRun::scan against a byte-at-a-time loop, for sets of a few
+    // ranges (scanned with vector compares where available), their
+    // complements and sets of many ranges, on text with non-ASCII bytes.
+    uint32_t bits = 1717;
+    auto next = [&]() {
+      bits = bits * 1103515245 + 12345;
+      return bits >> 16;
+    };
+
+    for (size_t i = 0; i < 200; i++)
+    {
+      uint64_t set[2] = {0, 0};
+      size_t ranges = 1 + next() % 8;
+      for (size_t r = 0; r < ranges; r++)
+      {
+        size_t lo = next() % 128;
+        size_t hi = std::min<size_t>(127, lo + next() % 20);
+        for (size_t b = lo; b <= hi; b++)
+          set[b >> 6] |= uint64_t(1) << (b & 63);
+      }
+      if (i % 2)
+      {
+        set[0] = ~set[0];
+        set[1] = ~set[1];
+      }
+
+      std::vector<char> members;
+      for (size_t b = 0; b < 128; b++)
+      {
+        if ((set[b >> 6] >> (b & 63)) & 1)
+          members.push_back(static_cast<char>(b));
+      }
+      if (members.empty())
+        continue;
+
+      AsciiRun run(set);
+      std::string text;
+      size_t len = next() % 80;
+      for (size_t j = 0; j < len; j++)
+        text += members[next() % members.size()];
+      text += static_cast<char>(next() % 256);
+      text += members[0];
+
+      for (size_t pos = 0; pos <= text.size(); pos++)
+      {
+        size_t expected = pos;
+        while ((expected < text.size()) &&
+               run.contains(static_cast<unsigned char>(text[expected])))
+          expected++;
+
+        size_t got = run.scan(text, pos);
+        if (got != expected)
+        {
+          std::cerr << "  FAIL: ascii run " << i << " from " << pos << " got "
+                    << got << " expected " << expected << std::endl;
+          failures++;
+          break;
+        }
+      }
+    }
+
+    // Patterns that loop on a class skip runs of it on the bit-parallel NFA
+    // and on the lazy DFA. A leading ^ forces the plain NFA as a reference.
+    std::vector<std::string> patterns = {
+      "\"[^\"\\\\\\x00-\\x1F]*\"",
+      "\"(?:[^\"\\\\]|\\\\.)*\"",
+      "[ \r\n\t]+",
+      "[a-zA-Z_][a-zA-Z0-9_]*",
+      "[acegikmoqsuwy]+z",
+      "[^a]*a",
+      "(?:[a-c]+|x)y",
+      "[a-z]*[a-c]",
+      "a[^\n]*é",
+    };
+
+    const std::string runes[] = {
+      "a", "b", "c", "x", "y", "z", "_", " ", "\n", "\"", "\\", "é", "\x01"};
+    std::vector<std::string> inputs = {"", "\"\"", "\"abc\"", "a\n"};
+    for (size_t i = 0; i < 200; i++)
+    {
+      std::string text = (i % 3) ? "\"" : "";
+      size_t len = next() % 600;
+      for (size_t j = 0; j < len; j++)
+      {
+        // Mostly letters and spaces, so that runs get long.
+        size_t k = next() % 64;
+        text += runes[k < 13 ? k : k % 8];
+      }
+      inputs.push_back(text);
+    }
+
+    RegexEngine::MatchContext ctx;
+    for (auto& pattern : patterns)
+    {
+      RegexEngine bit(pattern);
+      RegexEngine dfa(pattern + "|#{130}");
+      RegexEngine ref("^(?:" + pattern + ")");
+      for (auto& input : inputs)
+      {
+        size_t expected = ref.find_prefix(input, ctx);
+        size_t got_bit = bit.find_prefix(input, ctx);
+        size_t got_dfa = dfa.find_prefix(input, ctx);
+        if ((got_bit != expected) || (got_dfa != expected))
+        {
+          std::cerr << "  FAIL: ascii runs /" << pattern << "/ got "
+                    << got_bit << " and " << got_dfa << " expected "
+                    << expected << std::endl;
+          failures++;
+        }
+      }
+    }
+  }
+
+  void test_large_patterns()
+  {
+    std::cout << "  large patterns" << std::endl;
+
+    // A long alternation, with and without conditionals.
+    std::vector<std::string> words;
+    std::string alternation;
+    for (int i = 0; i < 300; i++)
+    {
+      words.push_back("w" + std::to_string(i * 7919 % 100000));
+      alternation += (i > 0 ? "|" : "") + words.back();
+    }
+
+    RegexEngine plain(alternation);
+    RegexEngine bounded("\\b(?:" + alternation + ")\\b");
+    RegexEngine::MatchContext ctx;
+    for (auto& word : words)
+    {
+      if (
+        !plain.match(word, ctx) || !bounded.match(word, ctx) ||
+        bounded.match(word + "x", ctx) || plain.match(word + "x", ctx))
+      {
+        std::cerr << "  FAIL: alternation of " << words.size() << " for "
+                  << word << std::endl;
+        failures++;
+      }
+    }
+    if (plain.match("w", ctx) || plain.match("w1", ctx))
+    {
+      std::cerr << "  FAIL: alternation matched a prefix" << std::endl;
+      failures++;
+    }
+    std::vector<RegexEngine::Capture> captures;
+    auto found = bounded.search("say w7919 and w15838x", captures, ctx);
+    if ((found.match_start != 4) || (found.match_len != 5))
+    {
+      std::cerr << "  FAIL: alternation search got " << found.match_start
+                << std::endl;
+      failures++;
+    }
+
+    // Bracket expressions that mix categories with other ranges, against
+    // the same sets as an alternation.
+    std::vector<std::pair<std::string, std::string>> classes = {
+      {"[\\p{Lu}0-9_]", "\\p{Lu}|[0-9_]"},
+      {"[_\\p{Nd}a-f\\p{Ll}]", "_|\\p{Nd}|[a-f]|\\p{Ll}"},
+      {"[\\p{L}\\p{N}_]", "\\p{L}|\\p{N}|_"},
+      {"[z\\P{L}a]", "z|\\P{L}|a"},
+      {"[\\p{Sm}\\p{Sc}!-#]", "\\p{Sm}|\\p{Sc}|[!-#]"},
+    };
+    const std::vector<std::string> runes = {
+      "A", "z", "a", "g", "_", "5", "!", "$", "+", "€", "é", "É", "Ж", "ж",
+      "٣", "中", " ", "\t", "∑"};
+    for (auto& [bracket, reference] : classes)
+    {
+      RegexEngine re(bracket);
+      RegexEngine ref(reference);
+      RegexEngine negated("[^" + bracket.substr(1));
+      for (auto& rune : runes)
+      {
+        bool expected = ref.match(rune, ctx);
+        if ((re.match(rune, ctx) != expected) ||
+            (negated.match(rune, ctx) == expected))
+        {
+          std::cerr << "  FAIL: /" << bracket << "/ on " << rune
+                    << " expected " << expected << std::endl;
+          failures++;
+        }
+      }
+    }
+
+    // Counted repeats between anchors.
+    RegexEngine iban("^[A-Z]{2}[0-9]{2}[A-Z0-9]{3,8}$");
+    for (size_t len = 0; len < 12; len++)
+    {
+      std::string text = "GB12" + std::string(len, 'X');
+      bool expected = (len >= 3) && (len <= 8);
+      if (iban.match(text, ctx) != expected)
+      {
+        std::cerr << "  FAIL: counted repeat on " << text << std::endl;
+        failures++;
+      }
+    }
+  }
+
+  // Every rune against the table of each category, its complement and a
+  // class of scattered ranges, comparing with the ranges themselves.
+  void test_rune_tables()
+  {
+    std::cout << "  rune tables" << std::endl;
+
+    auto check = [](const std::string& name, const RuneClass& rc) {
+      if (!rc.table)
+      {
+        std::cerr << "  FAIL: " << name << " has no table" << std::endl;
+        failures++;
+        return;
+      }
+      size_t next = 0;
+      for (trieste::rune_t r = 128; r <= 0x10FFFF; r++)
+      {
+        while ((next < rc.ranges.size()) && (rc.ranges[next].second < r))
+          next++;
+        bool expected =
+          (next < rc.ranges.size()) && (rc.ranges[next].first <= r);
+        if (rc.contains(r) != expected)
+        {
+          std::cerr << "  FAIL: " << name << " on U+" << std::hex << r
+                    << std::dec << " expected " << expected << std::endl;
+          failures++;
+          return;
+        }
+      }
+      if (rc.contains(0x110000))
+      {
+        std::cerr << "  FAIL: " << name << " contains U+110000" << std::endl;
+        failures++;
+      }
+    };
+
+    for (std::string name :
+         {"Lu", "Ll", "Lt", "Lm", "Lo", "Mn", "Mc", "Me", "Nd", "Nl", "No",
+          "Pc", "Pd", "Ps", "Pe", "Pi", "Pf", "Po", "Sm", "Sc", "Sk", "So",
+          "Cc", "Cf", "Co", "Cs", "Zs", "Zl", "Zp", "L",  "M",  "N",  "P",
+          "S",  "Z",  "C"})
+    {
+      auto info = trieste::unicode::find_category(name);
+      RuneClass rc;
+      rc.ranges.assign(info.ranges, info.ranges + info.count);
+      rc.finalize();
+      if (rc.ranges.size() <= RuneClass::MaxSearchedRanges)
+        continue;
+      rc.build_table();
+      check(name, rc);
+
+      RuneClass negated = rc.complement();
+      negated.build_table();
+      check("^" + name, negated);
+    }
+
+    RuneClass scattered;
+    for (trieste::rune_t lo = 0x80; lo < 0x30000; lo += 0x1234)
+      scattered.add_range(lo, lo + (lo % 300));
+    scattered.add_range(0x10FF00, 0x10FFFF);
+    scattered.finalize();
+    scattered.build_table();
+    check("scattered", scattered);
+
+    // Through the engine, at the edges of pages.
+    RegexEngine letters("\\p{L}+");
+    RegexEngine others("\\P{L}+");
+    RegexEngine::MatchContext ctx;
+    for (auto& [text, letter] : std::vector<std::pair<std::string, bool>>{
+           {"\u00FF", true},
+           {"\u0100", true},
+           {"\u02FF", false},
+           {"\u0370", true},
+           {"\u4E00\u9FFF", true},
+           {"\U00020000", true},
+           {"\U000323AF", true},
+           {"\U000323B0", false},
+           {"\U0010FFFF", false}})
+    {
+      if (
+        (letters.match(text, ctx) != letter) ||
+        (others.match(text, ctx) == letter))
+      {
+        std::cerr << "  FAIL: \\p{L} table on " << text << std::endl;
+        failures++;
+      }
+    }
+  }
+
+  // match_batch and FullMatchBatch agree with match on every text.
+  void test_match_batch()
+  {
+    std::cout << "  match batch" << std::endl;
+
+    std::vector<std::string> store = {
+      "", "a", "abc", "abc123", "_x", "9lives", "key-name", "x y", "é", "ñandú",
+      "中文", "ab\xff", std::string(300, 'a'), std::string(299, 'a') + "!"};
+    uint64_t seed = 88172645463325252ull;
+    for (int i = 0; i < 2000; i++)
+    {
+      seed ^= seed << 13;
+      seed ^= seed >> 7;
+      seed ^= seed << 17;
+      // Half are only a and b, which take (a|b)*a(a|b){10} through more
+      // DFA states than fit, so that the DFA resets and then fails.
+      std::string text;
+      size_t letters = (i % 2) ? 2 : 8;
+      for (size_t n = seed % 40; n > 0; n--)
+        text += "ab-_1Zé"[(seed >> (n % 48)) % letters];
+      store.push_back(text);
+    }
+    std::vector<std::string_view> texts(store.begin(), store.end());
+
+    for (std::string pattern :
+         {"[A-Za-z_][A-Za-z0-9_]*",
+          "[a-z0-9]+(?:-[a-z0-9]+)*",
+          "^[a-z]+$",
+          "\\bab",
+          "abc",
+          "",
+          "a*",
+          "\\p{L}+",
+          "[^-]{3,12}",
+          "(a|b)*a(a|b){10}",
+          "(unclosed"})
+    {
+      RegexEngine re(pattern);
+      RegexEngine::MatchContext ctx;
+      std::unique_ptr<bool[]> matched(new bool[texts.size()]);
+      size_t count =
+        re.match_batch(texts.data(), texts.size(), matched.get(), ctx);
+      auto all =
+        trieste::TRegex::FullMatchBatch(texts, trieste::TRegex(pattern));
+
+      size_t expected_count = 0;
+      for (size_t i = 0; i < texts.size(); i++)
+      {
+        bool expected = re.match(texts[i]);
+        expected_count += expected;
+        if ((matched[i] != expected) || (all[i] != expected))
+        {
+          std::cerr << "  FAIL: match_batch /" << pattern << "/ on \""
+                    << texts[i] << "\" expected " << expected << std::endl;
+          failures++;
+          break;
+        }
+      }
+      if (count != expected_count)
+      {
+        std::cerr << "  FAIL: match_batch /" << pattern << "/ counted "
+                  << count << " expected " << expected_count << std::endl;
+        failures++;
+      }
+    }
+  }
+
   void test_constructor_api_compatibility()
   {
     std::cout << "  constructor API compatibility" << std::endl;
@@ -2687,6 +3352,208 @@ namespace
     }
   }
 
+  void test_unanchored_search()
+  {
+    using trieste::regex::RegexEngine;
+    std::cout << "  unanchored search" << std::endl;
+
+    struct SearchCase
+    {
+      std::string pattern;
+      std::string input;
+      size_t start;
+      size_t len;
+      std::vector<std::pair<size_t, size_t>> captures;
+    };
+
+    const size_t none = RegexEngine::npos;
+
+    // Leftmost wins over shorter-lived later attempts, and the longest match
+    // at the leftmost position wins over earlier, shorter ones.
+    std::vector<SearchCase> cases = {
+      {"a.*z|b", "abz", 0, 3, {}},
+      {"a.*z|b", "abx", 1, 1, {}},
+      {"b|a.*z", "xabzb", 1, 3, {}},
+      {"(a+)(b*)", "xxaab", 2, 3, {{2, 4}, {4, 5}}},
+      {"(a|ab)(c|bcd)", "xabcd", 1, 4, {{1, 2}, {2, 5}}},
+      {"(a*)b", "aaxaab", 3, 3, {{3, 5}}},
+      {"(x)?\\bc", "ax c", 3, 1, {{none, none}}},
+      {"(\\w+)\\s(\\w+)$", "a b c", 2, 3, {{2, 3}, {4, 5}}},
+      {"z", "abc", none, 0, {}},
+    };
+
+    for (auto& tc : cases)
+    {
+      RegexEngine re(tc.pattern);
+      RegexEngine::MatchContext ctx;
+      std::vector<RegexEngine::Capture> captures;
+      auto result = re.search(tc.input, captures, ctx);
+      bool ok = (result.match_start == tc.start) &&
+        (!result.found() || (result.match_len == tc.len)) &&
+        (captures.size() == tc.captures.size());
+
+      for (size_t i = 0; ok && (i < captures.size()); i++)
+        ok = (captures[i].start == tc.captures[i].first) &&
+          (captures[i].end == tc.captures[i].second);
+
+      if (!ok)
+      {
+        std::cerr << "  FAIL: search /" << tc.pattern << "/ in '" << tc.input
+                  << "' got start=" << result.match_start
+                  << " len=" << result.match_len << std::endl;
+        failures++;
+      }
+    }
+
+    // A failed search over a long input must stay linear. Probing each
+    // position separately would take quadratic time here.
+    {
+      std::string text(200000, 'a');
+      RegexEngine re("a[ab]*z");
+      if (re.search(text).found())
+      {
+        std::cerr << "  FAIL: search a[ab]*z in long input" << std::endl;
+        failures++;
+      }
+
+      RegexEngine capturing("(a)(a*)$");
+      RegexEngine::MatchContext ctx;
+      std::vector<RegexEngine::Capture> captures;
+      auto result = capturing.search(text, captures, ctx);
+      if (
+        !result.found() || (result.match_start != 0) ||
+        (result.match_len != text.size()) || (captures.size() != 2) ||
+        (captures[1].start != 1) || (captures[1].end != text.size()))
+      {
+        std::cerr << "  FAIL: search (a)(a*)$ in long input" << std::endl;
+        failures++;
+      }
+    }
+  }
+
+  void test_search_literals()
+  {
+    using trieste::regex::RegexEngine;
+    std::cout << "  search literals" << std::endl;
+
+    struct LiteralCase
+    {
+      std::string pattern;
+      std::string prefix;
+      std::string required;
+    };
+
+    std::vector<LiteralCase> cases = {
+      {"password=\\S+", "password=", "password="},
+      {"\"id\":\\s*\\d+", "\"id\":", "\"id\":"},
+      {"a(bc)d", "abcd", "abcd"},
+      {"\\d+px", "", "px"},
+      {"(a|b)cd", "", "cd"},
+      {"(abc)?d", "", "d"},
+      {"(x*|w)yz", "", "yz"},
+      {"ab|ac", "", ""},
+      {"\\bfoo", "", "foo"},
+      {"foo\\b", "foo", "foo"},
+      {"é+ab", "", "ab"},
+      {"ab?", "a", "a"},
+    };
+
+    for (auto& tc : cases)
+    {
+      RegexEngine re(tc.pattern);
+      if (
+        (re.literal_prefix() != tc.prefix) ||
+        (re.required_literal() != tc.required))
+      {
+        std::cerr << "  FAIL: /" << tc.pattern << "/ prefix '"
+                  << re.literal_prefix() << "' required '"
+                  << re.required_literal() << "'" << std::endl;
+        failures++;
+      }
+    }
+
+    struct SearchCase
+    {
+      std::string pattern;
+      std::string input;
+      size_t start;
+      size_t len;
+    };
+
+    const size_t none = RegexEngine::npos;
+
+    std::vector<SearchCase> searches = {
+      {"password=\\S+", "user=x password=hunter2 y", 7, 16},
+      {"password=\\S+", "password= password=x", 10, 10},
+      {"\\d+px", "width: 12px", 7, 4},
+      {"\\d+px", "width: 12em", none, 0},
+      {"foo\\b", "foobar foo", 7, 3},
+      {"=\\w", "a\xC3=b", 2, 2},
+      {"x=(\\d+)", "ax=x=7", 3, 3},
+      {"abc", "ababc", 2, 3},
+    };
+
+    for (auto& tc : searches)
+    {
+      RegexEngine re(tc.pattern);
+      auto result = re.search(tc.input);
+      if (
+        (result.match_start != tc.start) ||
+        (result.found() && (result.match_len != tc.len)))
+      {
+        std::cerr << "  FAIL: search /" << tc.pattern << "/ in '" << tc.input
+                  << "' got start=" << result.match_start
+                  << " len=" << result.match_len << std::endl;
+        failures++;
+      }
+    }
+
+    // Against find_prefix at each position in turn.
+    const char* patterns[] = {
+      "ab+c", "(a|b)ca", "b*cab", "[ab]ca?b", "a(b)c|bc", "c(ab)*"};
+    uint32_t seed = 7;
+    auto next = [&seed](uint32_t n) {
+      seed = seed * 1103515245 + 12345;
+      return (seed >> 16) % n;
+    };
+
+    for (auto pattern : patterns)
+    {
+      RegexEngine re(pattern);
+      RegexEngine::MatchContext ctx;
+      for (size_t i = 0; i < 200; i++)
+      {
+        std::string input;
+        size_t len = next(12);
+        for (size_t j = 0; j < len; j++)
+          input += "abc"[next(3)];
+
+        size_t start = none;
+        size_t match_len = 0;
+        for (size_t pos = 0; pos <= input.size(); pos++)
+        {
+          size_t n = re.find_prefix(std::string_view(input).substr(pos), ctx);
+          if (n != none)
+          {
+            start = pos;
+            match_len = n;
+            break;
+          }
+        }
+
+        auto result = re.search(input);
+        if (
+          (result.match_start != start) ||
+          (result.found() && (result.match_len != match_len)))
+        {
+          std::cerr << "  FAIL: search /" << pattern << "/ in '" << input
+                    << "'" << std::endl;
+          failures++;
+        }
+      }
+    }
+  }
+
   void test_utf8_search()
   {
     using trieste::TRegex;
@@ -3161,6 +4028,18 @@ namespace
                   << std::endl;
         failures++;
       }
+
+      // The combined automaton agrees with trying each regex in turn.
+      TRegexSet combined(regexes);
+      combined.combined(true);
+      TRegexMatch cm(4);
+      auto cidx = combined.match(cm, src->view(), src, 0);
+      if ((cidx != idx) || (idx && (cm.at(0).len != m.at(0).len)))
+      {
+        std::cerr << "  FAIL: " << label << " combined got "
+                  << (cidx ? std::to_string(*cidx) : "nullopt") << std::endl;
+        failures++;
+      }
     };
 
     // --- Basic tests ---
@@ -3331,6 +4210,232 @@ namespace
       1);
   }
 
+  void test_tregex_set_combined()
+  {
+    using trieste::TRegex;
+    using trieste::TRegexIterator;
+    using trieste::TRegexMatch;
+    using trieste::TRegexSet;
+    std::cout << "  TRegexSet combined" << std::endl;
+
+    // Rules with captures are rematched for their captures, and rules with
+    // anchors or \b are tried on their own, both keeping their priority.
+    TRegexSet set({
+      TRegex("[[:blank:]]+"),
+      TRegex("\\bif\\b"),
+      TRegex("([a-z]+)([0-9]*)"),
+      TRegex("[0-9]+"),
+      TRegex("."),
+    });
+    set.combined(true);
+
+    auto src = trieste::SourceDef::synthetic("if iff abc12 7é");
+    TRegexIterator it(src);
+    TRegexMatch m(4);
+
+    struct Token
+    {
+      int index;
+      std::string text;
+      std::string capture;
+    };
+
+    std::vector<Token> expected = {
+      {1, "if", ""},
+      {0, " ", ""},
+      {2, "iff", "iff"},
+      {0, " ", ""},
+      {2, "abc12", "abc"},
+      {0, " ", ""},
+      {3, "7", ""},
+      {4, "é", ""},
+    };
+
+    for (auto& token : expected)
+    {
+      auto idx = it.consume_first_match(m, set);
+      if (
+        (idx != token.index) || (m.at(0).view() != token.text) ||
+        (!token.capture.empty() && (m.at(1).view() != token.capture)))
+      {
+        std::cerr << "  FAIL: combined set expected '" << token.text
+                  << "' (" << token.index << ") got '" << m.at(0).view()
+                  << "' (" << idx.value_or(-1) << ")" << std::endl;
+        failures++;
+      }
+    }
+
+    if (!it.empty())
+    {
+      std::cerr << "  FAIL: combined set should be empty at end" << std::endl;
+      failures++;
+    }
+
+    // Random rule lists and inputs, against trying each regex in turn.
+    const char* atoms[] = {
+      "a", "b", "ab", ".", "[ab]", "[^a]", "\\w", "(a|ab)", "é", "(b)"};
+    const char* quants[] = {"", "", "*", "+", "?", "{2}"};
+    const char* chars[] = {"a", "b", "c", "é"};
+    uint32_t seed = 1;
+    auto next = [&seed](uint32_t n) {
+      seed = seed * 1103515245 + 12345;
+      return (seed >> 16) % n;
+    };
+
+    for (size_t round = 0; round < 200; round++)
+    {
+      std::vector<TRegex> regexes;
+      size_t count = 1 + next(6);
+      for (size_t i = 0; i < count; i++)
+      {
+        std::string pattern;
+        size_t atoms_count = 1 + next(3);
+        for (size_t j = 0; j < atoms_count; j++)
+          pattern += std::string(atoms[next(10)]) + quants[next(6)];
+        regexes.emplace_back(pattern);
+      }
+
+      TRegexSet plain(regexes.begin(), regexes.end());
+      TRegexSet combined(regexes.begin(), regexes.end());
+      combined.combined(true);
+      TRegexMatch pm(2);
+      TRegexMatch cm(2);
+
+      for (size_t i = 0; i < 20; i++)
+      {
+        std::string input;
+        size_t len = next(8);
+        for (size_t j = 0; j < len; j++)
+          input += chars[next(4)];
+
+        auto input_src = trieste::SourceDef::synthetic(input);
+        auto pidx = plain.match(pm, input_src->view(), input_src, 0);
+        auto cidx = combined.match(cm, input_src->view(), input_src, 0);
+
+        // Trying each regex in turn, without the dispatch table or trie.
+        std::optional<int> ridx;
+        size_t rlen = 0;
+        for (size_t r = 0; r < regexes.size(); r++)
+        {
+          TRegexMatch rm(2);
+          if (rm.try_match(regexes[r], input_src->view(), input_src, 0))
+          {
+            ridx = static_cast<int>(r);
+            rlen = rm.at(0).len;
+            break;
+          }
+        }
+
+        if (
+          (pidx != cidx) || (pidx != ridx) ||
+          (pidx && ((pm.at(0).len != cm.at(0).len) || (pm.at(0).len != rlen))))
+        {
+          std::cerr << "  FAIL: combined set differs on '" << input << "'"
+                    << std::endl;
+          failures++;
+        }
+      }
+    }
+  }
+
+  void test_literal_patterns()
+  {
+    using trieste::TRegex;
+    using trieste::TRegexMatch;
+    using trieste::TRegexSet;
+    std::cout << "  literal patterns" << std::endl;
+
+    struct LiteralCase
+    {
+      std::string pattern;
+      bool literal;
+      std::string text;
+    };
+
+    std::vector<LiteralCase> cases = {
+      {"abc", true, "abc"},
+      {"\\{", true, "{"},
+      {"a\\.b", true, "a.b"},
+      {"(?:true)", true, "true"},
+      {"", true, ""},
+      {"a|b", false, ""},
+      {"(ab)", false, ""},
+      {"ab*", false, ""},
+      {"[a]", false, ""},
+      {"\\d", false, ""},
+      {"\\bif", false, ""},
+      {"é", false, ""},
+      {"(", false, ""},
+    };
+
+    for (auto& tc : cases)
+    {
+      RegexEngine re(tc.pattern);
+      if (
+        (re.is_literal() != tc.literal) ||
+        (tc.literal && (re.literal() != tc.text)))
+      {
+        std::cerr << "  FAIL: /" << tc.pattern << "/ is_literal "
+                  << re.is_literal() << " '" << re.literal() << "'"
+                  << std::endl;
+        failures++;
+      }
+    }
+
+    RegexEngine re("true");
+    if (
+      (re.find_prefix("true,") != 4) ||
+      (re.find_prefix("tru") != RegexEngine::npos) ||
+      (re.find_prefix("trUe") != RegexEngine::npos))
+    {
+      std::cerr << "  FAIL: literal find_prefix" << std::endl;
+      failures++;
+    }
+
+    // Literals share a trie but keep the priority of their rule.
+    TRegexSet set({
+      TRegex("=="),
+      TRegex("[a-z]+"),
+      TRegex("="),
+      TRegex("if"),
+      TRegex("=>"),
+      TRegex("=="),
+      TRegex("i"),
+    });
+
+    struct SetCase
+    {
+      std::string input;
+      std::optional<int> index;
+      size_t len;
+    };
+
+    std::vector<SetCase> set_cases = {
+      {"==x", 0, 2},
+      {"=>", 2, 1},
+      {"=", 2, 1},
+      {"if", 1, 2},
+      {"!", std::nullopt, 0},
+    };
+
+    for (bool combined : {false, true})
+    {
+      set.combined(combined);
+      for (auto& tc : set_cases)
+      {
+        auto src = trieste::SourceDef::synthetic(tc.input);
+        TRegexMatch m(1);
+        auto idx = set.match(m, src->view(), src, 0);
+        if ((idx != tc.index) || (idx && (m.at(0).len != tc.len)))
+        {
+          std::cerr << "  FAIL: literal set on '" << tc.input << "' got "
+                    << idx.value_or(-1) << std::endl;
+          failures++;
+        }
+      }
+    }
+  }
+
   void test_first_char_info()
   {
     using trieste::TRegex;
@@ -3546,6 +4651,297 @@ namespace
       }
     }
   }
+
+  void test_serialize()
+  {
+    std::cout << "  serialize" << std::endl;
+
+    struct Program
+    {
+      std::string pattern;
+      RegexEngine::SyntaxMode mode;
+    };
+
+    const auto extended = RegexEngine::SyntaxMode::Extended;
+    std::vector<Program> programs = {
+      {"[_[:alpha:]][_[:alnum:]]*", extended},
+      {"([0-9]+)(?:\\.([0-9]+))?", extended},
+      {"\\bif\\b|^#|;$", extended},
+      {"\"(?:[^\"\\\\]|\\\\.)*?\"", extended},
+      {"[é-ü]+\\p{Lu}", extended},
+      {"while", extended},
+      {"(a|b)*a(a|b){70}", extended},
+      {"", extended},
+      {"(", extended},
+      {"a{2,3}[b-d]", RegexEngine::SyntaxMode::IregexpStrict},
+    };
+
+    const std::vector<std::string> inputs = {
+      "",
+      "foo_1 bar",
+      "12.5x",
+      "if (x)",
+      "#define",
+      "a;",
+      "\"a\\\"b\" c",
+      "éüÉ!",
+      "while(1)",
+      std::string(80, 'a'),
+      "abcd",
+    };
+
+    for (auto& program : programs)
+    {
+      RegexEngine re(program.pattern, program.mode);
+      std::string bytes = re.serialize();
+      auto loaded = RegexEngine::deserialize(bytes);
+      if (!loaded)
+      {
+        std::cerr << "  FAIL: deserialize /" << program.pattern << "/"
+                  << std::endl;
+        failures++;
+        continue;
+      }
+
+      auto info = re.first_char_info();
+      auto loaded_info = loaded->first_char_info();
+      bool same = (loaded->serialize() == bytes) &&
+        (loaded->ok() == re.ok()) &&
+        (loaded->error_code() == re.error_code()) &&
+        (loaded->syntax_mode() == re.syntax_mode()) &&
+        (loaded->num_captures() == re.num_captures()) &&
+        (loaded->is_literal() == re.is_literal()) &&
+        (loaded->literal_prefix() == re.literal_prefix()) &&
+        (std::memcmp(&info.bitmap, &loaded_info.bitmap, sizeof(info.bitmap)) ==
+         0) &&
+        (info.can_match_empty == loaded_info.can_match_empty);
+
+      RegexEngine::MatchContext ctx;
+      for (auto& input : inputs)
+      {
+        std::vector<RegexEngine::Capture> caps, loaded_caps;
+        same = same &&
+          (re.find_prefix(input, caps, ctx) ==
+           loaded->find_prefix(input, loaded_caps, ctx)) &&
+          (caps.size() == loaded_caps.size());
+        for (size_t i = 0; same && (i < caps.size()); i++)
+          same = (caps[i].start == loaded_caps[i].start) &&
+            (caps[i].end == loaded_caps[i].end);
+
+        auto found = re.search(input);
+        auto loaded_found = loaded->search(input);
+        same = same && (re.match(input) == loaded->match(input)) &&
+          (found.match_start == loaded_found.match_start) &&
+          (found.match_len == loaded_found.match_len);
+      }
+
+      if (!same)
+      {
+        std::cerr << "  FAIL: serialize round trip /" << program.pattern << "/"
+                  << std::endl;
+        failures++;
+      }
+    }
+
+    // Damaged programs are rejected, or at least load as a consistent
+    // engine.
+    std::string bytes = RegexEngine("([a-z]+)\\b|\\d{2}").serialize();
+    bool rejected = !RegexEngine::deserialize("").has_value() &&
+      RegexEngine::deserialize(
+        bytes, "([a-z]+)\\b|\\d{2}", RegexEngine::SyntaxMode::Extended) &&
+      !RegexEngine::deserialize(
+        bytes, "([a-z]+)\\b|\\d{3}", RegexEngine::SyntaxMode::Extended) &&
+      !RegexEngine::deserialize(
+        bytes,
+        "([a-z]+)\\b|\\d{2}",
+        RegexEngine::SyntaxMode::IregexpStrict) &&
+      !RegexEngine::deserialize("TRXP").has_value() &&
+      !RegexEngine::deserialize(bytes + "x").has_value();
+    for (size_t len = 0; len < bytes.size(); len++)
+      rejected = rejected &&
+        !RegexEngine::deserialize(std::string_view(bytes).substr(0, len));
+    if (!rejected)
+    {
+      std::cerr << "  FAIL: deserialize accepted a damaged program"
+                << std::endl;
+      failures++;
+    }
+
+    for (size_t i = 0; i < bytes.size(); i++)
+    {
+      for (uint8_t flip : {0x01, 0x40, 0x80})
+      {
+        std::string damaged = bytes;
+        damaged[i] = static_cast<char>(damaged[i] ^ flip);
+        auto loaded = RegexEngine::deserialize(damaged);
+        if (!loaded)
+          continue;
+
+        std::vector<RegexEngine::Capture> caps;
+        for (auto& input : inputs)
+        {
+          (void)loaded->find_prefix(input, caps);
+          (void)loaded->search(input);
+        }
+      }
+    }
+
+    // A TRegex can be loaded from a program rather than compiled.
+    {
+      trieste::TRegex re(
+        "([a-z]+)=([0-9]+)", RegexEngine("([a-z]+)=([0-9]+)").serialize());
+      trieste::TRegex fallback("([a-z]+)=([0-9]+)", "not a program");
+      // A program from before the pattern was edited is not used.
+      trieste::TRegex stale(
+        "([a-z]+)=([0-9]+)", RegexEngine("([a-z]+)").serialize());
+      std::string key;
+      int value = 0;
+      if (
+        !trieste::TRegex::FullMatch("x=42", re, &key, &value) ||
+        (key != "x") || (value != 42) ||
+        !trieste::TRegex::FullMatch("y=7", fallback, &key, &value) ||
+        !trieste::TRegex::FullMatch("z=9", stale, &key, &value) ||
+        (key != "z") || (value != 9) ||
+        (re.NumberOfCapturingGroups() != 2) ||
+        (stale.NumberOfCapturingGroups() != 2))
+      {
+        std::cerr << "  FAIL: TRegex from a program" << std::endl;
+        failures++;
+      }
+    }
+  }
+
+  void test_regex_cache()
+  {
+    using trieste::regex::RegexCache;
+    std::cout << "  regex cache" << std::endl;
+
+    // Off until it has a capacity: every lookup compiles.
+    {
+      RegexCache cache;
+      auto a = cache.get("a+");
+      auto b = cache.get("a+");
+      auto stats = cache.stats();
+      if ((a == b) || !a->ok() || (stats.hits != 0) || (stats.entries != 0))
+      {
+        std::cerr << "  FAIL: regex cache without capacity" << std::endl;
+        failures++;
+      }
+    }
+
+    // Shared by pattern and syntax mode.
+    {
+      RegexCache cache;
+      cache.set_capacity(1 << 20);
+      auto a = cache.get("a+");
+      auto b = cache.get("a+");
+      auto strict = cache.get("a+", RegexEngine::SyntaxMode::IregexpStrict);
+      auto bad = cache.get("(");
+      auto bad_again = cache.get("(");
+      auto stats = cache.stats();
+      if (
+        (a != b) || (a == strict) ||
+        (strict->syntax_mode() != RegexEngine::SyntaxMode::IregexpStrict) ||
+        (bad != bad_again) || bad->ok() || (stats.hits != 2) ||
+        (stats.misses != 3) || (stats.entries != 3) ||
+        (stats.bytes < a->memory_usage()))
+      {
+        std::cerr << "  FAIL: regex cache sharing" << std::endl;
+        failures++;
+      }
+
+      cache.clear();
+      stats = cache.stats();
+      if (
+        (cache.get("a+") == a) || (stats.entries != 0) || (stats.hits != 0))
+      {
+        std::cerr << "  FAIL: regex cache clear" << std::endl;
+        failures++;
+      }
+    }
+
+    // The least recently used engines make way for new ones, and an engine
+    // larger than the whole budget isn't cached.
+    {
+      RegexCache cache;
+      size_t one = RegexEngine("[a-z]+0").memory_usage() + 64;
+      cache.set_capacity(2 * one);
+      auto a = cache.get("[a-z]+0");
+      auto b = cache.get("[a-z]+1");
+      (void)cache.get("[a-z]+0");
+      auto c = cache.get("[a-z]+2");
+      auto stats = cache.stats();
+      bool ok = (stats.entries == 2) && (stats.evictions == 1) &&
+        (stats.bytes <= cache.capacity()) && (cache.get("[a-z]+0") == a) &&
+        (cache.get("[a-z]+2") == c) && (cache.get("[a-z]+1") != b) &&
+        b->ok();
+
+      auto big = cache.get("[a-z]{500}");
+      ok = ok && big->ok() && (cache.get("[a-z]{500}") != big);
+
+      cache.set_capacity(0);
+      stats = cache.stats();
+      ok = ok && (stats.entries == 0) && (stats.bytes == 0);
+      if (!ok)
+      {
+        std::cerr << "  FAIL: regex cache eviction" << std::endl;
+        failures++;
+      }
+    }
+
+    // Threads looking up the same patterns all get the same engines.
+    {
+      RegexCache cache;
+      cache.set_capacity(1 << 24);
+      const size_t patterns = 50;
+      std::vector<std::vector<const RegexEngine*>> seen(4);
+      std::vector<std::thread> threads;
+      for (size_t t = 0; t < seen.size(); t++)
+      {
+        threads.emplace_back([&, t]() {
+          for (size_t round = 0; round < 3; round++)
+          {
+            for (size_t i = 0; i < patterns; i++)
+            {
+              auto engine = cache.get("x{" + std::to_string(i + 1) + "}");
+              if (round == 2)
+                seen[t].push_back(engine.get());
+            }
+          }
+        });
+      }
+      for (auto& thread : threads)
+        thread.join();
+
+      auto stats = cache.stats();
+      bool ok = (stats.entries == patterns) &&
+        (stats.hits + stats.misses == 3 * patterns * seen.size());
+      for (size_t t = 1; t < seen.size(); t++)
+        ok = ok && (seen[t] == seen[0]);
+      if (!ok)
+      {
+        std::cerr << "  FAIL: regex cache across threads" << std::endl;
+        failures++;
+      }
+    }
+
+    // TRegex compiles through the global cache.
+    {
+      auto& cache = RegexCache::global();
+      cache.set_capacity(1 << 20);
+      size_t hits = cache.stats().hits;
+      trieste::TRegex a("cached[0-9]+");
+      trieste::TRegex b("cached[0-9]+");
+      bool ok = (cache.stats().hits == hits + 1) &&
+        trieste::TRegex::FullMatch("cached42", b);
+      cache.set_capacity(0);
+      if (!ok)
+      {
+        std::cerr << "  FAIL: TRegex through the regex cache" << std::endl;
+        failures++;
+      }
+    }
+  }
 }
 
 int main()
@@ -3574,6 +4970,7 @@ int main()
   test_real_world_parser_patterns();
   test_find_prefix();
   test_capturing_groups();
+  test_find_captures();
   test_word_boundary();
   test_lazy_quantifiers();
   test_start_anchor();
@@ -3582,6 +4979,12 @@ int main()
   test_syntax_mode_differential();
   test_strict_error_codes();
   test_match_context_reuse_across_engines();
+  test_lazy_dfa();
+  test_bit_nfa();
+  test_ascii_runs();
+  test_large_patterns();
+  test_rune_tables();
+  test_match_batch();
   test_constructor_api_compatibility();
   test_arg_parse();
   test_variadic_fullmatch();
@@ -3591,11 +4994,17 @@ int main()
   test_global_replace_string_view_pattern();
   test_unmatched_capture_reset();
   test_word_boundary_search();
+  test_unanchored_search();
+  test_search_literals();
   test_utf8_search();
   test_find_first_match();
   test_consume_first_match();
   test_tregex_set();
+  test_tregex_set_combined();
+  test_literal_patterns();
   test_first_char_info();
+  test_regex_cache();
+  test_serialize();
 
   if (failures > 0)
   {
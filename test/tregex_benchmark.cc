@@ -19,6 +19,7 @@ namespace
   using trieste::TRegex;
   using trieste::TRegexIterator;
   using trieste::TRegexMatch;
+  using trieste::TRegexSet;
 
   struct BenchmarkCase
   {
@@ -106,6 +107,146 @@ namespace
     return tokens;
   }
 
+  // Identifiers and words in several scripts, where matching goes through
+  // the tables of Unicode categories rather than ASCII bitmaps.
+  size_t run_unicode_text_once(volatile uint64_t& sink)
+  {
+    static const std::vector<TRegex> rules = {
+      TRegex("\\s+"),
+      TRegex("[\\p{L}_][\\p{L}\\p{N}_]*"),
+      TRegex("\\p{N}+"),
+      TRegex("\\p{P}+")};
+
+    static const std::string input = []() {
+      std::string s;
+      s.reserve(16384);
+      for (int i = 0; i < 150; i++)
+      {
+        s += "Größe_";
+        s += std::to_string(i);
+        s += " = значение; 名前 «Ελληνικά» قيمة ";
+        s += (i % 2) ? "日本語テキスト, " : "Ação!\n";
+      }
+      return s;
+    }();
+
+    Source src = SourceDef::synthetic(input, "bench");
+    TRegexIterator it(src);
+    TRegexMatch m(1);
+
+    size_t tokens = 0;
+    while (!it.empty())
+    {
+      bool matched = false;
+      for (const auto& rule : rules)
+      {
+        if (it.consume(rule, m))
+        {
+          matched = true;
+          tokens++;
+          break;
+        }
+      }
+
+      if (!matched)
+        it.skip();
+    }
+
+    sink += static_cast<uint64_t>(tokens);
+    return tokens;
+  }
+
+  // A JSON lexer mode, where most rules are literals.
+  TRegexSet json_lexer_rules(bool combined)
+  {
+    TRegexSet set({
+      TRegex("[ \r\n\t]+"),
+      TRegex(":"),
+      TRegex(","),
+      TRegex("\\{"),
+      TRegex("\\}"),
+      TRegex("\\["),
+      TRegex("\\]"),
+      TRegex("true"),
+      TRegex("false"),
+      TRegex("null"),
+      TRegex("-?(?:0|[1-9][0-9]*)(?:\\.[0-9]+)?(?:[eE][-+]?[0-9]+)?"),
+      TRegex("\"(?:[^\"\\\\]+|\\\\.)*\""),
+      TRegex("."),
+    });
+    set.combined(combined);
+    return set;
+  }
+
+  size_t lex_json(
+    const TRegexSet& rules, const std::string& input, volatile uint64_t& sink)
+  {
+    Source src = SourceDef::synthetic(input, "bench");
+    TRegexIterator it(src);
+    TRegexMatch m(1);
+
+    size_t tokens = 0;
+    while (!it.empty())
+    {
+      if (it.consume_first_match(m, rules))
+        tokens++;
+      else
+        it.skip();
+    }
+
+    sink += static_cast<uint64_t>(tokens);
+    return tokens;
+  }
+
+  size_t run_json_lexer_once(const TRegexSet& rules, volatile uint64_t& sink)
+  {
+    static const std::string input = []() {
+      std::string s = "[";
+      s.reserve(16384);
+      for (int i = 0; i < 200; i++)
+      {
+        if (i > 0)
+          s += ", ";
+        s += "{\"id\": ";
+        s += std::to_string(i);
+        s += ", \"ok\": true, \"tags\": [null, false, \"t";
+        s += std::to_string(i % 7);
+        s += "\"]}";
+      }
+      s += "]";
+      return s;
+    }();
+
+    return lex_json(rules, input, sink);
+  }
+
+  // Indented JSON with long string values, where most bytes are in runs of
+  // whitespace or string characters.
+  size_t run_json_text_once(const TRegexSet& rules, volatile uint64_t& sink)
+  {
+    static const std::string input = []() {
+      std::string s = "[\n";
+      s.reserve(65536);
+      for (int i = 0; i < 100; i++)
+      {
+        if (i > 0)
+          s += ",\n";
+        s += "        {\n            \"id\": ";
+        s += std::to_string(i);
+        s += ",\n            \"text\": \"";
+        for (int j = 0; j < 4; j++)
+          s += "The quick brown fox jumps over the lazy dog, again. ";
+        s += "\\n\",\n            \"path\": \"/usr/share/doc/item_";
+        s += std::to_string(i);
+        s += "/README.md\"\n        }";
+      }
+      s += "\n]\n";
+      return s;
+    }();
+
+    return lex_json(rules, input, sink);
+  }
+
   size_t run_fullmatch_once(volatile uint64_t& sink)
   {
     static const TRegex re(
@@ -145,6 +286,61 @@ namespace
     return matches;
   }
 
+  // Validating many short keys against one pattern, one call at a time or
+  // as a batch.
+  const std::vector<std::string_view>& key_texts()
+  {
+    static const std::vector<std::string> store = []() {
+      std::vector<std::string> keys;
+      for (int i = 0; i < 1000; i++)
+      {
+        std::string key = (i % 3) ? "config" : "Service";
+        key += (i % 5) ? "." : "_";
+        key += "item_" + std::to_string(i * 7919 % 100000);
+        if (i % 7 == 0)
+          key += ".enabled";
+        if (i % 11 == 0)
+          key += "-bad";
+        keys.push_back(key);
+      }
+      return keys;
+    }();
+    static const std::vector<std::string_view> views(
+      store.begin(), store.end());
+    return views;
+  }
+
+  const TRegex& key_regex()
+  {
+    static const TRegex re(
+      "[A-Za-z][A-Za-z0-9_]{0,30}(?:\\.[A-Za-z][A-Za-z0-9_]{0,30}){0,3}");
+    return re;
+  }
+
+  size_t run_fullmatch_keys_once(volatile uint64_t& sink)
+  {
+    size_t matches = 0;
+    for (auto key : key_texts())
+    {
+      if (TRegex::FullMatch(key, key_regex()))
+        matches++;
+    }
+
+    sink += static_cast<uint64_t>(matches);
+    return matches;
+  }
+
+  size_t run_fullmatch_keys_batch_once(volatile uint64_t& sink)
+  {
+    static bool matched[1000];
+    auto& keys = key_texts();
+    size_t matches =
+      TRegex::FullMatchBatch(keys.data(), keys.size(), key_regex(), matched);
+
+    sink += static_cast<uint64_t>(matches);
+    return matches;
+  }
+
   size_t run_partialmatch_nocapture_once(volatile uint64_t& sink)
   {
     static const TRegex re("[[:digit:]]+");
@@ -217,23 +413,216 @@ namespace
     return static_cast<size_t>(replaced);
   }
 
+  // Redacting secrets from a log where they are rare.
+  size_t run_redact_once(volatile uint64_t& sink)
+  {
+    static const std::string base = []() {
+      std::string s;
+      s.reserve(65536);
+      for (int i = 0; i < 1000; i++)
+      {
+        s += "2024-01-01T00:00:00Z INFO request ";
+        s += std::to_string(i);
+        s += " handled in 12ms\n";
+        if (i % 250 == 0)
+          s += "login user=bob password=hunter2\n";
+      }
+      return s;
+    }();
+
+    std::string text = base;
+    int replaced = TRegex::GlobalReplace(&text, "password=\\S+", "password=*");
+    replaced += TRegex::GlobalReplace(&text, "\"id\":\\s*\\d+", "\"id\":0");
+    sink += static_cast<uint64_t>(replaced);
+    sink += static_cast<uint64_t>(text.size());
+    return static_cast<size_t>(replaced);
+  }
+
+  // Rule sets for --compile, by case name. The lexer rules are those of the
+  // JSON parser, the infix and shrubbery samples, and the larger YAML rules.
+  const std::vector<std::string>& compile_rules(std::string_view name)
+  {
+    static const std::vector<std::string> json = {
+      "[ \r\n\t]+",
+      ":",
+      ",",
+      "{",
+      "}",
+      R"(\[)",
+      "]",
+      "true",
+      "false",
+      "null",
+      R"(-?(?:0|[1-9][0-9]*)(?:\.[0-9]+)?(?:[eE][-+]?[0-9]+)?)",
+      R"("(?:[^"\\\x00-\x1F]+|\\["\\\/bfnrt]|\\u[[:xdigit:]]{4})*")",
+      ".",
+    };
+
+    static const std::vector<std::string> samples = {
+      "[[:blank:]]+",
+      "=",
+      ";[\r\n]*",
+      R"((\()[[:blank:]]*)",
+      R"(\))",
+      R"([[:digit:]]+\.[[:digit:]]+(?:e[+-]?[[:digit:]]+)?\b)",
+      R"("[^"]*")",
+      R"([[:digit:]]+\b)",
+      "//[^\r\n]*",
+      R"(print\b)",
+      R"([_[:alpha:]][_[:alnum:]]*\b)",
+      "[\r\n]+",
+      R"([[:alpha:]_][[:alnum:]_]*)",
+      R"([!#$%&<>\^?|=+\-*/.:]*[!#$%&<>\^?=*]|[!#$%&<>\^?|=+\-*/.:]+[!#$%&<>\^?|=*]|\.+|\++|-+|::+)",
+    };
+
+    static const std::vector<std::string> yaml = {
+      R"((%YAML[ \t]+([0-9])\.([0-9]))([ \t]+[^#\r\n]+)?(?:[ \t]|\r?\n))",
+      R"(%TAG ([^\s]+) ([^\s]+))",
+      R"([ \t]*\.\.\.(?:\r?\n| )+)",
+      R"((%[[:alpha:]]+(?:[ \t]+[^\s]+))([ \t]+#[^\r\n]*)?)",
+      R"((\.\.\.)([ \t]*|[ \t]+#[^\r\n]*)?\r?\n)",
+      R"(([[a-zA-Z0-9\?:-](?:[^\s]|[^:\r\n] [^\s#])*) *(:)(?:[ \t]+|\r?(\n)))",
+      R"((\*([^\[\]\{\}\, \r\n]+)(:))(?:[ \t]+|\r?(\n)))",
+      R"((&[^\[\]\{\}\, \r\n]+)(?:[ \t]+|\r?(\n)))",
+      R"((![0-9A-Za-z\-]+!|!!|!)(<(?:[\w#;\/\?:@&=+$,_.!~*'()[\]{}]|%\d+)+>)(?:[ \t]+|\r?(\n)))",
+      R"((![0-9A-Za-z\-]+!|!!|!)((?:[\w#;\/\?:@&=+$,_.!~*'()[\]{}]|%\d+)+)(?:[ \t]+|\r?(\n)))",
+      R"(([>|\|])([0-9]|[+-])?([0-9]|[+-])?(#)?(\r?\n)( +))",
+      R"('(?:''|[^'])*'(#)?)",
+      R"("(?:\\\\|\\"|[^"])*"(#)?)",
+      R"((?:[^\s:\?-]|:[^\s]|\?[^\s]|-[^\s])(?:[^\s:#]|:[^\s]|#[^\s]|[ \t][^\s:#])*)",
+      R"((:)?("(?:\\\\|\\"|[^"])*"))",
+      R"((?:[^\s:\?\-,{}[\]]|:[^\s,]|\?[^\s,{}[\]]|-[^\s,{}[\]])(?:[^\s:#,{}[\]]|:[^\s,{}[\]]|#[^\s,{}[\]]|[ \t][^\s:#,{}[\]])*)",
+      R"(([^\r\n]*)((?:\r?\n)+)( *))",
+    };
+
+    // Large alternations, as for the keywords of a language or the names
+    // of an enumeration.
+    static const std::vector<std::string> keywords = []() {
+      static const char* words[] = {
+        "alignas", "alignof", "and", "asm", "auto", "bool", "break", "case",
+        "catch", "char", "class", "concept", "const", "consteval", "constexpr",
+        "constinit", "const_cast", "continue", "decltype", "default", "delete",
+        "do", "double", "dynamic_cast", "else", "enum", "explicit", "export",
+        "extern", "false", "float", "for", "friend", "goto", "if", "inline",
+        "int", "long", "mutable", "namespace", "new", "noexcept", "not",
+        "nullptr", "operator", "or", "private", "protected", "public",
+        "register", "reinterpret_cast", "requires", "return", "short", "signed",
+        "sizeof", "static", "static_assert", "static_cast", "struct", "switch",
+        "template", "this", "thread_local", "throw", "true", "try", "typedef",
+        "typeid", "typename", "union", "unsigned", "using", "virtual", "void",
+        "volatile", "while", "xor"};
+
+      std::string language;
+      for (auto word : words)
+      {
+        if (!language.empty())
+          language += "|";
+        language += word;
+      }
+      language = "(?:" + language + ")\\b";
+
+      std::string names;
+      for (int i = 0; i < 400; i++)
+      {
+        if (!names.empty())
+          names += "|";
+        names += "STATUS_" + std::to_string(i * 7919 % 100000);
+      }
+      return std::vector<std::string>{language, names};
+    }();
+
+    static const std::vector<std::string> unicode = {
+      R"([\p{L}_][\p{L}\p{N}_]*)",
+      R"(\p{Lu}\p{Ll}+)",
+      R"([^\p{L}\p{N}\s]+)",
+      R"(\P{L}+)",
+      R"([\p{Sm}\p{Sc}\p{Sk}\p{So}]+)",
+      R"([\p{Zs}\t]+)",
+    };
+
+    // Patterns of the kind found in user-supplied JSON Schemas.
+    static const std::vector<std::string> schema = {
+      R"(^[a-zA-Z0-9._%+-]+@[a-zA-Z0-9.-]+\.[a-zA-Z]{2,}$)",
+      R"(^\d{4}-\d{2}-\d{2}$)",
+      R"(^\d{4}-\d{2}-\d{2}T\d{2}:\d{2}:\d{2}(?:\.\d+)?(?:Z|[+-]\d{2}:\d{2})$)",
+      R"(^(\([0-9]{3}\))?[0-9]{3}-[0-9]{4}$)",
+      R"(^[A-Z]{2}[0-9]{2}[A-Z0-9]{11,30}$)",
+      R"(^(?:[0-9a-fA-F]{2}:){5}[0-9a-fA-F]{2}$)",
+      R"(^[a-z0-9]+(?:-[a-z0-9]+)*$)",
+      R"(^[0-9a-f]{8}-[0-9a-f]{4}-[1-5][0-9a-f]{3}-[89ab][0-9a-f]{3}-[0-9a-f]{12}$)",
+      R"(^(?:25[0-5]|2[0-4]\d|1?\d?\d)(?:\.(?:25[0-5]|2[0-4]\d|1?\d?\d)){3}$)",
+      R"(^https?://[^\s/$.?#].[^\s]*$)",
+    };
+
+    static const std::vector<std::string> none;
+    if (name == "compile_json")
+      return json;
+    if (name == "compile_samples")
+      return samples;
+    if (name == "compile_yaml")
+      return yaml;
+    if (name == "compile_keywords")
+      return keywords;
+    if (name == "compile_unicode")
+      return unicode;
+    if (name == "compile_schema")
+      return schema;
+    return none;
+  }
+
+  size_t run_compile_once(
+    const std::vector<std::string>& patterns, volatile uint64_t& sink)
+  {
+    size_t compiled = 0;
+    for (const auto& pattern : patterns)
+    {
+      TRegex re(pattern);
+      if (re.ok())
+        compiled++;
+    }
+
+    sink += static_cast<uint64_t>(compiled);
+    return compiled;
+  }
+
   double run_case_once(const BenchmarkCase& tc, volatile uint64_t& sink)
   {
+    static const TRegexSet json_lexer = json_lexer_rules(false);
+    static const TRegexSet json_lexer_combined = json_lexer_rules(true);
+
     auto start = std::chrono::steady_clock::now();
     for (int i = 0; i < tc.iterations; i++)
     {
       if (tc.name == "parser_like")
         (void)run_parser_like_once(sink);
+      else if (tc.name == "unicode_text")
+        (void)run_unicode_text_once(sink);
+      else if (tc.name == "json_lexer")
+        (void)run_json_lexer_once(json_lexer, sink);
+      else if (tc.name == "json_lexer_combined")
+        (void)run_json_lexer_once(json_lexer_combined, sink);
+      else if (tc.name == "json_text")
+        (void)run_json_text_once(json_lexer, sink);
+      else if (tc.name == "json_text_combined")
+        (void)run_json_text_once(json_lexer_combined, sink);
       else if (tc.name == "fullmatch")
         (void)run_fullmatch_once(sink);
       else if (tc.name == "fullmatch_capture")
         (void)run_fullmatch_capture_once(sink);
+      else if (tc.name == "fullmatch_keys")
+        (void)run_fullmatch_keys_once(sink);
+      else if (tc.name == "fullmatch_keys_batch")
+        (void)run_fullmatch_keys_batch_once(sink);
       else if (tc.name == "partialmatch_nocapture")
         (void)run_partialmatch_nocapture_once(sink);
       else if (tc.name == "partialmatch_capture")
         (void)run_partialmatch_capture_once(sink);
       else if (tc.name == "global_replace")
         (void)run_globalreplace_once(sink);
+      else if (tc.name == "redact")
+        (void)run_redact_once(sink);
+      else
+        (void)run_compile_once(compile_rules(tc.name), sink);
     }
     auto end = std::chrono::steady_clock::now();
 
@@ -242,6 +631,42 @@ namespace
     return static_cast<double>(elapsed_ns) / static_cast<double>(tc.iterations);
   }
 
+  // The patterns of the cases above, for reporting the size of their
+  // compiled engines.
+  const std::vector<std::string>& benchmark_patterns()
+  {
+    static const std::vector<std::string> patterns = {
+      "[[:blank:]]+",
+      "[_[:alpha:]][_[:alnum:]]*",
+      "[[:digit:]]+",
+      "==|!=|<=|>=",
+      "[=+\\-*/(),;{}]",
+      "-?(?:0|[1-9][0-9]*)(?:\\.[0-9]+)?(?:[eE][-+]?[0-9]+)?",
+      "\"(?:[^\"\\\\]+|\\\\.)*\"",
+      "([_[:alpha:]][_[:alnum:]]*)([[:blank:]]+)([[:digit:]]+)",
+      "([[:alpha:]]+):([[:digit:]]+)",
+      "token([[:digit:]]+)",
+      "password=\\S+",
+      "[\\p{L}_][\\p{L}\\p{N}_]*",
+    };
+    return patterns;
+  }
+
+  void report_engine_bytes()
+  {
+    size_t total = 0;
+    for (const auto& pattern : benchmark_patterns())
+    {
+      trieste::regex::RegexEngine re(pattern);
+      total += re.memory_usage();
+      std::cout << "BENCH engine_bytes bytes=" << re.memory_usage()
+                << " pattern=" << pattern << std::endl;
+    }
+
+    std::cout << "BENCH engine_bytes_total bytes=" << total
+              << " engines=" << benchmark_patterns().size() << std::endl;
+  }
+
   const BenchmarkCase*
   find_case(const std::vector<BenchmarkCase>& cases, std::string_view name)
   {
@@ -258,17 +683,36 @@ int main(int argc, char** argv)
 {
   std::vector<BenchmarkCase> cases = {
     {"parser_like", 150},
+    {"unicode_text", 150},
+    {"json_lexer", 150},
+    {"json_lexer_combined", 150},
+    {"json_text", 150},
+    {"json_text_combined", 150},
     {"fullmatch", 600},
     {"fullmatch_capture", 500},
+    {"fullmatch_keys", 200},
+    {"fullmatch_keys_batch", 200},
     {"partialmatch_nocapture", 400},
     {"partialmatch_capture", 500},
-    {"global_replace", 280}};
+    {"global_replace", 280},
+    {"redact", 100}};
+
+  // Each iteration compiles every rule of a set, as a parser does when it
+  // is constructed.
+  std::vector<BenchmarkCase> compile_cases = {
+    {"compile_json", 300},
+    {"compile_samples", 300},
+    {"compile_yaml", 200},
+    {"compile_keywords", 60},
+    {"compile_unicode", 100},
+    {"compile_schema", 200}};
 
   std::string focus_case;
   int focus_repeats = 9;
   int warmup_iters = DefaultWarmupIters;
   int iteration_scale_percent = 100;
   bool quick_mode = false;
+  bool compile_mode = false;
 
   for (int i = 1; i < argc; i++)
   {
@@ -293,9 +737,13 @@ int main(int argc, char** argv)
       std::cout << "Usage: trieste_tregex_benchmark [--focus-case=<name>] "
                    "[--focus-repeats=<n>]"
                 << " [--warmup=<n>] [--iteration-scale=<percent>] [--quick]"
-                << std::endl;
+                << " [--compile]" << std::endl;
       return 0;
     }
+    else if (arg == "--compile")
+    {
+      compile_mode = true;
+    }
     else if (arg == "--quick")
     {
       quick_mode = true;
@@ -333,6 +781,9 @@ int main(int argc, char** argv)
   if (quick_mode && focus_case.empty())
     focus_repeats = 1;
 
+  if (compile_mode)
+    cases = compile_cases;
+
   for (auto& tc : cases)
   {
     tc.iterations =
@@ -384,8 +835,11 @@ int main(int argc, char** argv)
 
   std::cout << "BENCH cases=" << cases.size() << " warmup=" << warmup_iters
             << " iteration_scale=" << iteration_scale_percent
-            << " quick=" << (quick_mode ? 1 : 0) << std::endl;
+            << " quick=" << (quick_mode ? 1 : 0)
+            << " compile=" << (compile_mode ? 1 : 0) << std::endl;
 
+  double total_ns = 0.0;
+  size_t total_patterns = 0;
   for (const auto& tc : cases)
   {
     for (int i = 0; i < warmup_iters; i++)
@@ -393,10 +847,27 @@ int main(int argc, char** argv)
 
     const double ns = run_case_once(tc, sink);
     std::cout << std::fixed << std::setprecision(1) << "BENCH case=" << tc.name
-              << " tregex_ns=" << ns << " iterations=" << tc.iterations
-              << std::endl;
+              << " tregex_ns=" << ns << " iterations=" << tc.iterations;
+    if (compile_mode)
+    {
+      const size_t patterns = compile_rules(tc.name).size();
+      std::cout << " patterns=" << patterns;
+      total_ns += ns;
+      total_patterns += patterns;
+    }
+    std::cout << std::endl;
   }
 
+  if (compile_mode)
+  {
+    std::cout << std::fixed << std::setprecision(1)
+              << "BENCH compile_total tregex_ns=" << total_ns
+              << " patterns=" << total_patterns << std::endl;
+  }
+  else
+  {
+    report_engine_bytes();
+  }
   std::cout << "BENCH sink=" << sink << std::endl;
   return 0;
 }